@@ -0,0 +1,196 @@
+#include "allocation_tracking.h"
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <new>
+#include <string_view>
+
+#include <malloc.h>
+
+/*
+	Replaces the global operator new and delete for this module, so every allocation made by our code is counted.
+	Allocations made inside other modules (the D3D12 runtime, the driver) go through their own heaps and are not seen.
+*/
+
+namespace cube {
+	namespace {
+		struct atomic_allocation_counters {
+			std::atomic_uint64_t count;
+			std::atomic_uint64_t bytes;
+		};
+
+		// Only trivial thread-locals here, since they are touched from inside operator new
+		thread_local allocation_tag current_tag {allocation_tag::general};
+		thread_local allocation_sink* current_sink {};
+
+		std::array<atomic_allocation_counters, allocation_tag_count> totals {};
+
+		void count_allocation(std::size_t size) noexcept
+		{
+			if (current_sink)
+				current_sink->add(current_tag, size);
+
+			auto& total = totals.at(static_cast<std::size_t>(current_tag));
+			total.count.fetch_add(1, std::memory_order_relaxed);
+			total.bytes.fetch_add(size, std::memory_order_relaxed);
+		}
+
+		void* allocate(std::size_t size) noexcept
+		{
+			count_allocation(size);
+			return std::malloc(size == 0 ? 1 : size);
+		}
+
+		void* allocate(std::size_t size, std::align_val_t alignment) noexcept
+		{
+			count_allocation(size);
+			return _aligned_malloc(size == 0 ? 1 : size, static_cast<std::size_t>(alignment));
+		}
+
+		void* allocate_or_throw(std::size_t size)
+		{
+			const auto memory = allocate(size);
+			if (!memory)
+				throw std::bad_alloc {};
+
+			return memory;
+		}
+
+		void* allocate_or_throw(std::size_t size, std::align_val_t alignment)
+		{
+			const auto memory = allocate(size, alignment);
+			if (!memory)
+				throw std::bad_alloc {};
+
+			return memory;
+		}
+	}
+}
+
+std::string_view cube::get_name(allocation_tag tag) noexcept
+{
+	switch (tag) {
+	case allocation_tag::general:
+		return "general";
+
+	case allocation_tag::renderer:
+		return "renderer";
+
+	case allocation_tag::simulation:
+		return "simulation";
+
+	case allocation_tag::tracing:
+		return "tracing";
+
+	case allocation_tag::logging:
+		return "logging";
+
+	default:
+		return "unknown";
+	}
+}
+
+cube::allocation_counters cube::allocation_sink::get(allocation_tag tag) const noexcept
+{
+	const auto& counters = m_counters.at(static_cast<std::size_t>(tag));
+	return {counters.count.load(std::memory_order_relaxed), counters.bytes.load(std::memory_order_relaxed)};
+}
+
+cube::allocation_counters cube::allocation_sink::get_total() const noexcept
+{
+	allocation_counters total {};
+	for (const auto& counters : m_counters) {
+		total.count += counters.count.load(std::memory_order_relaxed);
+		total.bytes += counters.bytes.load(std::memory_order_relaxed);
+	}
+
+	return total;
+}
+
+void cube::allocation_sink::reset() noexcept
+{
+	for (auto& counters : m_counters) {
+		counters.count.store(0, std::memory_order_relaxed);
+		counters.bytes.store(0, std::memory_order_relaxed);
+	}
+}
+
+void cube::allocation_sink::add(allocation_tag tag, std::size_t size) noexcept
+{
+	for (auto sink = this; sink; sink = sink->m_parent) {
+		auto& counters = sink->m_counters.at(static_cast<std::size_t>(tag));
+		counters.count.fetch_add(1, std::memory_order_relaxed);
+		counters.bytes.fetch_add(size, std::memory_order_relaxed);
+	}
+}
+
+cube::allocation_context cube::get_allocation_context() noexcept { return {current_tag, current_sink}; }
+
+cube::allocation_counters cube::get_allocation_totals(allocation_tag tag) noexcept
+{
+	const auto& total = totals.at(static_cast<std::size_t>(tag));
+	return {total.count.load(std::memory_order_relaxed), total.bytes.load(std::memory_order_relaxed)};
+}
+
+cube::allocation_tag_scope::allocation_tag_scope(allocation_tag tag) noexcept : m_previous {current_tag}
+{
+	current_tag = tag;
+}
+
+cube::allocation_tag_scope::~allocation_tag_scope() noexcept { current_tag = m_previous; }
+
+cube::allocation_sink_scope::allocation_sink_scope(allocation_sink& sink) noexcept : m_previous {current_sink}
+{
+	sink.m_parent = current_sink;
+	current_sink = &sink;
+}
+
+cube::allocation_sink_scope::~allocation_sink_scope() noexcept { current_sink = m_previous; }
+
+cube::allocation_context_scope::allocation_context_scope(const allocation_context& context) noexcept :
+	m_previous {current_tag, current_sink}
+{
+	current_tag = context.tag;
+	current_sink = context.sink;
+}
+
+cube::allocation_context_scope::~allocation_context_scope() noexcept
+{
+	current_tag = m_previous.tag;
+	current_sink = m_previous.sink;
+}
+
+void* operator new(std::size_t size) { return cube::allocate_or_throw(size); }
+void* operator new[](std::size_t size) { return cube::allocate_or_throw(size); }
+void* operator new(std::size_t size, const std::nothrow_t&) noexcept { return cube::allocate(size); }
+void* operator new[](std::size_t size, const std::nothrow_t&) noexcept { return cube::allocate(size); }
+
+void* operator new(std::size_t size, std::align_val_t alignment) { return cube::allocate_or_throw(size, alignment); }
+void* operator new[](std::size_t size, std::align_val_t alignment) { return cube::allocate_or_throw(size, alignment); }
+
+void* operator new(std::size_t size, std::align_val_t alignment, const std::nothrow_t&) noexcept
+{
+	return cube::allocate(size, alignment);
+}
+
+void* operator new[](std::size_t size, std::align_val_t alignment, const std::nothrow_t&) noexcept
+{
+	return cube::allocate(size, alignment);
+}
+
+void operator delete(void* memory) noexcept { std::free(memory); }
+void operator delete[](void* memory) noexcept { std::free(memory); }
+void operator delete(void* memory, std::size_t) noexcept { std::free(memory); }
+void operator delete[](void* memory, std::size_t) noexcept { std::free(memory); }
+void operator delete(void* memory, const std::nothrow_t&) noexcept { std::free(memory); }
+void operator delete[](void* memory, const std::nothrow_t&) noexcept { std::free(memory); }
+
+void operator delete(void* memory, std::align_val_t) noexcept { _aligned_free(memory); }
+void operator delete[](void* memory, std::align_val_t) noexcept { _aligned_free(memory); }
+void operator delete(void* memory, std::size_t, std::align_val_t) noexcept { _aligned_free(memory); }
+void operator delete[](void* memory, std::size_t, std::align_val_t) noexcept { _aligned_free(memory); }
+void operator delete(void* memory, std::align_val_t, const std::nothrow_t&) noexcept { _aligned_free(memory); }
+void operator delete[](void* memory, std::align_val_t, const std::nothrow_t&) noexcept { _aligned_free(memory); }
@@ -0,0 +1,110 @@
+#ifndef HELIUM_ALLOCATION_TRACKING_H
+#define HELIUM_ALLOCATION_TRACKING_H
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+
+namespace cube {
+	enum class allocation_tag : std::size_t {
+		general,
+		renderer,
+		simulation,
+		tracing,
+		logging,
+		count
+	};
+
+	constexpr auto allocation_tag_count = static_cast<std::size_t>(allocation_tag::count);
+
+	std::string_view get_name(allocation_tag tag) noexcept;
+
+	struct allocation_counters {
+		std::uint64_t count;
+		std::uint64_t bytes;
+	};
+
+	/*
+		Counts the allocations made while it is current, on whichever thread makes them: worker_pool jobs carry
+		their submitter's sink and tag, so work fanned out across the pool counts toward whoever started it. Sinks
+		nest, and an allocation counts toward every enclosing one.
+	*/
+	class allocation_sink {
+	public:
+		allocation_sink() = default;
+
+		allocation_sink(allocation_sink&) = delete;
+		allocation_sink& operator=(allocation_sink&) = delete;
+
+		allocation_counters get(allocation_tag tag) const noexcept;
+		allocation_counters get_total() const noexcept;
+		void reset() noexcept;
+
+		// Called by the global operator new; counts toward the enclosing sinks too
+		void add(allocation_tag tag, std::size_t size) noexcept;
+
+	private:
+		friend class allocation_sink_scope;
+
+		struct atomic_counters {
+			std::atomic_uint64_t count;
+			std::atomic_uint64_t bytes;
+		};
+
+		std::array<atomic_counters, allocation_tag_count> m_counters {};
+		allocation_sink* m_parent {}; // Whichever was current when this one was made current
+	};
+
+	// What the calling thread's allocations are attributed to
+	struct allocation_context {
+		allocation_tag tag;
+		allocation_sink* sink;
+	};
+
+	allocation_context get_allocation_context() noexcept;
+
+	// Process-wide totals, attributed to whichever tag was active on the allocating thread
+	allocation_counters get_allocation_totals(allocation_tag tag) noexcept;
+
+	class allocation_tag_scope {
+	public:
+		explicit allocation_tag_scope(allocation_tag tag) noexcept;
+		~allocation_tag_scope() noexcept;
+
+		allocation_tag_scope(allocation_tag_scope&) = delete;
+		allocation_tag_scope& operator=(allocation_tag_scope&) = delete;
+
+	private:
+		const allocation_tag m_previous;
+	};
+
+	// Makes the sink current on the calling thread, nested in whichever was current before
+	class allocation_sink_scope {
+	public:
+		explicit allocation_sink_scope(allocation_sink& sink) noexcept;
+		~allocation_sink_scope() noexcept;
+
+		allocation_sink_scope(allocation_sink_scope&) = delete;
+		allocation_sink_scope& operator=(allocation_sink_scope&) = delete;
+
+	private:
+		allocation_sink* const m_previous;
+	};
+
+	// Makes a whole context current on the calling thread, as the pool does with each job's
+	class allocation_context_scope {
+	public:
+		explicit allocation_context_scope(const allocation_context& context) noexcept;
+		~allocation_context_scope() noexcept;
+
+		allocation_context_scope(allocation_context_scope&) = delete;
+		allocation_context_scope& operator=(allocation_context_scope&) = delete;
+
+	private:
+		const allocation_context m_previous;
+	};
+}
+
+#endif
@@ -0,0 +1,654 @@
+#include "bvh.h"
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <iterator>
+#include <limits>
+#include <numeric>
+#include <optional>
+#include <vector>
+
+#include <gsl/gsl>
+
+#include "frustum_culling.h"
+#include "trace.h"
+#include "transform_system.h"
+#include "worker_pool.h"
+
+namespace cube {
+	namespace {
+		constexpr std::size_t bin_count {16};
+		constexpr std::size_t max_leaf_size {4};
+		constexpr std::size_t min_subtree_size {4096};
+		constexpr std::size_t chunk_size {65536};
+		constexpr std::size_t max_depth {128}; // Of the traversal stacks, which hold one entry per level and one more
+
+		// Nodes this deep are halved at their median instead, so no tree of 2^32 objects outgrows the stacks
+		constexpr std::size_t median_split_depth {max_depth - 40};
+		constexpr unsigned int all_planes {(1u << 6) - 1};
+
+		using vector3 = std::array<float, 3>;
+
+		struct bin {
+			aabb bounds;
+			std::size_t count;
+		};
+
+		using bin_set = std::array<std::array<bin, bin_count>, 3>;
+
+		struct range_bounds {
+			aabb bounds;
+			aabb centroids;
+		};
+
+		struct split_choice {
+			std::size_t axis;
+			std::size_t last_left_bin;
+			float cost;
+		};
+
+		enum class containment { outside, intersecting, inside };
+
+		aabb get_empty_aabb() noexcept
+		{
+			constexpr auto max = std::numeric_limits<float>::max();
+			return {{max, max, max}, {-max, -max, -max}};
+		}
+
+		void grow(aabb& box, const aabb& other) noexcept
+		{
+			for (std::size_t i {}; i < 3; ++i) {
+				box.min[i] = std::min(box.min[i], other.min[i]);
+				box.max[i] = std::max(box.max[i], other.max[i]);
+			}
+		}
+
+		void grow(aabb& box, const vector3& point) noexcept { grow(box, {point, point}); }
+
+		// Half the surface area, which is all the heuristic needs
+		float get_half_area(const aabb& box) noexcept
+		{
+			const auto x = box.max[0] - box.min[0];
+			const auto y = box.max[1] - box.min[1];
+			const auto z = box.max[2] - box.min[2];
+			if (x < 0.0f || y < 0.0f || z < 0.0f)
+				return 0.0f;
+
+			return x * y + y * z + z * x;
+		}
+
+		bool overlaps(const aabb& first, const aabb& second) noexcept
+		{
+			for (std::size_t i {}; i < 3; ++i) {
+				if (first.max[i] < second.min[i] || second.max[i] < first.min[i])
+					return false;
+			}
+
+			return true;
+		}
+
+		bool contains(const aabb& outer, const aabb& inner) noexcept
+		{
+			for (std::size_t i {}; i < 3; ++i) {
+				if (inner.min[i] < outer.min[i] || inner.max[i] > outer.max[i])
+					return false;
+			}
+
+			return true;
+		}
+
+		vector3 get_centroid(const aabb& box) noexcept
+		{
+			return {
+				(box.min[0] + box.max[0]) * 0.5f, (box.min[1] + box.max[1]) * 0.5f, (box.min[2] + box.max[2]) * 0.5f};
+		}
+
+		// Planes already known to hold the whole box are dropped from the mask, so children skip them
+		containment classify(const frustum& view_frustum, const aabb& box, unsigned int& planes) noexcept
+		{
+			const auto center = get_centroid(box);
+			const vector3 extent {box.max[0] - center[0], box.max[1] - center[1], box.max[2] - center[2]};
+			for (std::size_t i {}; i < view_frustum.planes.size(); ++i) {
+				if ((planes & (1u << i)) == 0)
+					continue;
+
+				const auto& plane = view_frustum.planes[i];
+				const auto distance = plane.x * center[0] + plane.y * center[1] + plane.z * center[2] + plane.w;
+				const auto radius
+					= std::abs(plane.x) * extent[0] + std::abs(plane.y) * extent[1] + std::abs(plane.z) * extent[2];
+
+				if (distance + radius < 0.0f)
+					return containment::outside;
+
+				if (distance - radius >= 0.0f)
+					planes &= ~(1u << i);
+			}
+
+			return planes == 0 ? containment::inside : containment::intersecting;
+		}
+
+		// The entry distance, if the ray enters the box before max_distance
+		std::optional<float>
+		intersect(const aabb& box, const ray& query, const vector3& inverse_direction, float max_distance) noexcept
+		{
+			auto entry_distance = 0.0f;
+			auto exit_distance = max_distance;
+			for (std::size_t i {}; i < 3; ++i) {
+				auto first = (box.min[i] - query.origin[i]) * inverse_direction[i];
+				auto second = (box.max[i] - query.origin[i]) * inverse_direction[i];
+				if (first > second)
+					std::swap(first, second);
+
+				// A NaN from a ray lying in a slab plane leaves the interval alone
+				entry_distance = std::max(entry_distance, first);
+				exit_distance = std::min(exit_distance, second);
+			}
+
+			if (entry_distance > exit_distance)
+				return {};
+
+			return entry_distance;
+		}
+
+		range_bounds measure(
+			gsl::span<const std::uint32_t> indices,
+			gsl::span<const aabb> bounds,
+			gsl::span<const vector3> centroids) noexcept
+		{
+			range_bounds result {get_empty_aabb(), get_empty_aabb()};
+			for (const auto index : indices) {
+				grow(result.bounds, bounds[index]);
+				grow(result.centroids, centroids[index]);
+			}
+
+			return result;
+		}
+
+		std::size_t get_bin(float centroid, float min, float scale) noexcept
+		{
+			return std::min(static_cast<std::size_t>((centroid - min) * scale), bin_count - 1);
+		}
+
+		float get_bin_scale(const aabb& centroids, std::size_t axis) noexcept
+		{
+			const auto extent = centroids.max[axis] - centroids.min[axis];
+			return extent > 0.0f ? bin_count / extent : 0.0f;
+		}
+
+		bin_set get_empty_bins() noexcept
+		{
+			bin_set bins {};
+			for (auto& axis : bins) {
+				for (auto& entry : axis)
+					entry = {get_empty_aabb(), 0};
+			}
+
+			return bins;
+		}
+
+		void fill_bins(
+			bin_set& bins,
+			gsl::span<const std::uint32_t> indices,
+			gsl::span<const aabb> bounds,
+			gsl::span<const vector3> centroids,
+			const aabb& centroid_bounds) noexcept
+		{
+			const std::array scales {
+				get_bin_scale(centroid_bounds, 0),
+				get_bin_scale(centroid_bounds, 1),
+				get_bin_scale(centroid_bounds, 2)};
+
+			for (const auto index : indices) {
+				for (std::size_t axis {}; axis < 3; ++axis) {
+					auto& entry = bins[axis][get_bin(centroids[index][axis], centroid_bounds.min[axis], scales[axis])];
+					grow(entry.bounds, bounds[index]);
+					++entry.count;
+				}
+			}
+		}
+
+		void merge_bins(bin_set& bins, const bin_set& other) noexcept
+		{
+			for (std::size_t axis {}; axis < 3; ++axis) {
+				for (std::size_t i {}; i < bin_count; ++i) {
+					grow(bins[axis][i].bounds, other[axis][i].bounds);
+					bins[axis][i].count += other[axis][i].count;
+				}
+			}
+		}
+
+		std::optional<split_choice> choose_split(const bin_set& bins, const aabb& centroid_bounds) noexcept
+		{
+			std::optional<split_choice> best {};
+			for (std::size_t axis {}; axis < 3; ++axis) {
+				if (centroid_bounds.max[axis] <= centroid_bounds.min[axis])
+					continue;
+
+				// Right-hand costs first, so that a single sweep from the left finds the best plane
+				std::array<float, bin_count> right_costs {};
+				auto right = get_empty_aabb();
+				std::size_t right_count {};
+				for (auto i = bin_count - 1; i > 0; --i) {
+					grow(right, bins[axis][i].bounds);
+					right_count += bins[axis][i].count;
+					right_costs[i] = get_half_area(right) * right_count;
+				}
+
+				auto left = get_empty_aabb();
+				std::size_t left_count {};
+				for (std::size_t i {}; i < bin_count - 1; ++i) {
+					grow(left, bins[axis][i].bounds);
+					left_count += bins[axis][i].count;
+					const auto cost = get_half_area(left) * left_count + right_costs[i + 1];
+					if (left_count != 0 && (!best || cost < best->cost))
+						best = split_choice {axis, i, cost};
+				}
+			}
+
+			return best;
+		}
+
+		std::size_t get_widest_axis(const aabb& box) noexcept
+		{
+			const std::array extents {box.max[0] - box.min[0], box.max[1] - box.min[1], box.max[2] - box.min[2]};
+			return gsl::narrow_cast<std::size_t>(std::ranges::max_element(extents) - extents.begin());
+		}
+
+		// Returns how many objects go to the left child, or zero for a leaf
+		std::size_t partition(
+			gsl::span<std::uint32_t> indices,
+			gsl::span<const vector3> centroids,
+			const range_bounds& measured,
+			const bin_set& bins,
+			std::size_t depth) noexcept
+		{
+			const auto count = indices.size();
+			if (depth >= median_split_depth) {
+				if (count <= max_leaf_size)
+					return 0;
+
+				const auto axis = get_widest_axis(measured.centroids);
+				const auto middle = indices.begin() + gsl::narrow_cast<std::ptrdiff_t>(count / 2);
+				std::nth_element(indices.begin(), middle, indices.end(), [&](std::uint32_t left, std::uint32_t right) {
+					return centroids[left][axis] < centroids[right][axis];
+				});
+
+				return count / 2;
+			}
+
+			const auto split = choose_split(bins, measured.centroids);
+			const auto leaf_cost = get_half_area(measured.bounds) * count;
+			if (count <= max_leaf_size && (!split || split->cost >= leaf_cost))
+				return 0;
+
+			// Every centroid coincides, so any split is as good as another
+			if (!split)
+				return count / 2;
+
+			const auto axis = split->axis;
+			const auto min = measured.centroids.min[axis];
+			const auto scale = get_bin_scale(measured.centroids, axis);
+			const auto middle = std::partition(indices.begin(), indices.end(), [&](std::uint32_t index) {
+				return get_bin(centroids[index][axis], min, scale) <= split->last_left_bin;
+			});
+
+			const auto left_count = gsl::narrow_cast<std::size_t>(middle - indices.begin());
+			return left_count == 0 || left_count == count ? count / 2 : left_count;
+		}
+	}
+}
+
+cube::aabb cube::get_sphere_bounds(const std::array<float, 3>& center, float radius) noexcept
+{
+	return {
+		{center[0] - radius, center[1] - radius, center[2] - radius},
+		{center[0] + radius, center[1] + radius, center[2] + radius}};
+}
+
+void cube::bvh::build(worker_pool& workers, gsl::span<const aabb> bounds)
+{
+	const trace_scope scope {"build bvh"};
+	const auto count = bounds.size();
+	Expects(count < std::numeric_limits<std::uint32_t>::max());
+	m_bounds.assign(bounds.begin(), bounds.end());
+	m_indices.resize(count);
+	std::iota(m_indices.begin(), m_indices.end(), 0u);
+	m_centroids.resize(count);
+	m_leaf_of.resize(count);
+	m_refit_count = 0;
+
+	const auto chunk_count = (count + chunk_size - 1) / chunk_size;
+	workers.run(chunk_count, [this, count](std::size_t chunk) {
+		const auto last = std::min((chunk + 1) * chunk_size, count);
+		for (auto i = chunk * chunk_size; i < last; ++i)
+			m_centroids[i] = get_centroid(m_bounds[i]);
+	});
+
+	m_nodes.clear();
+	if (count == 0)
+		return;
+
+	m_nodes.reserve(count * 2);
+	m_nodes.push_back({get_empty_aabb(), 0, gsl::narrow_cast<std::uint32_t>(count), 0, 0, 0});
+	split_top(workers, std::max(min_subtree_size, count / (workers.size() * 4)));
+
+	m_subtrees.resize(m_subtree_roots.size());
+	workers.run(m_subtree_roots.size(), [this](std::size_t subtree) {
+		auto& nodes = m_subtrees[subtree];
+		nodes.clear();
+		nodes.push_back(m_nodes[m_subtree_roots[subtree]]);
+		build_subtree(nodes);
+	});
+
+	stitch_subtrees();
+	for (std::size_t i {}; i < m_nodes.size(); ++i) {
+		const auto& node = m_nodes[i];
+		if (node.child != 0)
+			continue;
+
+		for (auto j = node.first; j < node.first + node.count; ++j)
+			m_leaf_of[m_indices[j]] = gsl::narrow_cast<std::uint32_t>(i);
+	}
+
+	m_is_stale.assign(m_nodes.size(), false);
+}
+
+void cube::bvh::update(worker_pool& workers, gsl::span<const aabb> bounds, gsl::span<const transform_range> changed)
+{
+	Expects(bounds.size() == m_bounds.size());
+	if (changed.empty())
+		return;
+
+	if (++m_refit_count >= rebuild_interval) {
+		build(workers, bounds);
+		return;
+	}
+
+	for (const auto& range : changed)
+		std::copy_n(bounds.begin() + range.first, range.count, m_bounds.begin() + range.first);
+
+	refit(changed);
+}
+
+std::size_t cube::bvh::cull(const frustum& view_frustum, gsl::span<std::uint32_t> visible) const
+{
+	const trace_scope scope {"bvh cull"};
+	Expects(visible.size() >= m_indices.size());
+	if (m_nodes.empty())
+		return 0;
+
+	struct entry {
+		std::uint32_t node;
+		unsigned int planes;
+	};
+
+	std::array<entry, max_depth> stack {};
+	std::size_t depth {};
+	std::size_t count {};
+	stack[depth++] = {0, all_planes};
+	while (depth != 0) {
+		const auto [index, parent_planes] = stack[--depth];
+		const auto& node = m_nodes[index];
+		auto planes = parent_planes;
+		const auto result = classify(view_frustum, node.bounds, planes);
+		if (result == containment::outside)
+			continue;
+
+		if (result == containment::inside) {
+			const auto first = m_indices.begin() + node.first;
+			std::copy(first, first + node.count, visible.begin() + gsl::narrow_cast<std::ptrdiff_t>(count));
+			count += node.count;
+		} else if (node.child == 0) {
+			for (auto i = node.first; i < node.first + node.count; ++i) {
+				auto object_planes = planes;
+				if (classify(view_frustum, m_bounds[m_indices[i]], object_planes) != containment::outside)
+					visible[count++] = m_indices[i];
+			}
+		} else {
+			Expects(depth + 2 <= stack.size());
+			stack[depth++] = {node.child + 1, planes};
+			stack[depth++] = {node.child, planes};
+		}
+	}
+
+	return count;
+}
+
+std::size_t cube::bvh::cull_reference(const frustum& view_frustum, gsl::span<std::uint32_t> visible) const noexcept
+{
+	Expects(visible.size() >= m_bounds.size());
+	std::size_t count {};
+	for (std::size_t i {}; i < m_bounds.size(); ++i) {
+		auto planes = all_planes;
+		if (classify(view_frustum, m_bounds[i], planes) != containment::outside)
+			visible[count++] = gsl::narrow_cast<std::uint32_t>(i);
+	}
+
+	return count;
+}
+
+std::optional<cube::ray_hit> cube::bvh::raycast(const ray& query, float max_distance) const
+{
+	if (m_nodes.empty())
+		return {};
+
+	const vector3 inverse_direction {1.0f / query.direction[0], 1.0f / query.direction[1], 1.0f / query.direction[2]};
+	struct entry {
+		std::uint32_t node;
+		float distance;
+	};
+
+	std::optional<ray_hit> best {};
+	std::array<entry, max_depth> stack {};
+	std::size_t depth {};
+	if (const auto distance = intersect(m_nodes.front().bounds, query, inverse_direction, max_distance))
+		stack[depth++] = {0, *distance};
+
+	while (depth != 0) {
+		const auto [index, distance] = stack[--depth];
+		if (best && distance >= best->distance)
+			continue;
+
+		const auto& node = m_nodes[index];
+		const auto limit = best ? best->distance : max_distance;
+		if (node.child == 0) {
+			for (auto i = node.first; i < node.first + node.count; ++i) {
+				const auto object = m_indices[i];
+				const auto hit = intersect(m_bounds[object], query, inverse_direction, limit);
+				if (hit && (!best || *hit < best->distance))
+					best = ray_hit {object, *hit};
+			}
+
+			continue;
+		}
+
+		const auto left = intersect(m_nodes[node.child].bounds, query, inverse_direction, limit);
+		const auto right = intersect(m_nodes[node.child + 1].bounds, query, inverse_direction, limit);
+		std::array children {entry {node.child, left.value_or(0.0f)}, entry {node.child + 1, right.value_or(0.0f)}};
+		std::array is_hit {left.has_value(), right.has_value()};
+		if (left && right && *right < *left) {
+			std::swap(children[0], children[1]);
+			std::swap(is_hit[0], is_hit[1]);
+		}
+
+		// The nearer child goes on top, so it is visited first and can prune the other
+		Expects(depth + 2 <= stack.size());
+		for (auto i = children.size(); i-- > 0;) {
+			if (is_hit[i])
+				stack[depth++] = children[i];
+		}
+	}
+
+	return best;
+}
+
+void cube::bvh::overlap(const aabb& query, std::vector<std::uint32_t>& results) const
+{
+	if (m_nodes.empty())
+		return;
+
+	std::array<std::uint32_t, max_depth> stack {};
+	std::size_t depth {};
+	stack[depth++] = 0;
+	while (depth != 0) {
+		const auto& node = m_nodes[stack[--depth]];
+		if (!overlaps(query, node.bounds))
+			continue;
+
+		const auto first = m_indices.begin() + node.first;
+		if (contains(query, node.bounds)) {
+			results.insert(results.end(), first, first + node.count);
+		} else if (node.child == 0) {
+			std::copy_if(first, first + node.count, std::back_inserter(results), [this, &query](std::uint32_t index) {
+				return overlaps(query, m_bounds[index]);
+			});
+		} else {
+			Expects(depth + 2 <= stack.size());
+			stack[depth++] = node.child + 1;
+			stack[depth++] = node.child;
+		}
+	}
+}
+
+// Splits breadth-first, binning large nodes across the pool, until every open node is small enough to be a subtree
+void cube::bvh::split_top(worker_pool& workers, std::size_t subtree_size)
+{
+	m_subtree_roots.clear();
+	std::vector<range_bounds> chunk_bounds {};
+	std::vector<bin_set> chunk_bins {};
+	for (std::size_t open {}; open < m_nodes.size(); ++open) {
+		const auto first = m_nodes[open].first;
+		const auto count = m_nodes[open].count;
+		if (count <= subtree_size) {
+			m_subtree_roots.push_back(gsl::narrow_cast<std::uint32_t>(open));
+			continue;
+		}
+
+		const auto indices = gsl::span<std::uint32_t> {m_indices}.subspan(first, count);
+		const auto chunk_count = (count + chunk_size - 1) / chunk_size;
+		chunk_bounds.resize(chunk_count);
+		workers.run(chunk_count, [this, indices, &chunk_bounds](std::size_t chunk) {
+			const auto last = std::min((chunk + 1) * chunk_size, indices.size());
+			chunk_bounds[chunk]
+				= measure(indices.subspan(chunk * chunk_size, last - chunk * chunk_size), m_bounds, m_centroids);
+		});
+
+		range_bounds measured {get_empty_aabb(), get_empty_aabb()};
+		for (const auto& bounds : chunk_bounds) {
+			grow(measured.bounds, bounds.bounds);
+			grow(measured.centroids, bounds.centroids);
+		}
+
+		chunk_bins.resize(chunk_count);
+		workers.run(chunk_count, [this, indices, &chunk_bins, &measured](std::size_t chunk) {
+			const auto last = std::min((chunk + 1) * chunk_size, indices.size());
+			chunk_bins[chunk] = get_empty_bins();
+			fill_bins(
+				chunk_bins[chunk],
+				indices.subspan(chunk * chunk_size, last - chunk * chunk_size),
+				m_bounds,
+				m_centroids,
+				measured.centroids);
+		});
+
+		auto bins = get_empty_bins();
+		for (const auto& chunk : chunk_bins)
+			merge_bins(bins, chunk);
+
+		m_nodes[open].bounds = measured.bounds;
+		const auto depth = m_nodes[open].depth;
+		const auto left_count
+			= gsl::narrow_cast<std::uint32_t>(partition(indices, m_centroids, measured, bins, depth));
+
+		const auto parent = gsl::narrow_cast<std::uint32_t>(open);
+		m_nodes[open].child = gsl::narrow_cast<std::uint32_t>(m_nodes.size());
+		m_nodes.push_back({get_empty_aabb(), first, left_count, 0, parent, depth + 1});
+		m_nodes.push_back({get_empty_aabb(), first + left_count, count - left_count, 0, parent, depth + 1});
+	}
+}
+
+// The root is nodes.front(); children are appended after their parents
+void cube::bvh::build_subtree(std::vector<node>& nodes)
+{
+	for (std::size_t current {}; current < nodes.size(); ++current) {
+		const auto first = nodes[current].first;
+		const auto count = nodes[current].count;
+		const auto indices = gsl::span<std::uint32_t> {m_indices}.subspan(first, count);
+		const auto measured = measure(indices, m_bounds, m_centroids);
+		auto bins = get_empty_bins();
+		fill_bins(bins, indices, m_bounds, m_centroids, measured.centroids);
+		nodes[current].bounds = measured.bounds;
+		const auto depth = nodes[current].depth;
+		const auto left_count
+			= gsl::narrow_cast<std::uint32_t>(partition(indices, m_centroids, measured, bins, depth));
+
+		if (left_count == 0)
+			continue;
+
+		const auto parent = gsl::narrow_cast<std::uint32_t>(current);
+		nodes[current].child = gsl::narrow_cast<std::uint32_t>(nodes.size());
+		nodes.push_back({get_empty_aabb(), first, left_count, 0, parent, depth + 1});
+		nodes.push_back({get_empty_aabb(), first + left_count, count - left_count, 0, parent, depth + 1});
+	}
+}
+
+// Each subtree's root replaces its placeholder, and the rest of its nodes are appended in order
+void cube::bvh::stitch_subtrees()
+{
+	for (std::size_t subtree {}; subtree < m_subtree_roots.size(); ++subtree) {
+		const auto root = m_subtree_roots[subtree];
+		const auto base = gsl::narrow_cast<std::uint32_t>(m_nodes.size()) - 1;
+		const auto& nodes = m_subtrees[subtree];
+		const auto map = [root, base](std::uint32_t local) { return local == 0 ? root : base + local; };
+		for (std::size_t i {}; i < nodes.size(); ++i) {
+			auto node = nodes[i];
+			if (node.child != 0)
+				node.child = map(node.child);
+
+			if (i == 0) {
+				m_nodes[root] = node;
+			} else {
+				node.parent = map(node.parent);
+				m_nodes.push_back(node);
+			}
+		}
+	}
+}
+
+// Parents always come before their children, so one backwards pass sees children before parents
+void cube::bvh::refit(gsl::span<const transform_range> changed)
+{
+	const trace_scope scope {"refit bvh"};
+	for (const auto& range : changed) {
+		for (auto object = range.first; object < range.first + range.count; ++object) {
+			auto node = m_leaf_of[object];
+			while (!m_is_stale[node]) {
+				m_is_stale[node] = true;
+				if (node == 0)
+					break;
+
+				node = m_nodes[node].parent;
+			}
+		}
+	}
+
+	for (auto i = m_nodes.size(); i-- > 0;) {
+		if (!m_is_stale[i])
+			continue;
+
+		auto& node = m_nodes[i];
+		node.bounds = get_empty_aabb();
+		if (node.child == 0) {
+			for (auto j = node.first; j < node.first + node.count; ++j)
+				grow(node.bounds, m_bounds[m_indices[j]]);
+		} else {
+			grow(node.bounds, m_nodes[node.child].bounds);
+			grow(node.bounds, m_nodes[node.child + 1].bounds);
+		}
+
+		m_is_stale[i] = false;
+	}
+}
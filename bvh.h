@@ -0,0 +1,92 @@
+#ifndef HELIUM_BVH_H
+#define HELIUM_BVH_H
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <vector>
+
+#include <gsl/gsl>
+
+#include "frustum_culling.h"
+#include "transform_system.h"
+#include "worker_pool.h"
+
+namespace cube {
+	struct aabb {
+		std::array<float, 3> min;
+		std::array<float, 3> max;
+	};
+
+	aabb get_sphere_bounds(const std::array<float, 3>& center, float radius) noexcept;
+
+	struct ray {
+		std::array<float, 3> origin;
+		std::array<float, 3> direction; // Need not be normalized; distances are in multiples of it
+	};
+
+	struct ray_hit {
+		std::uint32_t index;
+		float distance;
+	};
+
+	/*
+		Bounding volume hierarchy over object bounds, built top-down with a binned surface area heuristic. The
+		top of the tree is split with binning spread across the pool, then the remaining subtrees are built in
+		parallel and stitched in. Every node covers a contiguous run of the index array, so whole subtrees can be
+		reported without visiting their leaves.
+	*/
+	class bvh {
+	public:
+		// Refits since the last build before the tree is rebuilt, as refits let the boxes grow loose
+		static constexpr unsigned int rebuild_interval {256};
+
+		void build(worker_pool& workers, gsl::span<const aabb> bounds);
+
+		// Refits the leaves holding the changed objects and their ancestors, and rebuilds every rebuild_interval
+		// refits; the object count must not change
+		void update(worker_pool& workers, gsl::span<const aabb> bounds, gsl::span<const transform_range> changed);
+
+		// Writes the objects whose boxes touch the frustum and returns how many; visible must hold every object
+		std::size_t cull(const frustum& view_frustum, gsl::span<std::uint32_t> visible) const;
+
+		// Finds what cull() does by testing every box without the tree, writing the objects in order
+		std::size_t cull_reference(const frustum& view_frustum, gsl::span<std::uint32_t> visible) const noexcept;
+
+		// The nearest object box the ray enters within max_distance
+		std::optional<ray_hit> raycast(const ray& query, float max_distance) const;
+
+		// Appends the objects whose boxes overlap the query box
+		void overlap(const aabb& query, std::vector<std::uint32_t>& results) const;
+
+		std::size_t size() const noexcept { return m_indices.size(); }
+
+	private:
+		struct node {
+			aabb bounds;
+			std::uint32_t first; // Into m_indices
+			std::uint32_t count;
+			std::uint32_t child; // The left child, with the right one after it; zero for leaves
+			std::uint32_t parent;
+			std::uint32_t depth; // Levels below the root
+		};
+
+		std::vector<node> m_nodes {};
+		std::vector<aabb> m_bounds {};
+		std::vector<std::uint32_t> m_indices {};
+		std::vector<std::uint32_t> m_leaf_of {}; // The leaf holding each object
+		std::vector<std::array<float, 3>> m_centroids {};
+		std::vector<std::uint32_t> m_subtree_roots {};
+		std::vector<std::vector<node>> m_subtrees {};
+		std::vector<bool> m_is_stale {};
+		unsigned int m_refit_count {};
+
+		void split_top(worker_pool& workers, std::size_t subtree_size);
+		void build_subtree(std::vector<node>& nodes);
+		void stitch_subtrees();
+		void refit(gsl::span<const transform_range> changed);
+	};
+}
+
+#endif
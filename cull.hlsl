@@ -0,0 +1,76 @@
+// Must match gpu_cull_constants and cull_indirect_reference() in gpu_culling.h
+cbuffer constants : register(b0)
+{
+	float4 planes[6];
+	uint instance_count;
+	uint index_count;
+}
+
+// Center and radius
+StructuredBuffer<float4> bounds : register(t0);
+
+// Laid out as D3D12_DRAW_INDEXED_ARGUMENTS, after the root constant for the draw's first visible instance
+struct draw_arguments {
+	uint first_visible;
+	uint index_count;
+	uint instance_count;
+	uint first_index;
+	int base_vertex;
+	uint first_instance;
+};
+
+RWStructuredBuffer<uint> visible : register(u0);
+RWStructuredBuffer<draw_arguments> arguments : register(u1);
+RWStructuredBuffer<uint> count : register(u2);
+
+#define GROUP_SIZE 64
+
+groupshared uint is_visible_shared[GROUP_SIZE];
+
+// Each group packs its visible instances in order into its own slice of the visible list and writes its own draw,
+// so the output doesn't depend on how groups are scheduled
+[numthreads(GROUP_SIZE, 1, 1)]
+void main(uint3 group : SV_GroupID, uint thread : SV_GroupIndex, uint3 id : SV_DispatchThreadID)
+{
+	bool is_visible = id.x < instance_count;
+	if (is_visible) {
+		const float4 sphere = bounds[id.x];
+		const float negative_radius = 0.0f - sphere.w;
+
+		[unroll]
+		for (uint i = 0; i < 6; ++i) {
+			// Kept from being fused or reordered, so that the CPU reference gets the same bits
+			precise const float distance
+				= ((planes[i].x * sphere.x + planes[i].y * sphere.y) + planes[i].z * sphere.z) + planes[i].w;
+
+			is_visible = is_visible && distance >= negative_radius;
+		}
+	}
+
+	is_visible_shared[thread] = is_visible ? 1 : 0;
+	GroupMemoryBarrierWithGroupSync();
+
+	uint slot = 0;
+	uint total = 0;
+	for (uint i = 0; i < GROUP_SIZE; ++i) {
+		slot += i < thread ? is_visible_shared[i] : 0;
+		total += is_visible_shared[i];
+	}
+
+	const uint first = group.x * GROUP_SIZE;
+	if (is_visible)
+		visible[first + slot] = id.x;
+
+	if (thread == 0) {
+		draw_arguments draw;
+		draw.first_visible = first;
+		draw.index_count = index_count;
+		draw.instance_count = total;
+		draw.first_index = 0;
+		draw.base_vertex = 0;
+		draw.first_instance = 0;
+		arguments[group.x] = draw;
+		if (total != 0)
+			InterlockedMax(count[0], group.x + 1);
+	}
+}
@@ -0,0 +1,309 @@
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <exception>
+#include <iostream>
+#include <random>
+#include <source_location>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <gsl/gsl>
+
+#include <DirectXMath.h>
+
+#include "frustum_culling.h"
+#include "gpu_culling.h"
+#include "lod.h"
+#include "occlusion_culling.h"
+#include "worker_pool.h"
+
+namespace cube {
+	namespace {
+		// Looks down +z from the origin, as the renderer's camera does before it moves
+		const frustum test_frustum {
+			extract_frustum(DirectX::XMMatrixPerspectiveFovLH(3.141f / 2.0f, 1.0f, 0.1f, 1000.0f))};
+
+		// The occlusion culler's depth buffer is twice as wide as it is tall
+		const DirectX::XMMATRIX occlusion_view_projection {
+			DirectX::XMMatrixPerspectiveFovLH(3.141f / 2.0f, 2.0f, 0.1f, 1000.0f)};
+
+		constexpr DirectX::XMFLOAT3 in_view {0.0f, 0.0f, 20.0f};
+		constexpr DirectX::XMFLOAT3 behind_camera {0.0f, 0.0f, -20.0f};
+
+		void check(bool condition, const std::source_location location = std::source_location::current())
+		{
+			if (!condition)
+				throw std::logic_error {"check failed on line " + std::to_string(location.line())};
+		}
+
+		// Places the instances that pass is_visible in view and the rest behind the camera
+		template <typename predicate_type>
+		sphere_set make_spheres(std::size_t count, predicate_type is_visible)
+		{
+			sphere_set spheres {count};
+			for (std::size_t i {}; i < count; ++i)
+				spheres.set(i, is_visible(i) ? in_view : behind_camera, 1.0f);
+
+			return spheres;
+		}
+
+		std::vector<culling_kernel> get_testable_kernels()
+		{
+			if (is_avx_supported())
+				return {culling_kernel::avx, culling_kernel::sse};
+
+			return {culling_kernel::sse};
+		}
+
+		void test_sphere_kernels()
+		{
+			// Scattered across the frustum's edges, so that both sides of every plane are hit
+			constexpr std::size_t count {1003};
+			std::mt19937 generator {};
+			std::uniform_real_distribution<float> lateral {-40.0f, 40.0f};
+			std::uniform_real_distribution<float> depth {-5.0f, 40.0f};
+			std::uniform_real_distribution<float> radius {0.0f, 4.0f};
+			sphere_set spheres {count};
+			for (std::size_t i {}; i < count; ++i)
+				spheres.set(i, {lateral(generator), lateral(generator), depth(generator)}, radius(generator));
+
+			std::vector<std::uint32_t> expected(count);
+			std::vector<std::uint32_t> visible(count);
+			using range = std::pair<std::size_t, std::size_t>;
+			const std::array ranges {range {0, count}, range {64, 512}, range {8, 13}};
+			for (const auto kernel : get_testable_kernels()) {
+				for (const auto& [first, last] : ranges) {
+					const auto expected_count = cull_spheres_reference(test_frustum, spheres, first, last, expected);
+					check(expected_count != 0 && expected_count != last - first);
+					check(cull_spheres(test_frustum, spheres, first, last, visible, kernel) == expected_count);
+					check(std::equal(expected.begin(), expected.begin() + expected_count, visible.begin()));
+				}
+			}
+		}
+
+		void test_sphere_kernel_tails()
+		{
+			// Every sphere is visible, so any lane past the end that slipped through would show up
+			constexpr std::size_t count {40};
+			const auto spheres = make_spheres(count, [](std::size_t) { return true; });
+			std::vector<std::uint32_t> visible(count);
+			for (const auto kernel : get_testable_kernels()) {
+				for (std::size_t first {}; first <= sphere_set::batch_size; first += sphere_set::batch_size) {
+					for (auto last = first; last <= count; ++last) {
+						check(cull_spheres(test_frustum, spheres, first, last, visible, kernel) == last - first);
+						for (auto i = first; i < last; ++i)
+							check(visible[i - first] == i);
+					}
+				}
+			}
+		}
+
+		void test_indirect_group_slices()
+		{
+			// The last group is partial, and the second and last have nothing visible
+			constexpr std::size_t instance_count {3 * gpu_cull_group_size + 8};
+			const auto is_visible = [](std::size_t i) {
+				const auto group = i / gpu_cull_group_size;
+				return (group == 0 && i % 3 == 0) || (group == 2 && i % 5 == 0);
+			};
+
+			const auto spheres = make_spheres(instance_count, is_visible);
+			const gpu_cull_constants constants {test_frustum, instance_count, 36};
+			std::vector<std::uint32_t> visible(instance_count);
+			std::vector<indirect_draw> draws(get_gpu_cull_group_count(instance_count), {~0u, ~0u, ~0u, ~0u, -1, ~0u});
+			check(cull_indirect_reference(constants, spheres, visible, draws) == 3);
+
+			for (std::size_t group {}; group < draws.size(); ++group) {
+				const auto first = group * gpu_cull_group_size;
+				const auto last = std::min(first + gpu_cull_group_size, instance_count);
+				std::vector<std::uint32_t> expected {};
+				for (auto i = first; i < last; ++i) {
+					if (is_visible(i))
+						expected.push_back(gsl::narrow_cast<std::uint32_t>(i));
+				}
+
+				const auto& draw = draws[group];
+				check(draw.first_visible == first && draw.index_count == constants.index_count);
+				check(draw.first_index == 0 && draw.base_vertex == 0 && draw.first_instance == 0);
+				check(draw.instance_count == expected.size());
+				check(std::equal(expected.begin(), expected.end(), visible.begin() + first));
+			}
+		}
+
+		void test_indirect_nothing_visible()
+		{
+			constexpr std::size_t instance_count {2 * gpu_cull_group_size};
+			const auto spheres = make_spheres(instance_count, [](std::size_t) { return false; });
+			const gpu_cull_constants constants {test_frustum, instance_count, 36};
+			std::vector<std::uint32_t> visible(instance_count);
+			std::vector<indirect_draw> draws(get_gpu_cull_group_count(instance_count), {~0u, ~0u, ~0u, ~0u, -1, ~0u});
+			check(cull_indirect_reference(constants, spheres, visible, draws) == 0);
+			for (std::size_t group {}; group < draws.size(); ++group)
+				check(draws[group].first_visible == group * gpu_cull_group_size && draws[group].instance_count == 0);
+		}
+
+		void test_indirect_count_buffer()
+		{
+			// Only the last instance of the last group is visible, so every group's draw is kept
+			constexpr std::size_t instance_count {3 * gpu_cull_group_size};
+			const auto spheres = make_spheres(instance_count, [](std::size_t i) { return i == instance_count - 1; });
+			const gpu_cull_constants constants {test_frustum, instance_count, 36};
+			std::vector<std::uint32_t> visible(instance_count);
+			std::vector<indirect_draw> draws(get_gpu_cull_group_count(instance_count));
+			check(cull_indirect_reference(constants, spheres, visible, draws) == 3);
+			check(draws[2].instance_count == 1 && visible[2 * gpu_cull_group_size] == instance_count - 1);
+
+			// An instance count of zero runs no groups
+			const gpu_cull_constants empty {test_frustum, 0, 36};
+			check(cull_indirect_reference(empty, spheres, visible, draws) == 0);
+		}
+
+		// A wall filling the middle half of the view, and boxes around it
+		constexpr aabb occluder {{-10.0f, -10.0f, 10.0f}, {10.0f, 10.0f, 11.0f}};
+		constexpr aabb hidden {{-2.0f, -2.0f, 30.0f}, {2.0f, 2.0f, 32.0f}};
+		constexpr aabb partly_visible {{20.0f, -2.0f, 30.0f}, {60.0f, 2.0f, 32.0f}};
+		constexpr aabb crossing_near_plane {{-1.0f, -1.0f, -1.0f}, {1.0f, 1.0f, 40.0f}};
+		constexpr aabb in_front {{-1.0f, -1.0f, 5.0f}, {1.0f, 1.0f, 6.0f}};
+
+		void test_occlusion()
+		{
+			worker_pool workers {get_default_worker_count()};
+			const std::array boxes {occluder, hidden, partly_visible, crossing_near_plane, in_front};
+			const std::array<std::uint32_t, 1> occluders {0};
+			occlusion_culler culler {boxes.size()};
+			culler.render_occluders(workers, occlusion_view_projection, boxes, occluders);
+			check(culler.get_depth(occlusion_culler::width / 2, occlusion_culler::height / 2) < 1.0f);
+			check(culler.get_depth(0, 0) == 1.0f);
+
+			check(culler.is_occluded(hidden));
+			check(!culler.is_occluded(partly_visible));
+			check(!culler.is_occluded(crossing_near_plane));
+			check(!culler.is_occluded(in_front));
+			check(!culler.is_occluded(occluder));
+
+			const std::array<std::uint32_t, 4> candidates {1, 2, 3, 4};
+			const auto visible = culler.cull(workers, boxes, candidates);
+			const std::array<std::uint32_t, 3> expected {2, 3, 4};
+			check(std::equal(visible.begin(), visible.end(), expected.begin(), expected.end()));
+		}
+
+		void test_occlusion_pool_sizes()
+		{
+			// A grid of small boxes behind and around a few walls, culled by one thread and then by several
+			std::vector<aabb> boxes {occluder, {{-40.0f, -5.0f, 20.0f}, {-15.0f, 5.0f, 21.0f}}};
+			for (auto x = -60; x <= 60; x += 3) {
+				for (auto y = -30; y <= 30; y += 3) {
+					for (auto z = 8; z <= 48; z += 8) {
+						const auto left = gsl::narrow_cast<float>(x);
+						const auto bottom = gsl::narrow_cast<float>(y);
+						const auto front = gsl::narrow_cast<float>(z);
+						boxes.push_back({{left, bottom, front}, {left + 2.0f, bottom + 2.0f, front + 2.0f}});
+					}
+				}
+			}
+
+			std::vector<std::uint32_t> candidates(boxes.size() - 2);
+			for (std::size_t i {}; i < candidates.size(); ++i)
+				candidates[i] = gsl::narrow_cast<std::uint32_t>(i + 2);
+
+			const std::array<std::uint32_t, 2> occluders {0, 1};
+			const auto cull = [&](worker_pool& workers, occlusion_culler& culler) {
+				culler.render_occluders(workers, occlusion_view_projection, boxes, occluders);
+				const auto visible = culler.cull(workers, boxes, candidates);
+				return std::vector<std::uint32_t> {visible.begin(), visible.end()};
+			};
+
+			worker_pool serial {0};
+			worker_pool parallel {std::max<std::size_t>(get_default_worker_count(), 3)};
+			occlusion_culler serial_culler {boxes.size()};
+			occlusion_culler parallel_culler {boxes.size()};
+			const auto serial_visible = cull(serial, serial_culler);
+			const auto parallel_visible = cull(parallel, parallel_culler);
+			check(serial_visible.size() < candidates.size() && serial_visible == parallel_visible);
+			for (std::size_t y {}; y < occlusion_culler::height; ++y) {
+				for (std::size_t x {}; x < occlusion_culler::width; ++x)
+					check(serial_culler.get_depth(x, y) == parallel_culler.get_depth(x, y));
+			}
+		}
+
+		void test_lod_selection()
+		{
+			// Instances at every distance, visited in a scattered order that leaves a partial batch at the end
+			constexpr std::size_t count {4099};
+			std::mt19937 generator {};
+			std::uniform_real_distribution<float> lateral {-50.0f, 50.0f};
+			std::uniform_real_distribution<float> depth {-10.0f, 400.0f};
+			std::uniform_real_distribution<float> radius {0.5f, 2.0f};
+			std::uniform_int_distribution<int> level {0, max_lod_levels - 1};
+			sphere_set spheres {count};
+			std::vector<std::uint8_t> levels(count);
+			for (std::size_t i {}; i < count; ++i) {
+				spheres.set(i, {lateral(generator), lateral(generator), depth(generator)}, radius(generator));
+				levels[i] = gsl::narrow_cast<std::uint8_t>(level(generator));
+			}
+
+			std::vector<std::uint32_t> instances(count);
+			for (std::size_t i {}; i < count; ++i)
+				instances[i] = gsl::narrow_cast<std::uint32_t>(i);
+
+			std::shuffle(instances.begin(), instances.end(), generator);
+			instances.resize(count - count / 3);
+
+			const std::array errors {0.0f, 0.002f, 0.01f, 0.05f};
+			const auto lods = make_lod_parameters(
+				DirectX::XMMatrixIdentity(),
+				DirectX::XMMatrixPerspectiveFovLH(3.141f / 2.0f, 1.0f, 0.1f, 1000.0f),
+				1080,
+				errors,
+				1.0f,
+				0.2f);
+
+			auto expected = levels;
+			select_lods_reference(lods, spheres, instances, expected);
+			check(std::ranges::count(expected, std::uint8_t {0}) != 0);
+			check(std::ranges::count(expected, std::uint8_t {max_lod_levels - 1}) != 0);
+
+			auto selected = levels;
+			select_lods(lods, spheres, instances, selected);
+			check(selected == expected);
+
+			worker_pool workers {get_default_worker_count()};
+			selected = levels;
+			select_lods(workers, lods, spheres, instances, selected);
+			check(selected == expected);
+		}
+	}
+}
+
+int main()
+{
+	using namespace cube;
+
+	const std::array tests {
+		std::pair {"sphere kernels", &test_sphere_kernels},
+		std::pair {"sphere kernel tails", &test_sphere_kernel_tails},
+		std::pair {"indirect group slices", &test_indirect_group_slices},
+		std::pair {"indirect with nothing visible", &test_indirect_nothing_visible},
+		std::pair {"indirect count buffer", &test_indirect_count_buffer},
+		std::pair {"occlusion", &test_occlusion},
+		std::pair {"occlusion across pool sizes", &test_occlusion_pool_sizes},
+		std::pair {"level of detail selection", &test_lod_selection}};
+
+	auto failures = 0;
+	for (const auto& [name, test] : tests) {
+		try {
+			test();
+			std::cout << "passed: " << name << '\n';
+		}
+		catch (const std::exception& error) {
+			std::cout << "FAILED: " << name << ": " << error.what() << '\n';
+			++failures;
+		}
+	}
+
+	return failures == 0 ? 0 : 1;
+}
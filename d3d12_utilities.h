@@ -1,6 +1,9 @@
 #ifndef HELIUM_D3D12_UTILITIES_H
 #define HELIUM_D3D12_UTILITIES_H
 
+#include <algorithm>
+#include <array>
+#include <chrono>
 #include <cstddef>
 #include <cstdint>
 #include <utility>
@@ -14,6 +17,8 @@
 #include <d3d12.h>
 #include <dxgi1_6.h>
 
+#include "fence_timeline.h"
+
 namespace cube {
 	auto transition(ID3D12Resource& resource, D3D12_RESOURCE_STATES before, D3D12_RESOURCE_STATES after) noexcept
 	{
@@ -46,6 +51,8 @@ namespace cube {
 	struct extent2d {
 		unsigned int width;
 		unsigned int height;
+
+		friend bool operator==(const extent2d&, const extent2d&) = default;
 	};
 
 	extent2d get_extent(IDXGISwapChain1& swap_chain)
@@ -55,37 +62,99 @@ namespace cube {
 		return {info.Width, info.Height};
 	}
 
-	class gpu_fence {
+	class d3d12_fence {
 	public:
-		gpu_fence(ID3D12Device& device, std::uint64_t initial_value = 0) :
-			m_value {initial_value},
+		d3d12_fence(ID3D12Device& device, std::uint64_t initial_value = 0) :
 			m_fence {
-				winrt::capture<ID3D12Fence>(&device, &ID3D12Device::CreateFence, initial_value, D3D12_FENCE_FLAG_NONE)},
-			m_event {winrt::check_pointer(CreateEvent(nullptr, false, false, nullptr))}
+				winrt::capture<ID3D12Fence>(&device, &ID3D12Device::CreateFence, initial_value, D3D12_FENCE_FLAG_NONE)}
 		{
 		}
 
-		// Otherwise counts get out of sync
-		gpu_fence(gpu_fence&) = delete;
-		gpu_fence& operator=(gpu_fence&) = delete;
+		d3d12_fence(d3d12_fence&) = delete;
+		d3d12_fence& operator=(d3d12_fence&) = delete;
 
-		void bump(ID3D12CommandQueue& queue) { winrt::check_hresult(queue.Signal(m_fence.get(), ++m_value)); }
+		std::uint64_t completed_value() const { return m_fence->GetCompletedValue(); }
 
-		// TODO: This may not be the right API...
-		void block(std::uint64_t offset = 0)
+		void signal(ID3D12CommandQueue& queue, std::uint64_t value)
 		{
-			if (m_fence->GetCompletedValue() < m_value - offset) {
-				winrt::check_hresult(m_fence->SetEventOnCompletion(m_value, m_event.get()));
-				winrt::check_bool(WaitForSingleObject(m_event.get(), INFINITE) == WAIT_OBJECT_0);
-			}
+			winrt::check_hresult(queue.Signal(m_fence.get(), value));
+		}
+
+		bool wait(std::uint64_t value, fence_timeout timeout)
+		{
+			const auto event = get_wait_event();
+			winrt::check_hresult(m_fence->SetEventOnCompletion(value, event));
+			return wait_for_event(event, timeout, [this, value] { return completed_value() >= value; });
+		}
+
+		static bool wait_multiple(
+			gsl::span<d3d12_fence* const> fences,
+			gsl::span<const std::uint64_t> values,
+			bool wait_all,
+			fence_timeout timeout)
+		{
+			Expects(!fences.empty() && fences.size() == values.size() && fences.size() <= max_fence_waits);
+			std::array<ID3D12Fence*, max_fence_waits> handles {};
+			std::transform(
+				fences.begin(), fences.end(), handles.begin(), [](auto fence) { return fence->m_fence.get(); });
+
+			const auto event = get_wait_event();
+			const auto device = winrt::capture<ID3D12Device1>(handles.front(), &ID3D12Fence::GetDevice);
+			winrt::check_hresult(device->SetEventOnMultipleFenceCompletion(
+				handles.data(),
+				values.data(),
+				gsl::narrow_cast<UINT>(fences.size()),
+				wait_all ? D3D12_MULTIPLE_FENCE_WAIT_FLAG_ALL : D3D12_MULTIPLE_FENCE_WAIT_FLAG_ANY,
+				event));
+
+			return wait_for_event(event, timeout, [fences, values, wait_all] {
+				for (gsl::index i {}; i < gsl::narrow_cast<gsl::index>(fences.size()); ++i) {
+					const auto is_complete = fences[i]->completed_value() >= values[i];
+					if (is_complete != wait_all)
+						return is_complete;
+				}
+
+				return wait_all;
+			});
 		}
 
 	private:
-		std::uint64_t m_value {};
 		const winrt::com_ptr<ID3D12Fence> m_fence {};
-		const winrt::handle m_event {};
+
+		// One event per waiting thread, so that the completion thread and the render thread never share one
+		static HANDLE get_wait_event()
+		{
+			thread_local const winrt::handle event {winrt::check_pointer(CreateEvent(nullptr, false, false, nullptr))};
+			return event.get();
+		}
+
+		// A timed-out wait leaves its registration behind, so the event may fire early for a later wait
+		template <typename predicate_type>
+		static bool wait_for_event(HANDLE event, fence_timeout timeout, predicate_type is_complete)
+		{
+			using clock = std::chrono::steady_clock;
+			const auto is_infinite = timeout == infinite_timeout;
+			const auto deadline = is_infinite ? clock::time_point::max() : clock::now() + timeout;
+			while (!is_complete()) {
+				DWORD milliseconds {INFINITE};
+				if (!is_infinite) {
+					const auto remaining = std::chrono::ceil<fence_timeout>(deadline - clock::now());
+					milliseconds = gsl::narrow_cast<DWORD>(std::max(remaining.count(), fence_timeout::rep {}));
+				}
+
+				const auto result = WaitForSingleObject(event, milliseconds);
+				if (result == WAIT_TIMEOUT)
+					return is_complete();
+
+				winrt::check_bool(result == WAIT_OBJECT_0);
+			}
+
+			return true;
+		}
 	};
 
+	using gpu_timeline = timeline<d3d12_fence>;
+
 	template <typename... list_types>
 	void execute(ID3D12CommandQueue& queue, list_types&&... lists)
 	{
@@ -93,7 +162,11 @@ namespace cube {
 		queue.ExecuteCommandLists(gsl::narrow_cast<unsigned int>(list_array.size()), list_array.data());
 	}
 
-	auto create_buffer(ID3D12Device& device, std::size_t size)
+	auto create_buffer(
+		ID3D12Device& device,
+		std::size_t size,
+		D3D12_RESOURCE_STATES state = D3D12_RESOURCE_STATE_COPY_DEST,
+		D3D12_RESOURCE_FLAGS flags = D3D12_RESOURCE_FLAG_DENY_SHADER_RESOURCE)
 	{
 		D3D12_HEAP_PROPERTIES heap {};
 		heap.Type = D3D12_HEAP_TYPE_DEFAULT;
@@ -107,7 +180,7 @@ namespace cube {
 		info.Format = DXGI_FORMAT_UNKNOWN;
 		info.Layout = D3D12_TEXTURE_LAYOUT_ROW_MAJOR;
 		info.SampleDesc.Count = 1;
-		info.Flags = D3D12_RESOURCE_FLAG_DENY_SHADER_RESOURCE;
+		info.Flags = flags;
 
 		return winrt::capture<ID3D12Resource>(
 			&device,
@@ -115,7 +188,7 @@ namespace cube {
 			&heap,
 			D3D12_HEAP_FLAG_NONE,
 			&info,
-			D3D12_RESOURCE_STATE_COPY_DEST,
+			state,
 			nullptr);
 	}
 
@@ -145,6 +218,32 @@ namespace cube {
 			nullptr);
 	}
 
+	auto create_readback_buffer(ID3D12Device& device, std::size_t size)
+	{
+		D3D12_HEAP_PROPERTIES heap {};
+		heap.Type = D3D12_HEAP_TYPE_READBACK;
+
+		D3D12_RESOURCE_DESC info {};
+		info.Dimension = D3D12_RESOURCE_DIMENSION_BUFFER;
+		info.Width = size;
+		info.Height = 1;
+		info.DepthOrArraySize = 1;
+		info.MipLevels = 1;
+		info.Format = DXGI_FORMAT_UNKNOWN;
+		info.Layout = D3D12_TEXTURE_LAYOUT_ROW_MAJOR;
+		info.SampleDesc.Count = 1;
+		info.Flags = D3D12_RESOURCE_FLAG_DENY_SHADER_RESOURCE;
+
+		return winrt::capture<ID3D12Resource>(
+			&device,
+			&ID3D12Device::CreateCommittedResource,
+			&heap,
+			D3D12_HEAP_FLAG_NONE,
+			&info,
+			D3D12_RESOURCE_STATE_COPY_DEST,
+			nullptr);
+	}
+
 	void* map(ID3D12Resource& resource)
 	{
 		D3D12_RANGE range {};
@@ -0,0 +1,166 @@
+#include "draw_sorting.h"
+
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include <gsl/gsl>
+
+#include "trace.h"
+#include "worker_pool.h"
+
+namespace cube {
+	namespace {
+		struct key_field {
+			unsigned int shift;
+			unsigned int bits;
+		};
+
+		constexpr key_field pass_field {60, 4};
+		constexpr key_field pipeline_field {52, 8};
+		constexpr key_field material_field {40, 12};
+		constexpr key_field geometry_field {24, 16};
+		constexpr key_field depth_field {0, 24};
+
+		std::uint64_t pack(key_field field, std::uint32_t value) noexcept
+		{
+			Expects(value < (std::uint64_t {1} << field.bits));
+			return std::uint64_t {value} << field.shift;
+		}
+
+		std::uint32_t unpack(key_field field, std::uint64_t key) noexcept
+		{
+			return gsl::narrow_cast<std::uint32_t>((key >> field.shift) & ((std::uint64_t {1} << field.bits) - 1));
+		}
+	}
+}
+
+std::uint64_t cube::make_draw_key(const draw_state& state, float depth) noexcept
+{
+	// Also sends NaNs and anything behind the camera to the front
+	const auto clamped_depth = depth > 0.0f ? depth : 0.0f;
+	const auto depth_bits = std::bit_cast<std::uint32_t>(clamped_depth) >> (32 - depth_field.bits);
+	return pack(pass_field, state.pass) | pack(pipeline_field, state.pipeline) | pack(material_field, state.material)
+		| pack(geometry_field, state.geometry) | pack(depth_field, depth_bits);
+}
+
+cube::draw_state cube::get_draw_state(std::uint64_t key) noexcept
+{
+	return {
+		unpack(pass_field, key), unpack(pipeline_field, key), unpack(material_field, key), unpack(geometry_field, key)};
+}
+
+cube::state_change_counts cube::count_state_changes(gsl::span<const std::uint64_t> keys) noexcept
+{
+	state_change_counts counts {};
+	if (keys.empty())
+		return counts;
+
+	counts = {1, 1, 1, 1};
+	for (std::size_t i {1}; i < keys.size(); ++i) {
+		const auto previous = get_draw_state(keys[i - 1]);
+		const auto current = get_draw_state(keys[i]);
+		counts.pass += previous.pass != current.pass;
+		counts.pipeline += previous.pipeline != current.pipeline;
+		counts.material += previous.material != current.material;
+		counts.geometry += previous.geometry != current.geometry;
+	}
+
+	return counts;
+}
+
+cube::radix_sorter::radix_sorter(std::size_t capacity) :
+	m_keys {std::vector<std::uint64_t>(capacity), std::vector<std::uint64_t>(capacity)},
+	m_order {std::vector<std::uint32_t>(capacity), std::vector<std::uint32_t>(capacity)},
+	m_chunk_histograms((capacity + chunk_size - 1) / chunk_size),
+	m_chunk_offsets((capacity + chunk_size - 1) / chunk_size)
+{
+}
+
+cube::sorted_keys cube::radix_sorter::sort(worker_pool& workers, gsl::span<const std::uint64_t> keys)
+{
+	const trace_scope scope {"radix sort"};
+	const auto count = keys.size();
+	Expects(count <= m_keys.front().size());
+	const auto chunk_count = (count + chunk_size - 1) / chunk_size;
+
+	// The first pass only copies the keys in, but histograms every digit at once to find the ones worth sorting by
+	workers.run(chunk_count, [this, keys](std::size_t chunk) {
+		const auto first = chunk * chunk_size;
+		const auto last = std::min(first + chunk_size, keys.size());
+		auto& histograms = m_chunk_histograms[chunk];
+		for (auto& digit : histograms)
+			digit.fill(0);
+
+		for (auto i = first; i < last; ++i) {
+			const auto key = keys[i];
+			m_keys[0][i] = key;
+			m_order[0][i] = gsl::narrow_cast<std::uint32_t>(i);
+			for (std::size_t digit {}; digit < digit_count; ++digit)
+				++histograms[digit][(key >> (digit * digit_bits)) & (radix - 1)];
+		}
+	});
+
+	// Totals don't change as keys move, so they tell up front which digits are the same in every key
+	std::array<bool, digit_count> is_constant {};
+	for (std::size_t digit {}; digit < digit_count && count != 0; ++digit) {
+		const auto value = (keys.front() >> (digit * digit_bits)) & (radix - 1);
+		std::size_t total {};
+		for (std::size_t chunk {}; chunk < chunk_count; ++chunk)
+			total += m_chunk_histograms[chunk][digit][value];
+
+		is_constant[digit] = total == count;
+	}
+
+	std::size_t source {};
+	auto is_counted = true;
+	for (std::size_t digit {}; digit < digit_count && count != 0; ++digit) {
+		if (is_constant[digit])
+			continue;
+
+		// After the first scatter the keys have moved between chunks, so each chunk's slice is counted again
+		const auto shift = digit * digit_bits;
+		if (!is_counted) {
+			workers.run(chunk_count, [this, source, shift, count, digit](std::size_t chunk) {
+				const auto first = chunk * chunk_size;
+				const auto last = std::min(first + chunk_size, count);
+				auto& histogram = m_chunk_histograms[chunk][digit];
+				histogram.fill(0);
+				for (auto i = first; i < last; ++i)
+					++histogram[(m_keys[source][i] >> shift) & (radix - 1)];
+			});
+		}
+
+		// Each chunk's keys land after those with the same digit from earlier chunks, which keeps the sort stable
+		std::size_t offset {};
+		for (std::size_t value {}; value < radix; ++value) {
+			for (std::size_t chunk {}; chunk < chunk_count; ++chunk) {
+				m_chunk_offsets[chunk][value] = gsl::narrow_cast<std::uint32_t>(offset);
+				offset += m_chunk_histograms[chunk][digit][value];
+			}
+		}
+
+		const auto target = 1 - source;
+		workers.run(chunk_count, [this, source, target, shift, count](std::size_t chunk) {
+			const auto first = chunk * chunk_size;
+			const auto last = std::min(first + chunk_size, count);
+			auto& offsets = m_chunk_offsets[chunk];
+			for (auto i = first; i < last; ++i) {
+				const auto key = m_keys[source][i];
+				const auto destination = offsets[(key >> shift) & (radix - 1)]++;
+				m_keys[target][destination] = key;
+				m_order[target][destination] = m_order[source][i];
+			}
+		});
+
+		source = target;
+		is_counted = false;
+	}
+
+	return {
+		gsl::span<const std::uint64_t> {m_keys[source]}.first(count),
+		gsl::span<const std::uint32_t> {m_order[source]}.first(count)};
+}
@@ -0,0 +1,72 @@
+#ifndef HELIUM_DRAW_SORTING_H
+#define HELIUM_DRAW_SORTING_H
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include <gsl/gsl>
+
+#include "worker_pool.h"
+
+namespace cube {
+	// The state a draw needs bound, as indices into the renderer's tables
+	struct draw_state {
+		std::uint32_t pass;
+		std::uint32_t pipeline;
+		std::uint32_t material;
+		std::uint32_t geometry;
+	};
+
+	/*
+		From the most significant bits down: pass (4 bits), pipeline (8), material (12), geometry (16) and view depth
+		(24). Sorting by key groups draws by the state that is most expensive to change, and orders each group front
+		to back. Depth keeps the top bits of its float representation, which order the same way for positive values.
+	*/
+	std::uint64_t make_draw_key(const draw_state& state, float depth) noexcept;
+	draw_state get_draw_state(std::uint64_t key) noexcept;
+
+	// Times each field differs from the previous draw's; the first draw counts as changing everything
+	struct state_change_counts {
+		std::size_t pass;
+		std::size_t pipeline;
+		std::size_t material;
+		std::size_t geometry;
+	};
+
+	state_change_counts count_state_changes(gsl::span<const std::uint64_t> keys) noexcept;
+
+	struct sorted_keys {
+		gsl::span<const std::uint64_t> keys;
+		gsl::span<const std::uint32_t> order; // Where each sorted key came from
+	};
+
+	/*
+		Stable LSD radix sort over 8-bit digits. Each pass histograms and scatters chunks of keys in parallel, with
+		every chunk writing to its own precomputed slice of each bucket, so the output never depends on scheduling.
+		Digits that are the same in every key are skipped, which for draw keys is most of the high ones.
+	*/
+	class radix_sorter {
+	public:
+		explicit radix_sorter(std::size_t capacity);
+
+		// The result is only valid until the next call
+		sorted_keys sort(worker_pool& workers, gsl::span<const std::uint64_t> keys);
+
+	private:
+		static constexpr std::size_t digit_bits {8};
+		static constexpr std::size_t radix {1 << digit_bits};
+		static constexpr std::size_t digit_count {64 / digit_bits};
+		static constexpr std::size_t chunk_size {16384};
+
+		using histogram = std::array<std::uint32_t, radix>;
+
+		std::array<std::vector<std::uint64_t>, 2> m_keys;
+		std::array<std::vector<std::uint32_t>, 2> m_order;
+		std::vector<std::array<histogram, digit_count>> m_chunk_histograms;
+		std::vector<histogram> m_chunk_offsets;
+	};
+}
+
+#endif
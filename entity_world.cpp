@@ -0,0 +1,304 @@
+#include "entity_world.h"
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <new>
+#include <optional>
+#include <stdexcept>
+#include <vector>
+
+#include <gsl/gsl>
+
+namespace cube {
+	namespace {
+		constexpr std::size_t column_alignment {64}; // Every column starts on its own cache line
+
+		std::array<component_info, max_component_types> registered_components {};
+		std::atomic_size_t registered_component_count {};
+
+		std::size_t align(std::size_t offset, std::size_t alignment) noexcept
+		{
+			return (offset + alignment - 1) / alignment * alignment;
+		}
+
+		template <typename function_type>
+		void for_each_component(component_mask mask, function_type&& function)
+		{
+			for (; mask != 0; mask &= mask - 1)
+				function(gsl::narrow_cast<std::size_t>(std::countr_zero(mask)));
+		}
+
+		// Where the columns of a chunk with the given capacity would start, and where the last one would end
+		std::size_t get_layout(
+			component_mask mask,
+			std::size_t capacity,
+			std::array<std::size_t, max_component_types>& offsets) noexcept
+		{
+			auto end = capacity * sizeof(entity);
+			for_each_component(mask, [&offsets, &end, capacity](std::size_t component) {
+				const auto& info = get_component_info(component);
+				offsets[component] = align(end, std::max(info.alignment, column_alignment));
+				end = offsets[component] + capacity * info.size;
+			});
+
+			return end;
+		}
+	}
+}
+
+std::size_t cube::register_component(std::size_t size, std::size_t alignment)
+{
+	const auto id = registered_component_count.fetch_add(1, std::memory_order_relaxed);
+	if (id >= max_component_types)
+		throw std::length_error {"too many component types"};
+
+	registered_components[id] = {size, alignment};
+	return id;
+}
+
+const cube::component_info& cube::get_component_info(std::size_t id) noexcept
+{
+	Expects(id < max_component_types);
+	return registered_components[id];
+}
+
+cube::archetype::archetype(component_mask mask) : m_mask {mask}
+{
+	std::size_t entity_size {sizeof(entity)};
+	for_each_component(mask, [&entity_size](std::size_t component) {
+		entity_size += get_component_info(component).size;
+	});
+
+	// Alignment padding only ever takes a little off the naive capacity
+	m_capacity = chunk_bytes / entity_size;
+	while (m_capacity != 0 && get_layout(mask, m_capacity, m_offsets) > chunk_bytes)
+		--m_capacity;
+
+	if (m_capacity == 0)
+		throw std::length_error {"an entity's components must fit in a chunk"};
+}
+
+std::size_t cube::archetype::get_chunk_size(std::size_t chunk) const noexcept
+{
+	Expects(chunk < chunk_count());
+	return std::min(m_capacity, m_size - chunk * m_capacity);
+}
+
+cube::entity* cube::archetype::get_entities(std::size_t chunk) const noexcept
+{
+	return reinterpret_cast<entity*>(m_chunks[chunk].get());
+}
+
+std::byte* cube::archetype::get_column(std::size_t chunk, std::size_t component) const noexcept
+{
+	Expects(m_mask & (component_mask {1} << component));
+	return m_chunks[chunk].get() + m_offsets[component];
+}
+
+std::byte* cube::archetype::get_component(std::size_t row, std::size_t component) const noexcept
+{
+	const auto size = get_component_info(component).size;
+	return get_column(row / m_capacity, component) + row % m_capacity * size;
+}
+
+std::size_t cube::archetype::push(entity owner)
+{
+	if (m_size == m_chunks.size() * m_capacity) {
+		const auto memory = ::operator new(chunk_bytes, std::align_val_t {column_alignment});
+		m_chunks.emplace_back(static_cast<std::byte*>(memory));
+	}
+
+	const auto row = m_size++;
+	get_entities(row / m_capacity)[row % m_capacity] = owner;
+	for_each_component(m_mask, [this, row](std::size_t component) {
+		std::memset(get_component(row, component), 0, get_component_info(component).size);
+	});
+
+	return row;
+}
+
+std::optional<cube::entity> cube::archetype::erase(std::size_t row) noexcept
+{
+	Expects(row < m_size);
+	const auto last = --m_size;
+	if (row == last)
+		return std::nullopt;
+
+	const auto moved = get_entities(last / m_capacity)[last % m_capacity];
+	get_entities(row / m_capacity)[row % m_capacity] = moved;
+	for_each_component(m_mask, [this, row, last](std::size_t component) {
+		std::memcpy(
+			get_component(row, component), get_component(last, component), get_component_info(component).size);
+	});
+
+	return moved;
+}
+
+void cube::archetype::chunk_deleter::operator()(std::byte* chunk) const noexcept
+{
+	::operator delete(chunk, std::align_val_t {column_alignment});
+}
+
+void cube::entity_commands::clear() noexcept
+{
+	m_commands.clear();
+	m_data.clear();
+}
+
+void cube::entity_commands::push_value(std::size_t component, const void* value)
+{
+	const auto size = get_component_info(component).size;
+	const auto offset = m_data.size();
+	m_data.resize(offset + sizeof(component) + size);
+	std::memcpy(&m_data[offset], &component, sizeof(component));
+	std::memcpy(&m_data[offset + sizeof(component)], value, size);
+}
+
+bool cube::entity_world::is_alive(entity target) const noexcept
+{
+	if (target.index >= m_locations.size())
+		return false;
+
+	const auto& slot = m_locations[target.index];
+	return slot.owner && slot.generation == target.generation;
+}
+
+void cube::entity_world::destroy(entity target)
+{
+	Expects(!m_is_iterating && is_alive(target));
+	auto& slot = m_locations[target.index];
+	if (const auto moved = slot.owner->erase(slot.row))
+		m_locations[moved->index].row = slot.row;
+
+	slot.owner = nullptr;
+	++slot.generation;
+	m_free_slots.push_back(target.index);
+	--m_alive_count;
+}
+
+void cube::entity_world::apply(entity_commands& commands)
+{
+	Expects(!m_is_iterating);
+	for (const auto& command : commands.m_commands) {
+		auto target = command.target;
+		switch (command.type) {
+		case entity_commands::command_type::create:
+			target = allocate(command.mask);
+			break;
+
+		case entity_commands::command_type::destroy:
+			if (is_alive(target))
+				destroy(target);
+
+			continue;
+
+		case entity_commands::command_type::add:
+			if (!is_alive(target))
+				continue;
+
+			move_entity(target, get_mask(target) | command.mask);
+			break;
+
+		case entity_commands::command_type::remove:
+			if (is_alive(target))
+				move_entity(target, get_mask(target) & ~command.mask);
+
+			continue;
+		}
+
+		auto offset = command.data_offset;
+		for (std::size_t i {}; i < command.value_count; ++i) {
+			std::size_t component {};
+			std::memcpy(&component, &commands.m_data[offset], sizeof(component));
+			const auto size = get_component_info(component).size;
+			std::memcpy(get_component(target, component), &commands.m_data[offset + sizeof(component)], size);
+			offset += sizeof(component) + size;
+		}
+	}
+
+	commands.clear();
+}
+
+cube::archetype& cube::entity_world::get_archetype(component_mask mask)
+{
+	const auto found = std::ranges::find(m_archetypes, mask, [](const auto& candidate) { return candidate->mask(); });
+	if (found != m_archetypes.end())
+		return **found;
+
+	return *m_archetypes.emplace_back(std::make_unique<archetype>(mask));
+}
+
+cube::entity cube::entity_world::allocate(component_mask mask)
+{
+	Expects(!m_is_iterating);
+	auto& owner = get_archetype(mask);
+	std::uint32_t index {};
+	if (m_free_slots.empty()) {
+		index = gsl::narrow<std::uint32_t>(m_locations.size());
+		m_locations.push_back({});
+	} else {
+		index = m_free_slots.back();
+		m_free_slots.pop_back();
+	}
+
+	auto& slot = m_locations[index];
+	const entity created {index, slot.generation};
+	slot.row = owner.push(created);
+	slot.owner = &owner;
+	++m_alive_count;
+	return created;
+}
+
+cube::component_mask cube::entity_world::get_mask(entity target) const noexcept
+{
+	Expects(is_alive(target));
+	return m_locations[target.index].owner->mask();
+}
+
+std::byte* cube::entity_world::get_component(entity target, std::size_t component) noexcept
+{
+	Expects(is_alive(target));
+	const auto& slot = m_locations[target.index];
+	return slot.owner->get_component(slot.row, component);
+}
+
+void cube::entity_world::move_entity(entity target, component_mask mask)
+{
+	Expects(!m_is_iterating && is_alive(target));
+	auto& slot = m_locations[target.index];
+	auto& source = *slot.owner;
+	if (source.mask() == mask)
+		return;
+
+	auto& destination = get_archetype(mask);
+	const auto row = destination.push(target);
+	for_each_component(source.mask() & mask, [&source, &destination, &slot, row](std::size_t component) {
+		std::memcpy(
+			destination.get_component(row, component),
+			source.get_component(slot.row, component),
+			get_component_info(component).size);
+	});
+
+	if (const auto moved = source.erase(slot.row))
+		m_locations[moved->index].row = slot.row;
+
+	slot = {&destination, row, slot.generation};
+}
+
+void cube::entity_world::collect_chunks(component_mask mask)
+{
+	m_query_chunks.clear();
+	for (const auto& candidate : m_archetypes) {
+		if ((candidate->mask() & mask) != mask)
+			continue;
+
+		for (std::size_t chunk {}; chunk < candidate->chunk_count(); ++chunk)
+			m_query_chunks.emplace_back(*candidate, chunk);
+	}
+}
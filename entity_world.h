@@ -0,0 +1,279 @@
+#ifndef HELIUM_ENTITY_WORLD_H
+#define HELIUM_ENTITY_WORLD_H
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <optional>
+#include <type_traits>
+#include <vector>
+
+#include <gsl/gsl>
+
+#include "worker_pool.h"
+
+namespace cube {
+	// The generation tells a destroyed entity's handle apart from that of whichever entity reuses its slot
+	struct entity {
+		std::uint32_t index;
+		std::uint32_t generation;
+
+		friend bool operator==(const entity&, const entity&) noexcept = default;
+	};
+
+	constexpr std::size_t max_component_types {64};
+	using component_mask = std::uint64_t;
+
+	struct component_info {
+		std::size_t size;
+		std::size_t alignment;
+	};
+
+	// Components are plain data, moved between chunks with memcpy and never destroyed; throws past the limit
+	std::size_t register_component(std::size_t size, std::size_t alignment);
+	const component_info& get_component_info(std::size_t id) noexcept;
+
+	template <typename component>
+	std::size_t get_component_id()
+	{
+		static_assert(std::is_trivially_copyable_v<component> && std::is_trivially_destructible_v<component>);
+		static const auto id = register_component(sizeof(component), alignof(component));
+		return id;
+	}
+
+	template <typename... components>
+	component_mask get_component_mask()
+	{
+		return ((component_mask {1} << get_component_id<components>()) | ... | component_mask {});
+	}
+
+	/*
+		Every entity with exactly the same set of components lives in the same archetype, which stores them in
+		fixed-size chunks holding one array per component. Entities stay packed: every chunk but the last is full,
+		and erasing one moves the archetype's last entity into its place, so iteration streams through memory.
+	*/
+	class archetype {
+	public:
+		static constexpr std::size_t chunk_bytes {16384};
+
+		explicit archetype(component_mask mask);
+
+		component_mask mask() const noexcept { return m_mask; }
+		std::size_t size() const noexcept { return m_size; }
+		std::size_t chunk_capacity() const noexcept { return m_capacity; }
+		std::size_t chunk_count() const noexcept { return (m_size + m_capacity - 1) / m_capacity; }
+		std::size_t get_chunk_size(std::size_t chunk) const noexcept;
+
+		entity* get_entities(std::size_t chunk) const noexcept;
+		std::byte* get_column(std::size_t chunk, std::size_t component) const noexcept;
+		std::byte* get_component(std::size_t row, std::size_t component) const noexcept;
+
+		// Appends a row with zeroed components and returns it
+		std::size_t push(entity owner);
+
+		// Moves the last entity into the row and returns it, unless the row was the last
+		std::optional<entity> erase(std::size_t row) noexcept;
+
+	private:
+		struct chunk_deleter {
+			void operator()(std::byte* chunk) const noexcept;
+		};
+
+		using chunk = std::unique_ptr<std::byte[], chunk_deleter>;
+
+		const component_mask m_mask;
+		std::size_t m_capacity {};
+		std::array<std::size_t, max_component_types> m_offsets {};
+		std::vector<chunk> m_chunks {}; // Emptied chunks are kept for reuse
+		std::size_t m_size {};
+	};
+
+	// A chunk's worth of entities, as handed to systems
+	class entity_chunk {
+	public:
+		entity_chunk(const archetype& owner, std::size_t chunk) noexcept : m_owner {&owner}, m_chunk {chunk} {}
+
+		std::size_t size() const noexcept { return m_owner->get_chunk_size(m_chunk); }
+		gsl::span<const entity> entities() const noexcept { return {m_owner->get_entities(m_chunk), size()}; }
+
+		// The archetype must have the component
+		template <typename component>
+		gsl::span<component> get() const noexcept
+		{
+			const auto column = m_owner->get_column(m_chunk, get_component_id<component>());
+			return {reinterpret_cast<component*>(column), size()};
+		}
+
+	private:
+		const archetype* m_owner;
+		std::size_t m_chunk;
+	};
+
+	/*
+		Structural changes recorded while systems iterate, and applied in order once they are done. Not thread-safe:
+		tasks that make changes record into commands of their own.
+	*/
+	class entity_commands {
+	public:
+		template <typename... components>
+		void create(const components&... values)
+		{
+			const auto mask = get_component_mask<components...>();
+			m_commands.push_back({command_type::create, {}, mask, m_data.size(), sizeof...(components)});
+			(push_value(get_component_id<components>(), &values), ...);
+		}
+
+		void destroy(entity target) { m_commands.push_back({command_type::destroy, target, {}, m_data.size(), 0}); }
+
+		template <typename component>
+		void add(entity target, const component& value)
+		{
+			m_commands.push_back({command_type::add, target, get_component_mask<component>(), m_data.size(), 1});
+			push_value(get_component_id<component>(), &value);
+		}
+
+		template <typename component>
+		void remove(entity target)
+		{
+			m_commands.push_back({command_type::remove, target, get_component_mask<component>(), m_data.size(), 0});
+		}
+
+		bool empty() const noexcept { return m_commands.empty(); }
+		void clear() noexcept;
+
+	private:
+		friend class entity_world;
+
+		enum class command_type {
+			create,
+			destroy,
+			add,
+			remove
+		};
+
+		struct command {
+			command_type type;
+			entity target;
+			component_mask mask;
+			std::size_t data_offset; // Of the values, each a component ID followed by its bytes
+			std::size_t value_count;
+		};
+
+		std::vector<command> m_commands {};
+		std::vector<std::byte> m_data {};
+
+		void push_value(std::size_t component, const void* value);
+	};
+
+	/*
+		Entities and their components, grouped into archetypes. Structural changes (creating and destroying entities,
+		adding and removing components) move entities between chunks, so they may not happen while iterating;
+		systems record them into entity_commands instead.
+	*/
+	class entity_world {
+	public:
+		entity_world() = default;
+
+		entity_world(entity_world&) = delete;
+		entity_world& operator=(entity_world&) = delete;
+
+		std::size_t size() const noexcept { return m_alive_count; }
+		bool is_alive(entity target) const noexcept;
+
+		template <typename... components>
+		entity create(const components&... values)
+		{
+			const auto created = allocate(get_component_mask<components...>());
+			(std::memcpy(get_component(created, get_component_id<components>()), &values, sizeof(values)), ...);
+			return created;
+		}
+
+		void destroy(entity target);
+
+		template <typename component>
+		void add(entity target, const component& value)
+		{
+			const auto id = get_component_id<component>();
+			move_entity(target, get_mask(target) | (component_mask {1} << id));
+			std::memcpy(get_component(target, id), &value, sizeof(value));
+		}
+
+		template <typename component>
+		void remove(entity target)
+		{
+			move_entity(target, get_mask(target) & ~get_component_mask<component>());
+		}
+
+		template <typename component>
+		bool has(entity target) const noexcept
+		{
+			return is_alive(target) && (get_mask(target) & get_component_mask<component>()) != 0;
+		}
+
+		template <typename component>
+		component& get(entity target) noexcept
+		{
+			return *reinterpret_cast<component*>(get_component(target, get_component_id<component>()));
+		}
+
+		void apply(entity_commands& commands);
+
+		// Calls function(entity_chunk) for every chunk whose archetype has all of the components
+		template <typename... components, typename function_type>
+		void for_each_chunk(function_type&& function)
+		{
+			collect_chunks(get_component_mask<components...>());
+			const iteration_scope scope {*this};
+			for (const auto& chunk : m_query_chunks)
+				function(chunk);
+		}
+
+		// As above, with a task per chunk across the pool
+		template <typename... components, typename function_type>
+		void for_each_chunk(worker_pool& workers, function_type&& function)
+		{
+			collect_chunks(get_component_mask<components...>());
+			const iteration_scope scope {*this};
+			workers.run(m_query_chunks.size(), [this, &function](std::size_t chunk) {
+				function(m_query_chunks[chunk]);
+			});
+		}
+
+	private:
+		struct location {
+			archetype* owner; // Null while the slot is free
+			std::size_t row;
+			std::uint32_t generation;
+		};
+
+		class iteration_scope {
+		public:
+			explicit iteration_scope(entity_world& world) noexcept : m_world {world} { m_world.m_is_iterating = true; }
+			~iteration_scope() noexcept { m_world.m_is_iterating = false; }
+
+			iteration_scope(iteration_scope&) = delete;
+			iteration_scope& operator=(iteration_scope&) = delete;
+
+		private:
+			entity_world& m_world;
+		};
+
+		std::vector<std::unique_ptr<archetype>> m_archetypes {};
+		std::vector<location> m_locations {};
+		std::vector<std::uint32_t> m_free_slots {};
+		std::size_t m_alive_count {};
+		std::vector<entity_chunk> m_query_chunks {};
+		bool m_is_iterating {};
+
+		archetype& get_archetype(component_mask mask);
+		entity allocate(component_mask mask); // With zeroed components
+		component_mask get_mask(entity target) const noexcept;
+		std::byte* get_component(entity target, std::size_t component) noexcept;
+		void move_entity(entity target, component_mask mask);
+		void collect_chunks(component_mask mask);
+	};
+}
+
+#endif
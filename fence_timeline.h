@@ -0,0 +1,217 @@
+#ifndef HELIUM_FENCE_TIMELINE_H
+#define HELIUM_FENCE_TIMELINE_H
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <iterator>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include <gsl/gsl>
+
+namespace cube {
+	// A point on a fence's timeline; it is complete once the fence has reached its value
+	struct fence_token {
+		std::uint64_t value;
+	};
+
+	using fence_timeout = std::chrono::milliseconds;
+	constexpr fence_timeout infinite_timeout {fence_timeout::max()};
+	constexpr std::size_t max_fence_waits {8};
+
+	/*
+		The fence type is the only part that talks to hardware, so the state machine can be driven by a simulated
+		fence, as fence_timeline_tests.cpp does. It must provide:
+		- std::uint64_t completed_value() const
+		- void signal(arguments..., std::uint64_t value)
+		- bool wait(std::uint64_t value, fence_timeout timeout)
+		- static bool wait_multiple(
+			gsl::span<fence_type* const> fences, gsl::span<const std::uint64_t> values, bool wait_all, fence_timeout)
+	*/
+	template <typename fence_type>
+	class timeline {
+	public:
+		template <typename... argument_types>
+		explicit timeline(argument_types&&... arguments) :
+			m_fence {std::forward<argument_types>(arguments)...},
+			m_value {m_fence.completed_value()}
+		{
+		}
+
+		// Otherwise tokens from the two copies would alias
+		timeline(timeline&) = delete;
+		timeline& operator=(timeline&) = delete;
+
+		// Only the submitting thread may signal
+		template <typename... argument_types>
+		fence_token signal(argument_types&&... arguments)
+		{
+			const auto value = m_value.load(std::memory_order_relaxed) + 1;
+			m_fence.signal(std::forward<argument_types>(arguments)..., value);
+			m_value.store(value, std::memory_order_release);
+			return {value};
+		}
+
+		fence_token last_signaled() const noexcept { return {m_value.load(std::memory_order_acquire)}; }
+
+		bool is_complete(fence_token token) const { return m_fence.completed_value() >= token.value; }
+
+		bool wait(fence_token token, fence_timeout timeout = infinite_timeout)
+		{
+			return is_complete(token) || m_fence.wait(token.value, timeout);
+		}
+
+		bool wait_idle(fence_timeout timeout = infinite_timeout) { return wait(last_signaled(), timeout); }
+
+		fence_type& fence() noexcept { return m_fence; }
+
+	private:
+		fence_type m_fence;
+		std::atomic_uint64_t m_value;
+	};
+
+	template <typename fence_type>
+	struct fence_wait {
+		timeline<fence_type>* source;
+		fence_token token;
+	};
+
+	namespace detail {
+		template <typename fence_type>
+		bool wait_multiple(gsl::span<const fence_wait<fence_type>> waits, bool wait_all, fence_timeout timeout)
+		{
+			Expects(waits.size() <= max_fence_waits);
+			std::array<fence_type*, max_fence_waits> fences {};
+			std::array<std::uint64_t, max_fence_waits> values {};
+			std::size_t count {};
+			for (const auto& wait : waits) {
+				if (wait.source->is_complete(wait.token)) {
+					if (!wait_all)
+						return true;
+
+					continue;
+				}
+
+				fences.at(count) = &wait.source->fence();
+				values.at(count) = wait.token.value;
+				++count;
+			}
+
+			if (count == 0)
+				return true;
+
+			return fence_type::wait_multiple(
+				gsl::span<fence_type* const> {fences.data(), count},
+				gsl::span<const std::uint64_t> {values.data(), count},
+				wait_all,
+				timeout);
+		}
+	}
+
+	template <typename fence_type>
+	bool wait_all(gsl::span<const fence_wait<fence_type>> waits, fence_timeout timeout = infinite_timeout)
+	{
+		return detail::wait_multiple(waits, true, timeout);
+	}
+
+	template <typename fence_type>
+	bool wait_any(gsl::span<const fence_wait<fence_type>> waits, fence_timeout timeout = infinite_timeout)
+	{
+		return waits.empty() || detail::wait_multiple(waits, false, timeout);
+	}
+
+	// Runs CPU callbacks once the GPU reaches their tokens, without involving the thread that registered them
+	template <typename fence_type>
+	class completion_thread {
+	public:
+		completion_thread() : m_thread {[this] { run(); }} {}
+
+		completion_thread(completion_thread&) = delete;
+		completion_thread& operator=(completion_thread&) = delete;
+
+		// Callbacks still pending at destruction are dropped, as their work may never complete
+		~completion_thread() noexcept
+		{
+			{
+				const std::lock_guard lock {m_lock};
+				m_is_exiting = true;
+			}
+
+			m_wake.notify_one();
+			m_thread.join();
+		}
+
+		void on_completion(timeline<fence_type>& source, fence_token token, std::function<void()> callback)
+		{
+			{
+				const std::lock_guard lock {m_lock};
+				m_pending.push_back({&source, token, std::move(callback)});
+			}
+
+			m_wake.notify_one();
+		}
+
+	private:
+		// New registrations cannot interrupt a fence wait, so we never sleep on the fences for longer than this
+		static constexpr fence_timeout poll_interval {2};
+
+		struct pending_callback {
+			timeline<fence_type>* source;
+			fence_token token;
+			std::function<void()> callback;
+		};
+
+		std::mutex m_lock {};
+		std::condition_variable m_wake {};
+		std::vector<pending_callback> m_pending {};
+		bool m_is_exiting {};
+		std::thread m_thread;
+
+		void run()
+		{
+			std::vector<pending_callback> ready {};
+			std::array<fence_wait<fence_type>, max_fence_waits> waits {};
+			std::unique_lock lock {m_lock};
+			while (true) {
+				m_wake.wait(lock, [this] { return m_is_exiting || !m_pending.empty(); });
+				if (m_is_exiting)
+					return;
+
+				// Stable so that callbacks on the same timeline fire in token order
+				const auto first_ready = std::stable_partition(m_pending.begin(), m_pending.end(), [](auto& pending) {
+					return !pending.source->is_complete(pending.token);
+				});
+
+				std::move(first_ready, m_pending.end(), std::back_inserter(ready));
+				m_pending.erase(first_ready, m_pending.end());
+				if (!ready.empty()) {
+					lock.unlock();
+					for (auto& pending : ready)
+						pending.callback();
+
+					ready.clear();
+					lock.lock();
+					continue;
+				}
+
+				const auto count = std::min(m_pending.size(), max_fence_waits);
+				for (std::size_t i {}; i < count; ++i)
+					waits.at(i) = {m_pending.at(i).source, m_pending.at(i).token};
+
+				lock.unlock();
+				wait_any(gsl::span<const fence_wait<fence_type>> {waits.data(), count}, poll_interval);
+				lock.lock();
+			}
+		}
+	};
+}
+
+#endif
@@ -0,0 +1,229 @@
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <exception>
+#include <iostream>
+#include <mutex>
+#include <source_location>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include <gsl/gsl>
+
+#include "fence_timeline.h"
+
+namespace cube {
+	namespace {
+		/*
+			Stands in for a GPU fence: signals are only queued, and the test decides when the "GPU" reaches them by
+			calling complete(). Waits on several fences poll, as they don't share a condition variable.
+		*/
+		class simulated_fence {
+		public:
+			std::uint64_t completed_value() const
+			{
+				const std::lock_guard lock {m_lock};
+				return m_completed;
+			}
+
+			void signal(std::uint64_t value)
+			{
+				const std::lock_guard lock {m_lock};
+				m_signaled = value;
+			}
+
+			// Reaches value, which must already have been signaled
+			void complete(std::uint64_t value)
+			{
+				{
+					const std::lock_guard lock {m_lock};
+					Expects(value <= m_signaled);
+					m_completed = std::max(m_completed, value);
+				}
+
+				m_changed.notify_all();
+			}
+
+			bool wait(std::uint64_t value, fence_timeout timeout)
+			{
+				std::unique_lock lock {m_lock};
+				const auto is_complete = [this, value] { return m_completed >= value; };
+				if (timeout == infinite_timeout) {
+					m_changed.wait(lock, is_complete);
+					return true;
+				}
+
+				return m_changed.wait_for(lock, timeout, is_complete);
+			}
+
+			static bool wait_multiple(
+				gsl::span<simulated_fence* const> fences,
+				gsl::span<const std::uint64_t> values,
+				bool wait_all,
+				fence_timeout timeout)
+			{
+				Expects(!fences.empty() && fences.size() == values.size());
+				using clock = std::chrono::steady_clock;
+				const auto is_infinite = timeout == infinite_timeout;
+				const auto deadline = is_infinite ? clock::time_point::max() : clock::now() + timeout;
+				while (true) {
+					std::size_t complete_count {};
+					for (gsl::index i {}; i < gsl::narrow_cast<gsl::index>(fences.size()); ++i) {
+						if (fences[i]->completed_value() >= values[i])
+							++complete_count;
+					}
+
+					if (wait_all ? complete_count == fences.size() : complete_count != 0)
+						return true;
+
+					if (clock::now() >= deadline)
+						return false;
+
+					std::this_thread::sleep_for(std::chrono::milliseconds {1});
+				}
+			}
+
+		private:
+			mutable std::mutex m_lock {};
+			std::condition_variable m_changed {};
+			std::uint64_t m_signaled {};
+			std::uint64_t m_completed {};
+		};
+
+		using simulated_timeline = timeline<simulated_fence>;
+		using simulated_wait = fence_wait<simulated_fence>;
+
+		constexpr fence_timeout short_timeout {10}; // For waits that should time out
+		constexpr fence_timeout long_timeout {5000}; // For waits that shouldn't
+
+		void check(bool condition, const std::source_location location = std::source_location::current())
+		{
+			if (!condition)
+				throw std::logic_error {"check failed on line " + std::to_string(location.line())};
+		}
+
+		void test_tokens()
+		{
+			simulated_timeline gpu {};
+			check(gpu.last_signaled().value == 0);
+			check(gpu.is_complete(gpu.last_signaled()));
+
+			const auto first = gpu.signal();
+			const auto second = gpu.signal();
+			check(first.value == 1 && second.value == 2);
+			check(gpu.last_signaled().value == second.value);
+			check(!gpu.is_complete(first));
+
+			gpu.fence().complete(first.value);
+			check(gpu.is_complete(first));
+			check(!gpu.is_complete(second));
+		}
+
+		void test_waits()
+		{
+			simulated_timeline gpu {};
+			const auto token = gpu.signal();
+			check(!gpu.wait(token, short_timeout));
+			check(!gpu.wait_idle(short_timeout));
+
+			std::jthread completer {[&gpu, token] {
+				std::this_thread::sleep_for(std::chrono::milliseconds {5});
+				gpu.fence().complete(token.value);
+			}};
+
+			check(gpu.wait(token));
+			check(gpu.wait_idle(short_timeout));
+		}
+
+		void test_multiple_waits()
+		{
+			simulated_timeline first {};
+			simulated_timeline second {};
+			const std::array waits {simulated_wait {&first, first.signal()}, simulated_wait {&second, second.signal()}};
+			check(!wait_any<simulated_fence>(waits, short_timeout));
+			check(!wait_all<simulated_fence>(waits, short_timeout));
+
+			second.fence().complete(1);
+			check(wait_any<simulated_fence>(waits, short_timeout));
+			check(!wait_all<simulated_fence>(waits, short_timeout));
+
+			first.fence().complete(1);
+			check(wait_all<simulated_fence>(waits, short_timeout));
+			check(wait_any<simulated_fence>({}, short_timeout));
+			check(wait_all<simulated_fence>({}, short_timeout));
+		}
+
+		void test_completion_callbacks()
+		{
+			simulated_timeline gpu {};
+			std::mutex lock {};
+			std::condition_variable changed {};
+			std::vector<std::uint64_t> completed {};
+			const auto record = [&](std::uint64_t value) {
+				return [&, value] {
+					{
+						const std::lock_guard guard {lock};
+						completed.push_back(value);
+					}
+
+					changed.notify_all();
+				};
+			};
+
+			const auto wait_for_count = [&](std::size_t count, fence_timeout timeout) {
+				std::unique_lock guard {lock};
+				return changed.wait_for(guard, timeout, [&] { return completed.size() >= count; });
+			};
+
+			completion_thread<simulated_fence> completions {};
+			const auto first = gpu.signal();
+			const auto second = gpu.signal();
+			const auto third = gpu.signal();
+			completions.on_completion(gpu, first, record(first.value));
+			completions.on_completion(gpu, second, record(second.value));
+			completions.on_completion(gpu, third, record(third.value));
+			check(!wait_for_count(1, short_timeout));
+
+			// Reaching the second token completes the first as well
+			gpu.fence().complete(second.value);
+			check(wait_for_count(2, long_timeout));
+			check(!wait_for_count(3, short_timeout));
+			gpu.fence().complete(third.value);
+			check(wait_for_count(3, long_timeout));
+
+			const std::lock_guard guard {lock};
+			check(completed == std::vector<std::uint64_t> {first.value, second.value, third.value});
+		}
+	}
+}
+
+int main()
+{
+	using namespace cube;
+
+	const std::array tests {
+		std::pair {"tokens", &test_tokens},
+		std::pair {"waits", &test_waits},
+		std::pair {"multiple waits", &test_multiple_waits},
+		std::pair {"completion callbacks", &test_completion_callbacks}};
+
+	auto failures = 0;
+	for (const auto& [name, test] : tests) {
+		try {
+			test();
+			std::cout << "passed: " << name << '\n';
+		}
+		catch (const std::exception& error) {
+			std::cout << "FAILED: " << name << ": " << error.what() << '\n';
+			++failures;
+		}
+	}
+
+	return failures == 0 ? 0 : 1;
+}
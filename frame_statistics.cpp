@@ -0,0 +1,152 @@
+#include "frame_statistics.h"
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <bit>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+
+#include <gsl/gsl>
+
+namespace cube {
+	namespace {
+		constexpr std::size_t sub_bucket_bits {3};
+		constexpr std::size_t sub_bucket_count {1 << sub_bucket_bits};
+
+		// Values below the sub-bucket count are exact; above it, each power of two gets its own set of sub-buckets
+		std::size_t get_bucket(std::uint64_t value) noexcept
+		{
+			if (value < sub_bucket_count)
+				return gsl::narrow_cast<std::size_t>(value);
+
+			const auto exponent = gsl::narrow_cast<std::size_t>(std::bit_width(value)) - 1;
+			const auto shift = exponent - sub_bucket_bits;
+			const auto mantissa = gsl::narrow_cast<std::size_t>(value >> shift) & (sub_bucket_count - 1);
+			return (shift + 1) * sub_bucket_count + mantissa;
+		}
+
+		// The midpoint of the bucket's range
+		std::uint64_t get_bucket_value(std::size_t bucket) noexcept
+		{
+			if (bucket < sub_bucket_count)
+				return bucket;
+
+			const auto shift = bucket / sub_bucket_count - 1;
+			const auto mantissa = bucket % sub_bucket_count;
+			const auto lower = std::uint64_t {sub_bucket_count + mantissa} << shift;
+			return lower + (std::uint64_t {1} << shift) / 2;
+		}
+	}
+}
+
+std::string_view cube::get_name(frame_timer timer) noexcept
+{
+	switch (timer) {
+	case frame_timer::input_delay:
+		return "input delay";
+
+	case frame_timer::simulate:
+		return "simulate";
+
+	case frame_timer::animate:
+		return "animate";
+
+	case frame_timer::transform:
+		return "transform";
+
+	case frame_timer::cull:
+		return "cull";
+
+	case frame_timer::record:
+		return "record";
+
+	case frame_timer::execute:
+		return "execute";
+
+	case frame_timer::present:
+		return "present";
+
+	case frame_timer::frame_graph:
+		return "frame graph";
+
+	case frame_timer::critical_path:
+		return "critical path";
+
+	case frame_timer::gpu_frame:
+		return "gpu frame";
+
+	case frame_timer::gpu_clear:
+		return "gpu clear";
+
+	case frame_timer::gpu_draw:
+		return "gpu draw";
+
+	default:
+		return "unknown";
+	}
+}
+
+void cube::latency_histogram::record(std::chrono::nanoseconds time) noexcept
+{
+	const auto value = gsl::narrow_cast<std::uint64_t>(std::max(time.count(), std::chrono::nanoseconds::rep {}));
+	m_buckets.at(get_bucket(value)).fetch_add(1, std::memory_order_relaxed);
+}
+
+void cube::latency_histogram::clear() noexcept
+{
+	for (auto& bucket : m_buckets)
+		bucket.store(0, std::memory_order_relaxed);
+}
+
+cube::timer_summary cube::summarize(const latency_histogram& first, const latency_histogram& second) noexcept
+{
+	std::array<std::uint32_t, latency_histogram::bucket_count> counts {};
+	std::uint64_t total {};
+	for (std::size_t i {}; i < counts.size(); ++i) {
+		counts.at(i) = first.m_buckets.at(i).load(std::memory_order_relaxed)
+			+ second.m_buckets.at(i).load(std::memory_order_relaxed);
+
+		total += counts.at(i);
+	}
+
+	if (total == 0)
+		return {};
+
+	const auto get_percentile = [&counts, total](std::uint64_t percent) {
+		const auto rank = std::max((total * percent + 99) / 100, std::uint64_t {1});
+		std::uint64_t seen {};
+		for (std::size_t i {}; i < counts.size(); ++i) {
+			seen += counts.at(i);
+			if (seen >= rank)
+				return std::chrono::nanoseconds {gsl::narrow_cast<std::chrono::nanoseconds::rep>(get_bucket_value(i))};
+		}
+
+		return std::chrono::nanoseconds {};
+	};
+
+	return {get_percentile(50), get_percentile(95), get_percentile(99), total};
+}
+
+void cube::frame_statistics::record(frame_timer timer, std::chrono::nanoseconds time) noexcept
+{
+	const auto current = m_current.load(std::memory_order_relaxed);
+	m_generations.at(current).at(static_cast<std::size_t>(timer)).record(time);
+}
+
+cube::timer_summary cube::frame_statistics::summary(frame_timer timer) const noexcept
+{
+	const auto index = static_cast<std::size_t>(timer);
+	return summarize(m_generations.at(0).at(index), m_generations.at(1).at(index));
+}
+
+void cube::frame_statistics::rotate() noexcept
+{
+	const auto next = 1 - m_current.load(std::memory_order_relaxed);
+	for (auto& histogram : m_generations.at(next))
+		histogram.clear();
+
+	m_current.store(next, std::memory_order_relaxed);
+}
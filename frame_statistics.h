@@ -0,0 +1,104 @@
+#ifndef HELIUM_FRAME_STATISTICS_H
+#define HELIUM_FRAME_STATISTICS_H
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+
+#include "trace.h"
+
+namespace cube {
+	enum class frame_timer : std::size_t {
+		input_delay, // From the window thread handling an event to the game thread draining it, after begin_frame()
+		simulate,
+		animate, // Systems, each also counted in the stage that runs it
+		transform,
+		cull,
+		record,
+		execute,
+		present,
+		frame_graph, // The render thread's tasks for a frame, from the first starting to the last finishing
+		critical_path, // The frame graph's longest chain of dependent tasks
+		gpu_frame,
+		gpu_clear,
+		gpu_draw,
+		count
+	};
+
+	constexpr auto frame_timer_count = static_cast<std::size_t>(frame_timer::count);
+
+	std::string_view get_name(frame_timer timer) noexcept;
+
+	struct timer_summary {
+		std::chrono::nanoseconds p50;
+		std::chrono::nanoseconds p95;
+		std::chrono::nanoseconds p99;
+		std::uint64_t count;
+	};
+
+	class latency_histogram;
+
+	// Samples are merged across histograms, so a rolling window can be summarized as a whole
+	timer_summary summarize(const latency_histogram& first, const latency_histogram& second) noexcept;
+
+	// Log-linear buckets (eight per power of two), so percentiles are accurate to within about 6%
+	class latency_histogram {
+	public:
+		void record(std::chrono::nanoseconds time) noexcept;
+		void clear() noexcept;
+
+		friend timer_summary summarize(const latency_histogram& first, const latency_histogram& second) noexcept;
+
+	private:
+		static constexpr std::size_t bucket_count {8 + 61 * 8};
+
+		std::array<std::atomic_uint32_t, bucket_count> m_buckets {};
+	};
+
+	/*
+		Lock-free: any thread may record at any time. Each timer keeps two generations of samples and rotate() drops
+		the older one, so summaries cover between one and two rotation periods. A sample racing with a rotation may
+		land in the generation being cleared and be lost, which is harmless for percentiles.
+	*/
+	class frame_statistics {
+	public:
+		void record(frame_timer timer, std::chrono::nanoseconds time) noexcept;
+		timer_summary summary(frame_timer timer) const noexcept;
+		void rotate() noexcept;
+
+	private:
+		std::array<std::array<latency_histogram, frame_timer_count>, 2> m_generations {};
+		std::atomic_size_t m_current {};
+	};
+
+	// Also emits a trace span named after the timer, when tracing is enabled
+	class scoped_timer {
+	public:
+		scoped_timer(frame_statistics& statistics, frame_timer timer) noexcept :
+			m_statistics {statistics},
+			m_timer {timer},
+			m_start {std::chrono::steady_clock::now()}
+		{
+		}
+
+		scoped_timer(scoped_timer&) = delete;
+		scoped_timer& operator=(scoped_timer&) = delete;
+
+		~scoped_timer() noexcept
+		{
+			const auto end = std::chrono::steady_clock::now();
+			m_statistics.record(m_timer, end - m_start);
+			trace_span(get_name(m_timer).data(), m_start, end); // The names are all literals
+		}
+
+	private:
+		frame_statistics& m_statistics;
+		const frame_timer m_timer;
+		const std::chrono::steady_clock::time_point m_start;
+	};
+}
+
+#endif
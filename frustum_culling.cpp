@@ -0,0 +1,295 @@
+#include "frustum_culling.h"
+
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include <gsl/gsl>
+
+#include <DirectXMath.h>
+
+#include <immintrin.h>
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+#include "lod.h"
+#include "trace.h"
+#include "worker_pool.h"
+
+// MSVC always allows AVX intrinsics; GCC and Clang need the functions using them to opt in
+#if defined(__GNUC__) || defined(__clang__)
+#define HELIUM_TARGET_AVX __attribute__((target("avx")))
+#else
+#define HELIUM_TARGET_AVX
+#endif
+
+namespace cube {
+	namespace {
+		std::size_t get_padded_count(std::size_t count) noexcept
+		{
+			return (count + sphere_set::batch_size - 1) / sphere_set::batch_size * sphere_set::batch_size;
+		}
+
+		// Drops the lanes of a batch that fall past the last sphere
+		unsigned int mask_tail(unsigned int mask, std::size_t index, std::size_t lane_count, std::size_t last) noexcept
+		{
+			if (index + lane_count <= last)
+				return mask;
+
+			return mask & ((1u << (last - index)) - 1);
+		}
+
+		std::size_t write_visible(
+			unsigned int mask,
+			std::size_t index,
+			gsl::span<std::uint32_t> visible,
+			std::size_t count) noexcept
+		{
+			while (mask != 0) {
+				visible[count++] = gsl::narrow_cast<std::uint32_t>(index + std::countr_zero(mask));
+				mask &= mask - 1;
+			}
+
+			return count;
+		}
+
+		std::size_t cull_sse(
+			const frustum& view_frustum,
+			const sphere_set& spheres,
+			std::size_t first,
+			std::size_t last,
+			gsl::span<std::uint32_t> visible) noexcept
+		{
+			std::array<std::array<__m128, 4>, 6> planes {};
+			for (std::size_t i {}; i < planes.size(); ++i) {
+				const auto& plane = view_frustum.planes[i];
+				planes[i] = {_mm_set1_ps(plane.x), _mm_set1_ps(plane.y), _mm_set1_ps(plane.z), _mm_set1_ps(plane.w)};
+			}
+
+			std::size_t count {};
+			for (auto i = first; i < last; i += 4) {
+				const auto x = _mm_loadu_ps(spheres.x() + i);
+				const auto y = _mm_loadu_ps(spheres.y() + i);
+				const auto z = _mm_loadu_ps(spheres.z() + i);
+				const auto negative_radius = _mm_sub_ps(_mm_setzero_ps(), _mm_loadu_ps(spheres.radius() + i));
+				auto inside = _mm_castsi128_ps(_mm_set1_epi32(-1));
+				for (const auto& plane : planes) {
+					const auto distance = _mm_add_ps(
+						_mm_add_ps(
+							_mm_add_ps(_mm_mul_ps(plane[0], x), _mm_mul_ps(plane[1], y)), _mm_mul_ps(plane[2], z)),
+						plane[3]);
+
+					inside = _mm_and_ps(inside, _mm_cmpge_ps(distance, negative_radius));
+				}
+
+				const auto mask = gsl::narrow_cast<unsigned int>(_mm_movemask_ps(inside));
+				count = write_visible(mask_tail(mask, i, 4, last), i, visible, count);
+			}
+
+			return count;
+		}
+
+		HELIUM_TARGET_AVX std::size_t cull_avx(
+			const frustum& view_frustum,
+			const sphere_set& spheres,
+			std::size_t first,
+			std::size_t last,
+			gsl::span<std::uint32_t> visible) noexcept
+		{
+			std::array<std::array<__m256, 4>, 6> planes {};
+			for (std::size_t i {}; i < planes.size(); ++i) {
+				const auto& plane = view_frustum.planes[i];
+				planes[i] = {
+					_mm256_set1_ps(plane.x), _mm256_set1_ps(plane.y), _mm256_set1_ps(plane.z), _mm256_set1_ps(plane.w)};
+			}
+
+			std::size_t count {};
+			for (auto i = first; i < last; i += 8) {
+				const auto x = _mm256_loadu_ps(spheres.x() + i);
+				const auto y = _mm256_loadu_ps(spheres.y() + i);
+				const auto z = _mm256_loadu_ps(spheres.z() + i);
+				const auto negative_radius = _mm256_sub_ps(_mm256_setzero_ps(), _mm256_loadu_ps(spheres.radius() + i));
+				auto inside = _mm256_castsi256_ps(_mm256_set1_epi32(-1));
+				for (const auto& plane : planes) {
+					const auto distance = _mm256_add_ps(
+						_mm256_add_ps(
+							_mm256_add_ps(_mm256_mul_ps(plane[0], x), _mm256_mul_ps(plane[1], y)),
+							_mm256_mul_ps(plane[2], z)),
+						plane[3]);
+
+					inside = _mm256_and_ps(inside, _mm256_cmp_ps(distance, negative_radius, _CMP_GE_OQ));
+				}
+
+				const auto mask = gsl::narrow_cast<unsigned int>(_mm256_movemask_ps(inside));
+				count = write_visible(mask_tail(mask, i, 8, last), i, visible, count);
+			}
+
+			return count;
+		}
+
+		bool detect_avx() noexcept
+		{
+#ifdef _MSC_VER
+			std::array<int, 4> info {};
+			__cpuid(info.data(), 1);
+			constexpr int osxsave {1 << 27};
+			constexpr int avx {1 << 28};
+			if ((info[2] & osxsave) == 0 || (info[2] & avx) == 0)
+				return false;
+
+			// The OS must also save the upper halves of the registers on context switches
+			return (_xgetbv(0) & 6) == 6;
+#else
+			return __builtin_cpu_supports("avx");
+#endif
+		}
+	}
+}
+
+cube::frustum cube::extract_frustum(DirectX::FXMMATRIX view_projection) noexcept
+{
+	using namespace DirectX;
+
+	// Row vectors go through the matrix on the left, so clip-space components come from its columns
+	const auto columns = XMMatrixTranspose(view_projection);
+	const std::array planes {
+		XMVectorAdd(columns.r[3], columns.r[0]),
+		XMVectorSubtract(columns.r[3], columns.r[0]),
+		XMVectorAdd(columns.r[3], columns.r[1]),
+		XMVectorSubtract(columns.r[3], columns.r[1]),
+		columns.r[2],
+		XMVectorSubtract(columns.r[3], columns.r[2])};
+
+	frustum result {};
+	for (std::size_t i {}; i < planes.size(); ++i)
+		XMStoreFloat4(&result.planes[i], XMPlaneNormalize(planes[i]));
+
+	return result;
+}
+
+cube::sphere_set::sphere_set(std::size_t count) :
+	m_count {count},
+	m_x(get_padded_count(count)),
+	m_y(get_padded_count(count)),
+	m_z(get_padded_count(count)),
+	m_radius(get_padded_count(count))
+{
+}
+
+void cube::sphere_set::set(std::size_t index, const DirectX::XMFLOAT3& center, float radius) noexcept
+{
+	Expects(index < m_count);
+	m_x[index] = center.x;
+	m_y[index] = center.y;
+	m_z[index] = center.z;
+	m_radius[index] = radius;
+}
+
+std::size_t cube::cull_spheres(
+	const frustum& view_frustum,
+	const sphere_set& spheres,
+	std::size_t first,
+	std::size_t last,
+	gsl::span<std::uint32_t> visible,
+	culling_kernel kernel) noexcept
+{
+	Expects(first % sphere_set::batch_size == 0 && last <= spheres.size() && visible.size() >= last - first);
+	Expects(kernel != culling_kernel::avx || is_avx_supported());
+	if (kernel == culling_kernel::automatic ? is_avx_supported() : kernel == culling_kernel::avx)
+		return cull_avx(view_frustum, spheres, first, last, visible);
+
+	return cull_sse(view_frustum, spheres, first, last, visible);
+}
+
+// Keep the arithmetic in the same order as the kernels, or the results drift apart by rounding at the edges
+std::size_t cube::cull_spheres_reference(
+	const frustum& view_frustum,
+	const sphere_set& spheres,
+	std::size_t first,
+	std::size_t last,
+	gsl::span<std::uint32_t> visible) noexcept
+{
+	Expects(last <= spheres.size() && visible.size() >= last - first);
+	std::size_t count {};
+	for (auto i = first; i < last; ++i) {
+		const auto negative_radius = 0.0f - spheres.radius()[i];
+		const auto& planes = view_frustum.planes;
+		const auto is_visible = std::all_of(planes.begin(), planes.end(), [&](const auto& plane) {
+			const auto distance
+				= ((plane.x * spheres.x()[i] + plane.y * spheres.y()[i]) + plane.z * spheres.z()[i]) + plane.w;
+
+			return distance >= negative_radius;
+		});
+
+		if (is_visible)
+			visible[count++] = gsl::narrow_cast<std::uint32_t>(i);
+	}
+
+	return count;
+}
+
+bool cube::is_avx_supported() noexcept
+{
+	static const auto is_supported = detect_avx();
+	return is_supported;
+}
+
+cube::frustum_culler::frustum_culler(std::size_t capacity) :
+	m_visible(capacity),
+	m_chunk_counts((capacity + chunk_size - 1) / chunk_size)
+{
+}
+
+gsl::span<const std::uint32_t>
+cube::frustum_culler::cull(worker_pool& workers, const frustum& view_frustum, const sphere_set& spheres)
+{
+	return cull_chunks(workers, view_frustum, spheres, nullptr, {});
+}
+
+gsl::span<const std::uint32_t> cube::frustum_culler::cull(
+	worker_pool& workers,
+	const frustum& view_frustum,
+	const sphere_set& spheres,
+	const lod_parameters& lods,
+	gsl::span<std::uint8_t> levels)
+{
+	return cull_chunks(workers, view_frustum, spheres, &lods, levels);
+}
+
+gsl::span<const std::uint32_t> cube::frustum_culler::cull_chunks(
+	worker_pool& workers,
+	const frustum& view_frustum,
+	const sphere_set& spheres,
+	const lod_parameters* lods,
+	gsl::span<std::uint8_t> levels)
+{
+	const trace_scope scope {"frustum cull"};
+	Expects(spheres.size() <= m_visible.size());
+	const auto chunk_count = (spheres.size() + chunk_size - 1) / chunk_size;
+	workers.run(chunk_count, [this, &view_frustum, &spheres, lods, levels](std::size_t chunk) {
+		const auto first = chunk * chunk_size;
+		const auto last = std::min(first + chunk_size, spheres.size());
+		const auto visible = gsl::span<std::uint32_t> {m_visible}.subspan(first, last - first);
+		const auto count = cull_spheres(view_frustum, spheres, first, last, visible);
+		if (lods)
+			select_lods(*lods, spheres, visible.first(count), levels);
+
+		m_chunk_counts[chunk] = count;
+	});
+
+	// Each chunk's results start where its spheres do, so sliding them down in order never overwrites unread ones
+	std::size_t count {};
+	for (std::size_t chunk {}; chunk < chunk_count; ++chunk) {
+		const auto source = m_visible.begin() + gsl::narrow_cast<std::ptrdiff_t>(chunk * chunk_size);
+		const auto chunk_visible = gsl::narrow_cast<std::ptrdiff_t>(m_chunk_counts[chunk]);
+		std::copy(source, source + chunk_visible, m_visible.begin() + gsl::narrow_cast<std::ptrdiff_t>(count));
+		count += m_chunk_counts[chunk];
+	}
+
+	return {m_visible.data(), count};
+}
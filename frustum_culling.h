@@ -0,0 +1,117 @@
+#ifndef HELIUM_FRUSTUM_CULLING_H
+#define HELIUM_FRUSTUM_CULLING_H
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include <gsl/gsl>
+
+#include <DirectXMath.h>
+
+#include "worker_pool.h"
+
+namespace cube {
+	struct lod_parameters;
+
+	// Planes face inwards with unit normals, so a point p is inside a plane when dot(normal, p) + w >= 0
+	struct frustum {
+		std::array<DirectX::XMFLOAT4, 6> planes;
+	};
+
+	// Expects the combined view and projection matrices, with a [0, 1] clip-space depth range
+	frustum extract_frustum(DirectX::FXMMATRIX view_projection) noexcept;
+
+	/*
+		World-space bounding spheres, one array per component. The arrays are padded to a whole batch so that the
+		vectorized tests never read past the end; padding lanes are never reported as visible.
+	*/
+	class sphere_set {
+	public:
+		// The widest batch the culling kernels load at once
+		static constexpr std::size_t batch_size {8};
+
+		explicit sphere_set(std::size_t count);
+
+		std::size_t size() const noexcept { return m_count; }
+
+		void set(std::size_t index, const DirectX::XMFLOAT3& center, float radius) noexcept;
+
+		const float* x() const noexcept { return m_x.data(); }
+		const float* y() const noexcept { return m_y.data(); }
+		const float* z() const noexcept { return m_z.data(); }
+		const float* radius() const noexcept { return m_radius.data(); }
+
+	private:
+		const std::size_t m_count;
+		std::vector<float> m_x;
+		std::vector<float> m_y;
+		std::vector<float> m_z;
+		std::vector<float> m_radius;
+	};
+
+	// Which instructions cull_spheres() uses; tests pick each in turn, everything else leaves it to the CPU
+	enum class culling_kernel {
+		automatic,
+		avx,
+		sse
+	};
+
+	/*
+		Both write the indices of the spheres in [first, last) that touch the frustum to visible, in ascending order,
+		and return how many they wrote. first must be a multiple of sphere_set::batch_size; visible must have room
+		for last - first indices. The vectorized version uses AVX when the CPU has it and SSE otherwise, and matches
+		the scalar reference bit for bit.
+	*/
+	std::size_t cull_spheres(
+		const frustum& view_frustum,
+		const sphere_set& spheres,
+		std::size_t first,
+		std::size_t last,
+		gsl::span<std::uint32_t> visible,
+		culling_kernel kernel = culling_kernel::automatic) noexcept;
+
+	std::size_t cull_spheres_reference(
+		const frustum& view_frustum,
+		const sphere_set& spheres,
+		std::size_t first,
+		std::size_t last,
+		gsl::span<std::uint32_t> visible) noexcept;
+
+	bool is_avx_supported() noexcept;
+
+	// Culls in chunks across the pool, then compacts the chunks' results in order, so the output is deterministic
+	class frustum_culler {
+	public:
+		explicit frustum_culler(std::size_t capacity);
+
+		// The result is only valid until the next call
+		gsl::span<const std::uint32_t>
+		cull(worker_pool& workers, const frustum& view_frustum, const sphere_set& spheres);
+
+		// Also selects the levels of detail of each chunk's visible spheres in the same task, while their bounds
+		// are still in cache
+		gsl::span<const std::uint32_t> cull(
+			worker_pool& workers,
+			const frustum& view_frustum,
+			const sphere_set& spheres,
+			const lod_parameters& lods,
+			gsl::span<std::uint8_t> levels);
+
+	private:
+		static constexpr std::size_t chunk_size {16384};
+
+		gsl::span<const std::uint32_t> cull_chunks(
+			worker_pool& workers,
+			const frustum& view_frustum,
+			const sphere_set& spheres,
+			const lod_parameters* lods,
+			gsl::span<std::uint8_t> levels);
+
+		std::vector<std::uint32_t> m_visible;
+		std::vector<std::size_t> m_chunk_counts;
+	};
+}
+
+#endif
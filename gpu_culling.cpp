@@ -0,0 +1,40 @@
+#include "gpu_culling.h"
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+
+#include <gsl/gsl>
+
+#include "frustum_culling.h"
+
+std::uint32_t cube::cull_indirect_reference(
+	const gpu_cull_constants& constants,
+	const sphere_set& spheres,
+	gsl::span<std::uint32_t> visible,
+	gsl::span<indirect_draw> draws) noexcept
+{
+	const std::size_t instance_count {constants.instance_count};
+	const auto group_count = get_gpu_cull_group_count(instance_count);
+	Expects(instance_count <= spheres.size() && visible.size() >= instance_count && draws.size() >= group_count);
+	std::uint32_t draw_count {};
+	for (std::size_t group {}; group < group_count; ++group) {
+		const auto first = group * gpu_cull_group_size;
+		const auto last = std::min(first + gpu_cull_group_size, instance_count);
+		const auto count = cull_spheres_reference(
+			constants.view_frustum, spheres, first, last, visible.subspan(first, last - first));
+
+		draws[group] = {
+			gsl::narrow_cast<std::uint32_t>(first),
+			constants.index_count,
+			gsl::narrow_cast<std::uint32_t>(count),
+			0,
+			0,
+			0};
+
+		if (count != 0)
+			draw_count = gsl::narrow_cast<std::uint32_t>(group + 1);
+	}
+
+	return draw_count;
+}
@@ -0,0 +1,51 @@
+#ifndef HELIUM_GPU_CULLING_H
+#define HELIUM_GPU_CULLING_H
+
+#include <cstddef>
+#include <cstdint>
+
+#include <gsl/gsl>
+
+#include "frustum_culling.h"
+
+namespace cube {
+	// Instances culled by each thread group of cull.hlsl, which also get a draw of their own
+	constexpr std::size_t gpu_cull_group_size {64};
+
+	constexpr std::size_t get_gpu_cull_group_count(std::size_t instance_count) noexcept
+	{
+		return (instance_count + gpu_cull_group_size - 1) / gpu_cull_group_size;
+	}
+
+	// The root constants of cull.hlsl
+	struct gpu_cull_constants {
+		frustum view_frustum;
+		std::uint32_t instance_count;
+		std::uint32_t index_count;
+	};
+
+	// One indirect command: the root constant locating the group's visible instances, then the arguments of an
+	// indexed draw, laid out as D3D12_DRAW_INDEXED_ARGUMENTS
+	struct indirect_draw {
+		std::uint32_t first_visible;
+		std::uint32_t index_count;
+		std::uint32_t instance_count;
+		std::uint32_t first_index;
+		std::int32_t base_vertex;
+		std::uint32_t first_instance;
+	};
+
+	/*
+		Does what cull.hlsl does, with the same arithmetic in the same order, so that its output matches the GPU's
+		bit for bit. Each group's visible instances are packed in order at the start of its slice of visible, and
+		every group writes its draw, even when nothing in it is visible. Returns what the shader leaves in the count
+		buffer: one past the last group with anything visible.
+	*/
+	std::uint32_t cull_indirect_reference(
+		const gpu_cull_constants& constants,
+		const sphere_set& spheres,
+		gsl::span<std::uint32_t> visible,
+		gsl::span<indirect_draw> draws) noexcept;
+}
+
+#endif
@@ -0,0 +1,34 @@
+cbuffer buffer : register(b0)
+{
+	row_major float4x4 view;
+	row_major float4x4 projection;
+}
+
+// Set by each indirect command, as SV_InstanceID always starts from zero
+cbuffer draw : register(b1)
+{
+	uint first_visible;
+}
+
+// Object-to-world, transposed so that it only takes three rows
+struct instance {
+	row_major float3x4 model;
+};
+
+StructuredBuffer<instance> instances : register(t0);
+StructuredBuffer<uint> visible : register(t1);
+
+struct vertex {
+	float4 position : SV_POSITION;
+	float3 color : COLOR;
+};
+
+vertex main(uint id : SV_VertexID, uint instance_id : SV_InstanceID, float3 position : POSITION)
+{
+	const float3 colors[] = {float3(0.0f, 0.0f, 1.0f), float3(0.0f, 1.0f, 0.0f), float3(1.0f, 0.0f, 0.0f)};
+	const float3 world = mul(instances[visible[first_visible + instance_id]].model, float4(position, 1.0));
+	vertex data;
+	data.position = mul(float4(world, 1.0), mul(view, projection));
+	data.color = colors[id % 3];
+	return data;
+}
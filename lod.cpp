@@ -0,0 +1,264 @@
+#include "lod.h"
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include <gsl/gsl>
+
+#include <DirectXMath.h>
+
+#include <immintrin.h>
+
+#include "frustum_culling.h"
+#include "trace.h"
+#include "worker_pool.h"
+
+namespace cube {
+	namespace {
+		using triangle = std::array<vector3, 3>;
+
+		vector3 operator+(const vector3& a, const vector3& b) noexcept { return {a.x + b.x, a.y + b.y, a.z + b.z}; }
+		vector3 operator-(const vector3& a, const vector3& b) noexcept { return {a.x - b.x, a.y - b.y, a.z - b.z}; }
+		vector3 operator*(const vector3& a, float b) noexcept { return {a.x * b, a.y * b, a.z * b}; }
+
+		float get_length(const vector3& a) noexcept { return std::sqrt(a.x * a.x + a.y * a.y + a.z * a.z); }
+
+		vector3 round_point(const vector3& point, float rounding) noexcept
+		{
+			const auto length = get_length(point);
+			if (length == 0.0f)
+				return point;
+
+			return point * ((length - (length - 1.0f) * rounding) / length);
+		}
+
+		// Weights are summed in the same order whichever corner comes first, so points on an edge shared by two
+		// triangles come out the same from both, and the rounded mesh has no cracks
+		vector3 interpolate(const triangle& corners, std::size_t i, std::size_t j, std::size_t n) noexcept
+		{
+			const auto scale = 1.0f / gsl::narrow_cast<float>(n);
+			const auto a = gsl::narrow_cast<float>(n - i - j) * scale;
+			const auto b = gsl::narrow_cast<float>(i) * scale;
+			const auto c = gsl::narrow_cast<float>(j) * scale;
+			return corners[0] * a + corners[1] * b + corners[2] * c;
+		}
+
+		// Splits a triangle into n * n, keeping its winding
+		void subdivide(const triangle& corners, std::size_t n, std::vector<triangle>& triangles)
+		{
+			for (std::size_t j {}; j < n; ++j) {
+				for (std::size_t i {}; i + j < n; ++i) {
+					triangles.push_back(
+						{interpolate(corners, i, j, n),
+						 interpolate(corners, i + 1, j, n),
+						 interpolate(corners, i, j + 1, n)});
+
+					if (i + j + 1 < n) {
+						triangles.push_back(
+							{interpolate(corners, i + 1, j, n),
+							 interpolate(corners, i + 1, j + 1, n),
+							 interpolate(corners, i, j + 1, n)});
+					}
+				}
+			}
+		}
+
+		// Samples the flat triangle's grid of n * n, comparing its rounded corners' interpolation to the surface
+		float measure_error(const triangle& flat, float rounding, std::size_t n) noexcept
+		{
+			const triangle rounded {
+				round_point(flat[0], rounding), round_point(flat[1], rounding), round_point(flat[2], rounding)};
+
+			float error {};
+			for (std::size_t j {}; j <= n; ++j) {
+				for (std::size_t i {}; i + j <= n; ++i) {
+					const auto surface = round_point(interpolate(flat, i, j, n), rounding);
+					error = std::max(error, get_length(surface - interpolate(rounded, i, j, n)));
+				}
+			}
+
+			return error;
+		}
+
+		float get_depth(const lod_parameters& lods, const sphere_set& spheres, std::uint32_t instance) noexcept
+		{
+			const auto& plane = lods.depth_plane;
+			return ((plane.x * spheres.x()[instance] + plane.y * spheres.y()[instance])
+					+ plane.z * spheres.z()[instance] + plane.w)
+				- spheres.radius()[instance];
+		}
+
+		std::uint8_t select_lod(const lod_parameters& lods, float depth, std::uint8_t current) noexcept
+		{
+			const auto allowed_limit = lods.threshold * depth;
+			const auto wanted_limit = lods.coarsen_threshold * depth;
+			float allowed {};
+			float wanted {};
+			for (std::size_t level {1}; level < lods.level_count; ++level) {
+				const auto error = lods.scaled_errors[level];
+				allowed += error <= allowed_limit ? 1.0f : 0.0f;
+				wanted += error < wanted_limit ? 1.0f : 0.0f;
+			}
+
+			const auto selected = std::min(std::max(gsl::narrow_cast<float>(current), wanted), allowed);
+			return gsl::narrow_cast<std::uint8_t>(selected);
+		}
+
+		constexpr std::size_t chunk_size {16384};
+	}
+}
+
+cube::lod_chain cube::build_rounded_lods(const wavefront& object, std::size_t level_count, float rounding)
+{
+	Expects(level_count != 0 && level_count <= max_lod_levels);
+	std::vector<triangle> base {};
+	for (const auto& face : object.faces) {
+		base.push_back(
+			{object.positions.at(face.indices[0] - 1),
+			 object.positions.at(face.indices[1] - 1),
+			 object.positions.at(face.indices[2] - 1)});
+	}
+
+	const std::size_t finest {std::size_t {1} << (level_count - 1)};
+	lod_chain chain {};
+	std::vector<triangle> triangles {};
+	for (std::size_t level {}; level < level_count; ++level) {
+		const auto n = finest >> level;
+		triangles.clear();
+		for (const auto& corners : base)
+			subdivide(corners, n, triangles);
+
+		lod_mesh mesh {};
+		float error {};
+		for (const auto& flat : triangles) {
+			for (const auto& corner : flat) {
+				mesh.indices.push_back(gsl::narrow<unsigned int>(mesh.positions.size()));
+				mesh.positions.push_back(round_point(corner, rounding));
+			}
+
+			error = std::max(error, measure_error(flat, rounding, finest * 2 / n));
+		}
+
+		chain.levels.push_back(std::move(mesh));
+		chain.errors.push_back(error);
+	}
+
+	return chain;
+}
+
+cube::lod_parameters cube::make_lod_parameters(
+	DirectX::FXMMATRIX view,
+	DirectX::CXMMATRIX projection,
+	unsigned int height,
+	gsl::span<const float> errors,
+	float threshold,
+	float hysteresis) noexcept
+{
+	Expects(!errors.empty() && errors.size() <= max_lod_levels && std::is_sorted(errors.begin(), errors.end()));
+	DirectX::XMFLOAT4X4 view_matrix {};
+	DirectX::XMFLOAT4X4 projection_matrix {};
+	DirectX::XMStoreFloat4x4(&view_matrix, view);
+	DirectX::XMStoreFloat4x4(&projection_matrix, projection);
+
+	lod_parameters lods {};
+	lods.depth_plane = {view_matrix.m[0][2], view_matrix.m[1][2], view_matrix.m[2][2], view_matrix.m[3][2]};
+	lods.threshold = threshold;
+	lods.coarsen_threshold = threshold * (1.0f - hysteresis);
+	lods.level_count = errors.size();
+	const auto pixel_scale = projection_matrix.m[1][1] * gsl::narrow_cast<float>(height) * 0.5f;
+	for (std::size_t level {}; level < errors.size(); ++level)
+		lods.scaled_errors[level] = errors[level] * pixel_scale;
+
+	return lods;
+}
+
+void cube::select_lods(
+	const lod_parameters& lods,
+	const sphere_set& spheres,
+	gsl::span<const std::uint32_t> instances,
+	gsl::span<std::uint8_t> levels) noexcept
+{
+	Expects(levels.size() >= spheres.size());
+	const auto& plane = lods.depth_plane;
+	const auto plane_x = _mm_set1_ps(plane.x);
+	const auto plane_y = _mm_set1_ps(plane.y);
+	const auto plane_z = _mm_set1_ps(plane.z);
+	const auto plane_w = _mm_set1_ps(plane.w);
+	const auto threshold = _mm_set1_ps(lods.threshold);
+	const auto coarsen_threshold = _mm_set1_ps(lods.coarsen_threshold);
+	const auto one = _mm_set1_ps(1.0f);
+
+	// Instances are scattered, so their bounds are gathered a lane at a time
+	std::size_t i {};
+	for (; i + 4 <= instances.size(); i += 4) {
+		const auto a = instances[i];
+		const auto b = instances[i + 1];
+		const auto c = instances[i + 2];
+		const auto d = instances[i + 3];
+		const auto x = _mm_setr_ps(spheres.x()[a], spheres.x()[b], spheres.x()[c], spheres.x()[d]);
+		const auto y = _mm_setr_ps(spheres.y()[a], spheres.y()[b], spheres.y()[c], spheres.y()[d]);
+		const auto z = _mm_setr_ps(spheres.z()[a], spheres.z()[b], spheres.z()[c], spheres.z()[d]);
+		const auto radius
+			= _mm_setr_ps(spheres.radius()[a], spheres.radius()[b], spheres.radius()[c], spheres.radius()[d]);
+
+		const auto current = _mm_setr_ps(levels[a], levels[b], levels[c], levels[d]);
+		const auto depth = _mm_sub_ps(
+			_mm_add_ps(
+				_mm_add_ps(_mm_add_ps(_mm_mul_ps(plane_x, x), _mm_mul_ps(plane_y, y)), _mm_mul_ps(plane_z, z)),
+				plane_w),
+			radius);
+
+		const auto allowed_limit = _mm_mul_ps(threshold, depth);
+		const auto wanted_limit = _mm_mul_ps(coarsen_threshold, depth);
+		auto allowed = _mm_setzero_ps();
+		auto wanted = _mm_setzero_ps();
+		for (std::size_t level {1}; level < lods.level_count; ++level) {
+			const auto error = _mm_set1_ps(lods.scaled_errors[level]);
+			allowed = _mm_add_ps(allowed, _mm_and_ps(_mm_cmple_ps(error, allowed_limit), one));
+			wanted = _mm_add_ps(wanted, _mm_and_ps(_mm_cmplt_ps(error, wanted_limit), one));
+		}
+
+		alignas(16) std::array<float, 4> selected {};
+		_mm_store_ps(selected.data(), _mm_min_ps(_mm_max_ps(current, wanted), allowed));
+		levels[a] = gsl::narrow_cast<std::uint8_t>(selected[0]);
+		levels[b] = gsl::narrow_cast<std::uint8_t>(selected[1]);
+		levels[c] = gsl::narrow_cast<std::uint8_t>(selected[2]);
+		levels[d] = gsl::narrow_cast<std::uint8_t>(selected[3]);
+	}
+
+	for (; i < instances.size(); ++i) {
+		const auto instance = instances[i];
+		levels[instance] = select_lod(lods, get_depth(lods, spheres, instance), levels[instance]);
+	}
+}
+
+void cube::select_lods_reference(
+	const lod_parameters& lods,
+	const sphere_set& spheres,
+	gsl::span<const std::uint32_t> instances,
+	gsl::span<std::uint8_t> levels) noexcept
+{
+	Expects(levels.size() >= spheres.size());
+	for (const auto instance : instances)
+		levels[instance] = select_lod(lods, get_depth(lods, spheres, instance), levels[instance]);
+}
+
+void cube::select_lods(
+	worker_pool& workers,
+	const lod_parameters& lods,
+	const sphere_set& spheres,
+	gsl::span<const std::uint32_t> instances,
+	gsl::span<std::uint8_t> levels)
+{
+	const trace_scope scope {"select lods"};
+	const auto chunk_count = (instances.size() + chunk_size - 1) / chunk_size;
+	workers.run(chunk_count, [&lods, &spheres, instances, levels](std::size_t chunk) {
+		const auto first = chunk * chunk_size;
+		const auto last = std::min(first + chunk_size, instances.size());
+		select_lods(lods, spheres, instances.subspan(first, last - first), levels);
+	});
+}
@@ -0,0 +1,88 @@
+#ifndef HELIUM_LOD_H
+#define HELIUM_LOD_H
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include <gsl/gsl>
+
+#include <DirectXMath.h>
+
+#include "wavefront_loader.h"
+#include "worker_pool.h"
+
+namespace cube {
+	class sphere_set;
+
+	constexpr std::size_t max_lod_levels {4};
+
+	struct lod_mesh {
+		std::vector<vector3> positions;
+		std::vector<unsigned int> indices; // Triangle lists
+	};
+
+	// Level 0 is the finest; every level has more error than the one before it
+	struct lod_chain {
+		std::vector<lod_mesh> levels;
+		std::vector<float> errors; // Farthest any point of the level strays from the surface, in object space
+	};
+
+	/*
+		Builds levels of detail of a rounded version of a convex mesh centred on the origin. Every level splits each
+		of the mesh's triangles into a finer grid than the next, then moves the vertices to the rounded surface,
+		where a point at distance d from the centre ends up at d - (d - 1) * rounding. The coarsest level keeps the
+		mesh's own triangles; errors are measured against the rounded surface at twice the finest level's density.
+	*/
+	lod_chain build_rounded_lods(const wavefront& object, std::size_t level_count, float rounding);
+
+	/*
+		Projected error is error * pixel_scale / depth, where depth is that of the nearest point of an instance's
+		bounds. Errors are stored already scaled, so selection compares them against the thresholds times depth and
+		never divides. Moving to a coarser level needs the error to fall below the lower threshold, so instances
+		near a boundary don't flip between levels every frame.
+	*/
+	struct lod_parameters {
+		DirectX::XMFLOAT4 depth_plane; // View-space depth as a plane equation over world-space positions
+		float threshold; // In pixels
+		float coarsen_threshold;
+		std::array<float, max_lod_levels> scaled_errors;
+		std::size_t level_count;
+	};
+
+	// Expects a perspective projection, from which the pixel scale is taken for the given target height
+	lod_parameters make_lod_parameters(
+		DirectX::FXMMATRIX view,
+		DirectX::CXMMATRIX projection,
+		unsigned int height,
+		gsl::span<const float> errors,
+		float threshold,
+		float hysteresis) noexcept;
+
+	/*
+		Updates the levels of the given instances, starting from the levels they had; others keep theirs. The
+		vectorized version handles four instances at once, and matches the scalar reference bit for bit.
+	*/
+	void select_lods(
+		const lod_parameters& lods,
+		const sphere_set& spheres,
+		gsl::span<const std::uint32_t> instances,
+		gsl::span<std::uint8_t> levels) noexcept;
+
+	void select_lods_reference(
+		const lod_parameters& lods,
+		const sphere_set& spheres,
+		gsl::span<const std::uint32_t> instances,
+		gsl::span<std::uint8_t> levels) noexcept;
+
+	// Splits the instances into chunks across the pool; they must be distinct
+	void select_lods(
+		worker_pool& workers,
+		const lod_parameters& lods,
+		const sphere_set& spheres,
+		gsl::span<const std::uint32_t> instances,
+		gsl::span<std::uint8_t> levels);
+}
+
+#endif
@@ -0,0 +1,23 @@
+#ifndef HELIUM_LOGGING_H
+#define HELIUM_LOGGING_H
+
+#include <format>
+#include <string_view>
+
+#include <Windows.h>
+
+#include "allocation_tracking.h"
+
+namespace cube {
+	// Goes to the debugger output; this is meant for low-rate status lines, not per-frame spam
+	template <typename... argument_types>
+	void log(std::string_view format, const argument_types&... arguments)
+	{
+		const allocation_tag_scope tag {allocation_tag::logging};
+		auto message = std::vformat(format, std::make_format_args(arguments...));
+		message.push_back('\n');
+		OutputDebugStringA(message.c_str());
+	}
+}
+
+#endif
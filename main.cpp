@@ -1,7 +1,22 @@
+#include <algorithm>
 #include <array>
 #include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstddef>
 #include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <format>
 #include <iterator>
+#include <mutex>
+#include <numeric>
+#include <optional>
+#include <stdexcept>
+#include <stop_token>
+#include <string>
+#include <string_view>
+#include <thread>
 #include <utility>
 #include <vector>
 
@@ -18,14 +33,81 @@
 
 #include <DirectXMath.h>
 
+#include "allocation_tracking.h"
+#include "bvh.h"
 #include "d3d12_utilities.h"
+#include "draw_sorting.h"
+#include "entity_world.h"
+#include "frame_statistics.h"
+#include "frustum_culling.h"
+#include "gpu_culling.h"
+#include "lod.h"
+#include "logging.h"
+#include "occlusion_culling.h"
+#include "scene.h"
+#include "settings.h"
 #include "shader_loading.h"
+#include "spsc_queue.h"
+#include "task_graph.h"
+#include "trace.h"
+#include "transform_system.h"
+#include "triple_buffer.h"
 #include "wavefront_loader.h"
+#include "worker_pool.h"
 
 namespace cube {
 	namespace {
 		constexpr auto ready_message = WM_USER;
 
+		using frame_clock = std::chrono::steady_clock;
+
+		enum class window_event_type {
+			key_down,
+			key_up,
+			focus_gained,
+			focus_lost,
+			mouse_move
+		};
+
+		// Stamped when the window thread handles the message, so the game thread can tell how long it waited
+		struct window_event {
+			window_event_type type;
+			frame_clock::time_point time;
+			unsigned int key; // A virtual-key code, for key events
+			std::array<int, 2> cursor; // In client coordinates, for mouse moves
+		};
+
+		// Far more than a frame's worth, even while sweeping the mouse across the window
+		constexpr std::size_t max_window_events {1024};
+
+		// Kept clear of mouse moves, which are the only events that may be dropped, for key and focus changes
+		constexpr std::size_t reserved_window_events {256};
+
+		// Shared between the window thread and the game thread; attached to the window as its user data
+		struct window_state {
+			std::atomic_bool is_exit_required {};
+
+			// Zero when there is no resize to apply; only the latest size matters, so it is never queued or dropped
+			std::atomic<extent2d> pending_size {};
+
+			spsc_queue<window_event, max_window_events> events {}; // Filled by the window thread only
+		};
+
+		window_state* get_window_state(HWND window) noexcept
+		{
+			return reinterpret_cast<window_state*>(GetWindowLongPtr(window, GWLP_USERDATA));
+		}
+
+		// Events arriving before the state is attached are dropped; the swap chain picks up the initial size itself
+		void push_event(HWND window, window_event event) noexcept
+		{
+			if (const auto state = get_window_state(window)) {
+				event.time = frame_clock::now();
+				const auto is_lossy = event.type == window_event_type::mouse_move;
+				state->events.try_push(event, is_lossy ? reserved_window_events : 0);
+			}
+		}
+
 		LRESULT handle_message(HWND window, UINT message, WPARAM w, LPARAM l) noexcept
 		{
 			switch (message) {
@@ -33,6 +115,41 @@ namespace cube {
 				ShowWindow(window, SW_SHOW);
 				return 0;
 
+			case WM_SIZE: {
+				// Sizes arriving before the state is attached are picked up from the swap chain itself
+				const auto state = get_window_state(window);
+				if (state && w != SIZE_MINIMIZED)
+					state->pending_size = {LOWORD(l), HIWORD(l)};
+
+				return 0;
+			}
+
+			case WM_KEYDOWN:
+			case WM_KEYUP: {
+				const auto is_down = message == WM_KEYDOWN;
+				const auto type = is_down ? window_event_type::key_down : window_event_type::key_up;
+				push_event(window, {.type {type}, .key {gsl::narrow_cast<unsigned int>(w)}});
+				if (is_down && w == VK_F8)
+					return 0;
+
+				return DefWindowProc(window, message, w, l);
+			}
+
+			case WM_SETFOCUS:
+			case WM_KILLFOCUS: {
+				const auto type
+					= message == WM_SETFOCUS ? window_event_type::focus_gained : window_event_type::focus_lost;
+
+				push_event(window, {.type {type}});
+				return DefWindowProc(window, message, w, l);
+			}
+
+			case WM_MOUSEMOVE: {
+				const std::array<int, 2> cursor {static_cast<short>(LOWORD(l)), static_cast<short>(HIWORD(l))};
+				push_event(window, {.type {window_event_type::mouse_move}, .cursor {cursor}});
+				return 0;
+			}
+
 			case WM_CLOSE:
 				ShowWindow(window, SW_HIDE);
 				PostQuitMessage(0);
@@ -74,25 +191,25 @@ namespace cube {
 			return winrt::capture<ID3D12DescriptorHeap>(&device, &ID3D12Device::CreateDescriptorHeap, &info);
 		}
 
-		auto create_command_allocator(ID3D12Device& device)
+		auto create_command_allocator(
+			ID3D12Device& device, D3D12_COMMAND_LIST_TYPE type = D3D12_COMMAND_LIST_TYPE_DIRECT)
 		{
-			return winrt::capture<ID3D12CommandAllocator>(
-				&device, &ID3D12Device::CreateCommandAllocator, D3D12_COMMAND_LIST_TYPE_DIRECT);
+			return winrt::capture<ID3D12CommandAllocator>(&device, &ID3D12Device::CreateCommandAllocator, type);
 		}
 
-		auto create_command_list(ID3D12Device4& device)
+		auto create_command_list(ID3D12Device4& device, D3D12_COMMAND_LIST_TYPE type = D3D12_COMMAND_LIST_TYPE_DIRECT)
 		{
 			return winrt::capture<ID3D12GraphicsCommandList>(
-				&device,
-				&ID3D12Device4::CreateCommandList1,
-				0,
-				D3D12_COMMAND_LIST_TYPE_DIRECT,
-				D3D12_COMMAND_LIST_FLAG_NONE);
+				&device, &ID3D12Device4::CreateCommandList1, 0, type, D3D12_COMMAND_LIST_FLAG_NONE);
 		}
 
-		auto create_default_pipeline_state(ID3D12Device& device, ID3D12RootSignature& root_signature)
+		auto create_graphics_pipeline_state(
+			ID3D12Device& device,
+			ID3D12RootSignature& root_signature,
+			gsl::cwzstring<> vertex_shader_name,
+			gsl::span<const D3D12_INPUT_ELEMENT_DESC> elements)
 		{
-			const auto vertex_shader = load_compiled_shader(L"vertex.cso");
+			const auto vertex_shader = load_compiled_shader(vertex_shader_name);
 			const auto pixel_shader = load_compiled_shader(L"pixel.cso");
 
 			D3D12_GRAPHICS_PIPELINE_STATE_DESC info {};
@@ -115,28 +232,66 @@ namespace cube {
 			info.RTVFormats[0] = DXGI_FORMAT_R8G8B8A8_UNORM_SRGB;
 			info.DSVFormat = DXGI_FORMAT_D32_FLOAT;
 			info.SampleDesc.Count = 1;
+			info.InputLayout.NumElements = gsl::narrow_cast<UINT>(elements.size());
+			info.InputLayout.pInputElementDescs = elements.data();
+
+			return winrt::capture<ID3D12PipelineState>(&device, &ID3D12Device::CreateGraphicsPipelineState, &info);
+		}
 
+		auto get_position_element() noexcept
+		{
 			D3D12_INPUT_ELEMENT_DESC position {};
 			position.Format = DXGI_FORMAT_R32G32B32_FLOAT;
 			position.InputSlotClass = D3D12_INPUT_CLASSIFICATION_PER_VERTEX_DATA;
 			position.SemanticName = "POSITION";
+			return position;
+		}
+
+		auto create_default_pipeline_state(ID3D12Device& device, ID3D12RootSignature& root_signature)
+		{
+			std::array<D3D12_INPUT_ELEMENT_DESC, 2> elements {get_position_element()};
 
-			info.InputLayout.NumElements = 1;
-			info.InputLayout.pInputElementDescs = &position;
+			// Which instance transform to use, so that draws can skip culled instances
+			auto& instance = elements.at(1);
+			instance.Format = DXGI_FORMAT_R32_UINT;
+			instance.InputSlot = 1;
+			instance.InputSlotClass = D3D12_INPUT_CLASSIFICATION_PER_INSTANCE_DATA;
+			instance.InstanceDataStepRate = 1;
+			instance.SemanticName = "INSTANCE";
 
-			return winrt::capture<ID3D12PipelineState>(&device, &ID3D12Device::CreateGraphicsPipelineState, &info);
+			return create_graphics_pipeline_state(device, root_signature, L"vertex.cso", elements);
+		}
+
+		// Instances are looked up through the visible list the cull shader wrote, so there is no instance stream
+		auto create_indirect_pipeline_state(ID3D12Device& device, ID3D12RootSignature& root_signature)
+		{
+			const std::array elements {get_position_element()};
+			return create_graphics_pipeline_state(device, root_signature, L"indirect_vertex.cso", elements);
 		}
 
-		auto create_root_signature(ID3D12Device& device)
+		auto create_compute_pipeline_state(
+			ID3D12Device& device,
+			ID3D12RootSignature& root_signature,
+			gsl::cwzstring<> shader_name)
 		{
-			D3D12_ROOT_PARAMETER constants {};
-			constants.ParameterType = D3D12_ROOT_PARAMETER_TYPE_32BIT_CONSTANTS;
-			constants.Constants.Num32BitValues = 4 * 4 * 2;
+			const auto shader = load_compiled_shader(shader_name);
 
+			D3D12_COMPUTE_PIPELINE_STATE_DESC info {};
+			info.pRootSignature = &root_signature;
+			info.CS.BytecodeLength = shader.size();
+			info.CS.pShaderBytecode = shader.data();
+			return winrt::capture<ID3D12PipelineState>(&device, &ID3D12Device::CreateComputePipelineState, &info);
+		}
+
+		auto create_root_signature(
+			ID3D12Device& device,
+			gsl::span<const D3D12_ROOT_PARAMETER> parameters,
+			D3D12_ROOT_SIGNATURE_FLAGS flags)
+		{
 			D3D12_ROOT_SIGNATURE_DESC info {};
-			info.Flags = D3D12_ROOT_SIGNATURE_FLAG_ALLOW_INPUT_ASSEMBLER_INPUT_LAYOUT;
-			info.NumParameters = 1;
-			info.pParameters = &constants;
+			info.Flags = flags;
+			info.NumParameters = gsl::narrow_cast<UINT>(parameters.size());
+			info.pParameters = parameters.data();
 
 			winrt::com_ptr<ID3DBlob> result {};
 			winrt::com_ptr<ID3DBlob> error {};
@@ -147,7 +302,83 @@ namespace cube {
 				&device, &ID3D12Device::CreateRootSignature, 0, result->GetBufferPointer(), result->GetBufferSize());
 		}
 
-		auto create_depth_buffer(ID3D12Device& device, D3D12_CPU_DESCRIPTOR_HANDLE dsv, const extent2d& size)
+		auto get_constants_parameter(unsigned int shader_register, unsigned int size) noexcept
+		{
+			D3D12_ROOT_PARAMETER parameter {};
+			parameter.ParameterType = D3D12_ROOT_PARAMETER_TYPE_32BIT_CONSTANTS;
+			parameter.Constants.ShaderRegister = shader_register;
+			parameter.Constants.Num32BitValues = size;
+			return parameter;
+		}
+
+		auto get_view_parameter(
+			D3D12_ROOT_PARAMETER_TYPE type,
+			unsigned int shader_register,
+			D3D12_SHADER_VISIBILITY visibility = D3D12_SHADER_VISIBILITY_ALL) noexcept
+		{
+			D3D12_ROOT_PARAMETER parameter {};
+			parameter.ParameterType = type;
+			parameter.Descriptor.ShaderRegister = shader_register;
+			parameter.ShaderVisibility = visibility;
+			return parameter;
+		}
+
+		auto create_default_root_signature(ID3D12Device& device)
+		{
+			const std::array parameters {
+				get_constants_parameter(0, 4 * 4 * 2),
+				get_view_parameter(D3D12_ROOT_PARAMETER_TYPE_SRV, 0, D3D12_SHADER_VISIBILITY_VERTEX)};
+
+			return create_root_signature(
+				device, parameters, D3D12_ROOT_SIGNATURE_FLAG_ALLOW_INPUT_ASSEMBLER_INPUT_LAYOUT);
+		}
+
+		// The default parameters, then the visible list and the per-draw constant set by each indirect command
+		auto create_indirect_root_signature(ID3D12Device& device)
+		{
+			const std::array parameters {
+				get_constants_parameter(0, 4 * 4 * 2),
+				get_view_parameter(D3D12_ROOT_PARAMETER_TYPE_SRV, 0, D3D12_SHADER_VISIBILITY_VERTEX),
+				get_view_parameter(D3D12_ROOT_PARAMETER_TYPE_SRV, 1, D3D12_SHADER_VISIBILITY_VERTEX),
+				get_constants_parameter(1, 1)};
+
+			return create_root_signature(
+				device, parameters, D3D12_ROOT_SIGNATURE_FLAG_ALLOW_INPUT_ASSEMBLER_INPUT_LAYOUT);
+		}
+
+		auto create_cull_root_signature(ID3D12Device& device)
+		{
+			const std::array parameters {
+				get_constants_parameter(0, sizeof(gpu_cull_constants) / sizeof(std::uint32_t)),
+				get_view_parameter(D3D12_ROOT_PARAMETER_TYPE_SRV, 0),
+				get_view_parameter(D3D12_ROOT_PARAMETER_TYPE_UAV, 0),
+				get_view_parameter(D3D12_ROOT_PARAMETER_TYPE_UAV, 1),
+				get_view_parameter(D3D12_ROOT_PARAMETER_TYPE_UAV, 2)};
+
+			return create_root_signature(device, parameters, D3D12_ROOT_SIGNATURE_FLAG_NONE);
+		}
+
+		static_assert(sizeof(indirect_draw) == sizeof(std::uint32_t) + sizeof(D3D12_DRAW_INDEXED_ARGUMENTS));
+
+		// Each command sets the draw's first visible instance, which SV_InstanceID doesn't account for, then draws
+		auto create_indirect_command_signature(ID3D12Device& device, ID3D12RootSignature& root_signature)
+		{
+			std::array<D3D12_INDIRECT_ARGUMENT_DESC, 2> arguments {};
+			auto& first_visible = arguments.at(0);
+			first_visible.Type = D3D12_INDIRECT_ARGUMENT_TYPE_CONSTANT;
+			first_visible.Constant.RootParameterIndex = 3;
+			first_visible.Constant.Num32BitValuesToSet = 1;
+			arguments.at(1).Type = D3D12_INDIRECT_ARGUMENT_TYPE_DRAW_INDEXED;
+
+			D3D12_COMMAND_SIGNATURE_DESC info {};
+			info.ByteStride = sizeof(indirect_draw);
+			info.NumArgumentDescs = gsl::narrow_cast<UINT>(arguments.size());
+			info.pArgumentDescs = arguments.data();
+			return winrt::capture<ID3D12CommandSignature>(
+				&device, &ID3D12Device::CreateCommandSignature, &info, &root_signature);
+		}
+
+		auto create_depth_buffer(ID3D12Device& device, const extent2d& size)
 		{
 			D3D12_HEAP_PROPERTIES properties {};
 			properties.Type = D3D12_HEAP_TYPE_DEFAULT;
@@ -166,7 +397,7 @@ namespace cube {
 			clear_value.DepthStencil.Depth = 1.0f;
 			clear_value.Format = info.Format;
 
-			const auto buffer = winrt::capture<ID3D12Resource>(
+			return winrt::capture<ID3D12Resource>(
 				&device,
 				&ID3D12Device::CreateCommittedResource,
 				&properties,
@@ -174,44 +405,137 @@ namespace cube {
 				&info,
 				D3D12_RESOURCE_STATE_DEPTH_WRITE,
 				&clear_value);
+		}
 
+		void create_depth_view(ID3D12Device& device, ID3D12Resource& buffer, D3D12_CPU_DESCRIPTOR_HANDLE dsv)
+		{
 			D3D12_DEPTH_STENCIL_VIEW_DESC dsv_info {};
-			dsv_info.Format = info.Format;
+			dsv_info.Format = DXGI_FORMAT_D32_FLOAT;
 			dsv_info.ViewDimension = D3D12_DSV_DIMENSION_TEXTURE2D;
-			device.CreateDepthStencilView(buffer.get(), &dsv_info, dsv);
-
-			return buffer;
+			device.CreateDepthStencilView(&buffer, &dsv_info, dsv);
 		}
 
+		// Depth buffers are bucketed by size, so that drag-resizing reuses a few buffers instead of allocating per step
+		class depth_buffer_pool {
+		public:
+			depth_buffer_pool(ID3D12Device& device, D3D12_CPU_DESCRIPTOR_HANDLE dsv) : m_device {&device}, m_dsv {dsv}
+			{
+			}
+
+			// All buffers share one view, so the GPU must be done with the previously acquired one
+			winrt::com_ptr<ID3D12Resource> acquire(const extent2d& size)
+			{
+				const extent2d bucket {round_up(size.width), round_up(size.height)};
+				const auto found = std::find_if(
+					m_buffers.begin(), m_buffers.end(), [&bucket](const auto& entry) { return entry.size == bucket; });
+
+				// Kept in least-recently-used order, so the front is the one to evict
+				if (found != m_buffers.end()) {
+					std::rotate(found, std::next(found), m_buffers.end());
+				} else {
+					if (m_buffers.size() == max_buffers)
+						m_buffers.erase(m_buffers.begin());
+
+					m_buffers.push_back({bucket, create_depth_buffer(*m_device, bucket)});
+				}
+
+				const auto& buffer = m_buffers.back().buffer;
+				create_depth_view(*m_device, *buffer, m_dsv);
+				return buffer;
+			}
+
+		private:
+			static constexpr unsigned int bucket_granularity {256};
+			static constexpr std::size_t max_buffers {4};
+
+			struct pool_entry {
+				extent2d size;
+				winrt::com_ptr<ID3D12Resource> buffer;
+			};
+
+			ID3D12Device* const m_device {};
+			const D3D12_CPU_DESCRIPTOR_HANDLE m_dsv {};
+			std::vector<pool_entry> m_buffers {};
+
+			static unsigned int round_up(unsigned int value) noexcept
+			{
+				return (value + bucket_granularity - 1) / bucket_granularity * bucket_granularity;
+			}
+		};
+
 		auto attach_swap_chain(
 			IDXGIFactory3& factory,
-			ID3D12Device& device,
 			HWND window,
 			ID3D12CommandQueue& queue,
-			D3D12_CPU_DESCRIPTOR_HANDLE rtvs)
+			unsigned int buffer_count,
+			unsigned int flags)
 		{
 			DXGI_SWAP_CHAIN_DESC1 info {};
-			info.BufferCount = 2;
+			info.BufferCount = buffer_count;
 			info.BufferUsage = DXGI_USAGE_RENDER_TARGET_OUTPUT;
 			info.Format = DXGI_FORMAT_R8G8B8A8_UNORM;
 			info.SampleDesc.Count = 1;
 			info.SwapEffect = DXGI_SWAP_EFFECT_FLIP_DISCARD;
+			info.Flags = flags;
 			winrt::com_ptr<IDXGISwapChain1> swap_chain {};
 			winrt::check_hresult(
 				factory.CreateSwapChainForHwnd(&queue, window, &info, nullptr, nullptr, swap_chain.put()));
 
-			const auto rtv_size = device.GetDescriptorHandleIncrementSize(D3D12_DESCRIPTOR_HEAP_TYPE_RTV);
-			for (gsl::index i {}; i < 2; ++i) {
-				D3D12_RENDER_TARGET_VIEW_DESC rtv_info {};
-				rtv_info.ViewDimension = D3D12_RTV_DIMENSION_TEXTURE2D;
-				rtv_info.Format = DXGI_FORMAT_R8G8B8A8_UNORM_SRGB;
-				device.CreateRenderTargetView(
-					get_buffer(*swap_chain, gsl::narrow_cast<unsigned int>(i)).get(),
-					&rtv_info,
-					offset(rtvs, rtv_size, i));
+			return swap_chain.as<IDXGISwapChain3>();
+		}
+
+		present_mode resolve_present_mode(IDXGIFactory5& factory, present_mode requested)
+		{
+			if (requested != present_mode::tearing)
+				return requested;
+
+			BOOL is_tearing_supported {};
+			winrt::check_hresult(factory.CheckFeatureSupport(
+				DXGI_FEATURE_PRESENT_ALLOW_TEARING, &is_tearing_supported, sizeof(is_tearing_supported)));
+
+			if (!is_tearing_supported) {
+				log("present: tearing is not supported, falling back to vsync");
+				return present_mode::vsync;
 			}
 
-			return swap_chain.as<IDXGISwapChain3>();
+			return requested;
+		}
+
+		unsigned int get_swap_chain_flags(bool low_latency, present_mode mode) noexcept
+		{
+			unsigned int flags {};
+			if (low_latency)
+				flags |= DXGI_SWAP_CHAIN_FLAG_FRAME_LATENCY_WAITABLE_OBJECT;
+
+			if (mode == present_mode::tearing)
+				flags |= DXGI_SWAP_CHAIN_FLAG_ALLOW_TEARING;
+
+			return flags;
+		}
+
+		constexpr std::string_view get_name(present_mode mode) noexcept
+		{
+			switch (mode) {
+			case present_mode::vsync:
+				return "vsync";
+
+			case present_mode::tearing:
+				return "tearing";
+
+			case present_mode::offscreen:
+				return "offscreen";
+			}
+
+			return "unknown";
+		}
+
+		winrt::handle get_frame_latency_waitable(IDXGISwapChain2& swap_chain, const renderer_settings& settings)
+		{
+			if (!settings.low_latency)
+				return {};
+
+			winrt::check_hresult(swap_chain.SetMaximumFrameLatency(settings.max_frame_latency));
+			return winrt::handle {winrt::check_pointer(swap_chain.GetFrameLatencyWaitableObject())};
 		}
 
 		void maximize_rasterizer(ID3D12GraphicsCommandList& list, ID3D12Resource& target)
@@ -275,8 +599,8 @@ namespace cube {
 
 			descriptor_heaps() = default;
 
-			descriptor_heaps(ID3D12Device& device) :
-				rtv_heap {create_descriptor_heap(device, D3D12_DESCRIPTOR_HEAP_TYPE_RTV, 2)},
+			descriptor_heaps(ID3D12Device& device, unsigned int rtv_count) :
+				rtv_heap {create_descriptor_heap(device, D3D12_DESCRIPTOR_HEAP_TYPE_RTV, rtv_count)},
 				dsv_heap {create_descriptor_heap(device, D3D12_DESCRIPTOR_HEAP_TYPE_DSV, 1)},
 				rtv_base {rtv_heap->GetCPUDescriptorHandleForHeapStart()},
 				dsv_base {dsv_heap->GetCPUDescriptorHandleForHeapStart()}
@@ -284,6 +608,9 @@ namespace cube {
 			}
 		};
 
+		// How far the cube's corners are pulled in towards its inscribed sphere, which it still encloses
+		constexpr float cube_rounding {0.5f};
+
 		struct geometry_buffers {
 			vertex_buffer vertices {};
 			index_buffer indices {};
@@ -294,19 +621,13 @@ namespace cube {
 			ID3D12GraphicsCommandList& list,
 			ID3D12CommandAllocator& allocator,
 			ID3D12CommandQueue& queue,
-			gpu_fence& fence)
+			gpu_timeline& timeline,
+			const lod_mesh& mesh)
 		{
 			geometry_buffers geometry;
 
-			const auto object = load_wavefront("cube.wv");
-			const auto& vertices = object.positions;
-			std::vector<unsigned int> indices(object.faces.size() * 3);
-			for (gsl::index i {}; i < gsl::narrow_cast<gsl::index>(object.faces.size()); ++i) {
-				const auto& face = object.faces.at(i);
-				for (gsl::index j {}; j < 3; ++j)
-					indices.at(i * 3 + j) = face.indices.at(j) - 1;
-			}
-
+			const auto& vertices = mesh.positions;
+			const auto& indices = mesh.indices;
 			const auto upload_buffer = create_upload_buffer(
 				device, indices.size() * sizeof(unsigned int) + vertices.size() * sizeof(vector3));
 
@@ -338,195 +659,2234 @@ namespace cube {
 
 			winrt::check_hresult(list.Close());
 			execute(queue, list);
-			fence.bump(queue);
-			fence.block();
+			timeline.wait(timeline.signal(queue));
 
 			return geometry;
 		}
 
+		// Everything the cull shader reads and writes, sized for every instance
+		struct gpu_culling_resources {
+			winrt::com_ptr<ID3D12RootSignature> cull_root_signature {};
+			winrt::com_ptr<ID3D12PipelineState> cull_pipeline {};
+			winrt::com_ptr<ID3D12RootSignature> draw_root_signature {};
+			winrt::com_ptr<ID3D12PipelineState> draw_pipeline {};
+			winrt::com_ptr<ID3D12CommandSignature> command_signature {};
+			winrt::com_ptr<ID3D12Resource> bounds {}; // Center and radius, which never change
+			winrt::com_ptr<ID3D12Resource> visible {}; // One slice per group
+			winrt::com_ptr<ID3D12Resource> draws {}; // One per group
+			winrt::com_ptr<ID3D12Resource> draw_count {};
+			unsigned int instance_count {};
+			unsigned int group_count {};
+		};
+
+		gpu_culling_resources create_gpu_culling_resources(
+			ID3D12Device& device,
+			ID3D12GraphicsCommandList& list,
+			ID3D12CommandAllocator& allocator,
+			ID3D12CommandQueue& queue,
+			gpu_timeline& timeline,
+			const sphere_set& bounds)
+		{
+			gpu_culling_resources resources {};
+			resources.cull_root_signature = create_cull_root_signature(device);
+			resources.cull_pipeline
+				= create_compute_pipeline_state(device, *resources.cull_root_signature, L"cull.cso");
+
+			resources.draw_root_signature = create_indirect_root_signature(device);
+			resources.draw_pipeline = create_indirect_pipeline_state(device, *resources.draw_root_signature);
+			resources.command_signature = create_indirect_command_signature(device, *resources.draw_root_signature);
+			resources.instance_count = gsl::narrow<unsigned int>(bounds.size());
+			resources.group_count = gsl::narrow<unsigned int>(get_gpu_cull_group_count(bounds.size()));
+
+			const auto bounds_size = bounds.size() * sizeof(DirectX::XMFLOAT4);
+			const auto slot_count = resources.group_count * gpu_cull_group_size;
+			resources.bounds
+				= create_buffer(device, bounds_size, D3D12_RESOURCE_STATE_COPY_DEST, D3D12_RESOURCE_FLAG_NONE);
+
+			resources.visible = create_buffer(
+				device,
+				slot_count * sizeof(std::uint32_t),
+				D3D12_RESOURCE_STATE_COMMON,
+				D3D12_RESOURCE_FLAG_ALLOW_UNORDERED_ACCESS);
+
+			resources.draws = create_buffer(
+				device,
+				resources.group_count * sizeof(indirect_draw),
+				D3D12_RESOURCE_STATE_COMMON,
+				D3D12_RESOURCE_FLAG_ALLOW_UNORDERED_ACCESS);
+
+			resources.draw_count = create_buffer(
+				device, sizeof(std::uint32_t), D3D12_RESOURCE_STATE_COMMON, D3D12_RESOURCE_FLAG_ALLOW_UNORDERED_ACCESS);
+
+			const auto upload_buffer = create_upload_buffer(device, bounds_size);
+			const gsl::span<DirectX::XMFLOAT4> spheres {
+				static_cast<DirectX::XMFLOAT4*>(map(*upload_buffer)), bounds.size()};
+
+			for (std::size_t i {}; i < bounds.size(); ++i)
+				spheres[i] = {bounds.x()[i], bounds.y()[i], bounds.z()[i], bounds.radius()[i]};
+
+			unmap(*upload_buffer);
+			winrt::check_hresult(allocator.Reset());
+			winrt::check_hresult(list.Reset(&allocator, nullptr));
+			list.CopyBufferRegion(resources.bounds.get(), 0, upload_buffer.get(), 0, bounds_size);
+			winrt::check_hresult(list.Close());
+			execute(queue, list);
+			timeline.wait(timeline.signal(queue));
+
+			return resources;
+		}
+
+		struct draw_item {
+			std::uint64_t key; // See make_draw_key()
+			unsigned int index_count;
+			unsigned int instance_count;
+			unsigned int first_index;
+			int base_vertex;
+			unsigned int first_instance;
+		};
+
 		struct render_state {
-			const winrt::com_ptr<ID3D12Resource> depth_buffer {};
+			winrt::com_ptr<ID3D12Resource> depth_buffer {};
 			const D3D12_CPU_DESCRIPTOR_HANDLE dsv {};
-			geometry_buffers geometry {};
+			std::vector<geometry_buffers> geometries {}; // One per level of detail, finest first
 			view_matrices matrices {};
+			std::vector<draw_item> draws {};
+			D3D12_VERTEX_BUFFER_VIEW all_instances {}; // Every instance in order, for when nothing is culled
 		};
 
-		render_state
-		create_render_state(ID3D12Device& device, IDXGISwapChain1& swap_chain, D3D12_CPU_DESCRIPTOR_HANDLE dsv)
+		auto create_projection(const extent2d& extent)
 		{
-			const auto extent = get_extent(swap_chain);
 			const auto aspect = gsl::narrow<float>(extent.width) / extent.height;
+			return DirectX::XMMatrixPerspectiveFovLH(3.141f / 2.0f, aspect, 0.1f, 1000.0f);
+		}
+
+		render_state create_render_state(
+			depth_buffer_pool& depth_buffers,
+			const extent2d& extent,
+			D3D12_CPU_DESCRIPTOR_HANDLE dsv)
+		{
 			return {
-				create_depth_buffer(device, dsv, get_extent(swap_chain)),
+				depth_buffers.acquire(extent),
 				dsv,
 				{},
-				{DirectX::XMMatrixTranslation(0.0f, 0.0f, 50.0f),
-				 DirectX::XMMatrixPerspectiveFovLH(3.141f / 2.0f, aspect, 0.01f, 100.0f)}};
+				{DirectX::XMMatrixIdentity(), create_projection(extent)},
+				{},
+				{}};
 		}
 
-		struct per_frame_resource_table {
-			const winrt::com_ptr<ID3D12CommandAllocator> allocator {};
-			const winrt::com_ptr<ID3D12GraphicsCommandList> list {};
-			const winrt::com_ptr<ID3D12Resource> backbuffer {};
-			const D3D12_CPU_DESCRIPTOR_HANDLE rtv {};
+		template <typename type>
+		struct transient_allocation {
+			gsl::span<type> data;
+			D3D12_GPU_VIRTUAL_ADDRESS address;
+			std::size_t offset; // From the start of the transient buffer
 		};
 
-		void record_commands(
-			const per_frame_resource_table& frame,
-			const render_state& state,
-			ID3D12RootSignature& root_signature,
-			ID3D12PipelineState& pipeline_state)
-		{
-			winrt::check_hresult(frame.list->Reset(frame.allocator.get(), &pipeline_state));
+		/*
+			Scratch memory rewritten every frame, such as instance transforms. Each frame in flight owns a slice of one
+			persistently mapped upload buffer, which is only reset once that frame's fence has completed.
+		*/
+		class transient_allocator {
+		public:
+			transient_allocator(ID3D12Device& device, unsigned int frames_in_flight, std::size_t frame_capacity) :
+				m_frame_capacity {align(frame_capacity)},
+				m_buffer {create_upload_buffer(device, m_frame_capacity * frames_in_flight)},
+				m_data {static_cast<std::byte*>(map(*m_buffer))},
+				m_address {m_buffer->GetGPUVirtualAddress()}
+			{
+			}
 
-			frame.list->SetGraphicsRootSignature(&root_signature);
-			frame.list->SetGraphicsRoot32BitConstants(0, 4 * 4 * 2, &state.matrices, 0);
-			frame.list->IASetPrimitiveTopology(D3D_PRIMITIVE_TOPOLOGY_TRIANGLELIST);
-			frame.list->IASetVertexBuffers(0, 1, &state.geometry.vertices.view);
-			frame.list->IASetIndexBuffer(&state.geometry.indices.view);
-			frame.list->OMSetRenderTargets(1, &frame.rtv, false, &state.dsv);
-			maximize_rasterizer(*frame.list, *frame.backbuffer);
+			transient_allocator(transient_allocator&) = delete;
+			transient_allocator& operator=(transient_allocator&) = delete;
 
-			std::array barriers {
-				transition(*frame.backbuffer, D3D12_RESOURCE_STATE_COMMON, D3D12_RESOURCE_STATE_RENDER_TARGET)};
+			~transient_allocator() noexcept { unmap(*m_buffer); }
 
-			barrier(*frame.list, barriers);
+			void begin_frame(std::size_t frame_index) noexcept
+			{
+				m_frame_base = frame_index * m_frame_capacity;
+				m_offset = 0;
+			}
 
-			std::array clear_color {0.0f, 0.0f, 0.0f, 1.0f};
-			frame.list->ClearDepthStencilView(state.dsv, D3D12_CLEAR_FLAG_DEPTH, 1.0f, 0, 0, nullptr);
-			frame.list->ClearRenderTargetView(frame.rtv, clear_color.data(), 0, nullptr);
-			frame.list->DrawIndexedInstanced(state.geometry.indices.size, 1, 0, 0, 0);
+			// The memory is write-combined, so it should be written sequentially and never read back
+			template <typename type>
+			transient_allocation<type> allocate(std::size_t count)
+			{
+				const auto size = align(count * sizeof(type));
+				Expects(m_offset + size <= m_frame_capacity);
+				const auto offset = m_frame_base + m_offset;
+				m_offset += size;
+				return {{reinterpret_cast<type*>(m_data + offset), count}, m_address + offset, offset};
+			}
 
-			reverse(barriers.front());
-			barrier(*frame.list, barriers);
+			ID3D12Resource& buffer() const noexcept { return *m_buffer; }
 
-			winrt::check_hresult(frame.list->Close());
-		}
+			// Every allocation is rounded up to this on its own, so a frame needs the sum of its rounded sizes
+			static constexpr std::size_t align(std::size_t size) noexcept
+			{
+				constexpr std::size_t alignment {D3D12_CONSTANT_BUFFER_DATA_PLACEMENT_ALIGNMENT};
+				return (size + alignment - 1) / alignment * alignment;
+			}
+
+		private:
+			const std::size_t m_frame_capacity;
+			const winrt::com_ptr<ID3D12Resource> m_buffer;
+			std::byte* const m_data;
+			const D3D12_GPU_VIRTUAL_ADDRESS m_address;
+			std::size_t m_frame_base {};
+			std::size_t m_offset {};
+		};
 
-		auto
-		create_frame_resources(ID3D12Device4& device, IDXGISwapChain& swap_chain, D3D12_CPU_DESCRIPTOR_HANDLE rtv_base)
+		// The most a frame allocates: every instance's transform uploaded, every instance visible, and the GPU culling
+		// path's zeroed draw counter
+		constexpr std::size_t get_transient_frame_capacity(std::size_t instance_count) noexcept
 		{
-			const auto rtv_size = device.GetDescriptorHandleIncrementSize(D3D12_DESCRIPTOR_HEAP_TYPE_RTV);
-			return std::array {
-				per_frame_resource_table {
-					create_command_allocator(device),
-					create_command_list(device),
-					get_buffer(swap_chain, 0),
-					offset(rtv_base, rtv_size, 0)},
-				per_frame_resource_table {
-					create_command_allocator(device),
-					create_command_list(device),
-					get_buffer(swap_chain, 1),
-					offset(rtv_base, rtv_size, 1)}};
+			return transient_allocator::align(instance_count * sizeof(DirectX::XMFLOAT3X4))
+				+ transient_allocator::align(instance_count * sizeof(std::uint32_t))
+				+ transient_allocator::align(sizeof(std::uint32_t));
 		}
 
-		class d3d12_renderer {
+		struct command_recorder {
+			const winrt::com_ptr<ID3D12CommandAllocator> allocator {};
+			const winrt::com_ptr<ID3D12GraphicsCommandList> list {};
+		};
+
+		// One recorder per draw range, so that the ranges can be recorded on different threads
+		struct per_frame_resource_table {
+			const std::vector<command_recorder> recorders {};
+			const std::vector<ID3D12CommandList*> lists {}; // In recorder order, ready to be submitted
+		};
+
+		struct backbuffer_table {
+			const winrt::com_ptr<ID3D12Resource> backbuffer {};
+			const D3D12_CPU_DESCRIPTOR_HANDLE rtv {};
+		};
+
+		/*
+			Each frame slot gets its own range of timestamps, resolved into a readback buffer at the end of the frame.
+			A range is only read once the slot's fence token has completed, so reading never stalls.
+		*/
+		class timestamp_queries {
 		public:
-			d3d12_renderer(HWND window, bool enable_debugging) :
-				d3d12_renderer {
-					*winrt::capture<IDXGIFactory6>(
-						CreateDXGIFactory2, enable_debugging ? DXGI_CREATE_FACTORY_DEBUG : 0),
-					window,
-					enable_debugging}
+			enum marker : unsigned int {
+				frame_start,
+				clear_end,
+				draw_end,
+				count
+			};
+
+			timestamp_queries(ID3D12Device& device, ID3D12CommandQueue& queue, unsigned int frames_in_flight) :
+				m_heap {create_query_heap(device, marker::count * frames_in_flight)},
+				m_readback {create_readback_buffer(device, marker::count * frames_in_flight * sizeof(std::uint64_t))},
+				m_frequency {get_frequency(queue)}
 			{
-				// Need to execute copy commands here
-				auto& frame = m_frame_resources.front();
-				m_state.geometry = load_geometry(*m_device, *frame.list, *frame.allocator, *m_queue, m_fence);
+				calibrate(queue);
 			}
 
-			d3d12_renderer(d3d12_renderer&) = delete;
-			d3d12_renderer(d3d12_renderer&&) = delete;
-			d3d12_renderer& operator=(d3d12_renderer&) = delete;
-			d3d12_renderer& operator=(d3d12_renderer&&) = delete;
-
-			~d3d12_renderer() noexcept
+			// Maps GPU ticks onto the CPU clock for tracing; repeated periodically, since the two clocks drift apart
+			void calibrate(ID3D12CommandQueue& queue)
 			{
-				GSL_SUPPRESS(f .6)
-				m_fence.block();
+				std::uint64_t gpu_time {};
+				std::uint64_t cpu_time {};
+				winrt::check_hresult(queue.GetClockCalibration(&gpu_time, &cpu_time));
+
+				// The same conversion steady_clock applies to QueryPerformanceCounter()
+				LARGE_INTEGER frequency {};
+				winrt::check_bool(QueryPerformanceFrequency(&frequency));
+				const auto cpu_frequency = gsl::narrow_cast<std::uint64_t>(frequency.QuadPart);
+				constexpr std::uint64_t nanoseconds_per_second {1'000'000'000};
+				const auto nanoseconds = cpu_time / cpu_frequency * nanoseconds_per_second
+					+ cpu_time % cpu_frequency * nanoseconds_per_second / cpu_frequency;
+
+				m_calibration_gpu_time = gpu_time;
+				m_calibration_cpu_time = trace_clock::time_point {std::chrono::duration_cast<trace_clock::duration>(
+					std::chrono::nanoseconds {gsl::narrow_cast<std::chrono::nanoseconds::rep>(nanoseconds)})};
 			}
 
-			void render()
+			void mark(ID3D12GraphicsCommandList& list, std::size_t frame, marker index) const
 			{
-				m_fence.block(1);
-				const auto index = m_swap_chain->GetCurrentBackBufferIndex();
-				auto& frame = m_frame_resources.at(index);
-				winrt::check_hresult(frame.allocator->Reset());
-
-				// FIXME: This thing is really, really oversized / hyper-specialized
-				record_commands(frame, m_state, *m_root_signature, *m_pipeline);
+				list.EndQuery(m_heap.get(), D3D12_QUERY_TYPE_TIMESTAMP, get_first(frame) + index);
+			}
 
-				execute(*m_queue, *frame.list);
-				winrt::check_hresult(m_swap_chain->Present(1, 0));
-				m_fence.bump(*m_queue);
+			void resolve(ID3D12GraphicsCommandList& list, std::size_t frame) const
+			{
+				list.ResolveQueryData(
+					m_heap.get(),
+					D3D12_QUERY_TYPE_TIMESTAMP,
+					get_first(frame),
+					marker::count,
+					m_readback.get(),
+					get_first(frame) * sizeof(std::uint64_t));
 			}
 
-			auto& view() noexcept { return m_state.matrices.view; }
+			void read(std::size_t frame, frame_statistics& statistics) const
+			{
+				const auto begin = get_first(frame) * sizeof(std::uint64_t);
+				std::array<std::uint64_t, marker::count> ticks {};
+				const D3D12_RANGE range {begin, begin + sizeof(ticks)};
+				void* data {};
+				winrt::check_hresult(m_readback->Map(0, &range, &data));
+				std::memcpy(ticks.data(), std::next(static_cast<const char*>(data), begin), sizeof(ticks));
+
+				const D3D12_RANGE written {};
+				m_readback->Unmap(0, &written);
+
+				statistics.record(frame_timer::gpu_frame, get_elapsed(ticks.at(frame_start), ticks.at(draw_end)));
+				statistics.record(frame_timer::gpu_clear, get_elapsed(ticks.at(frame_start), ticks.at(clear_end)));
+				statistics.record(frame_timer::gpu_draw, get_elapsed(ticks.at(clear_end), ticks.at(draw_end)));
+				if (is_tracing()) {
+					const auto clear_start = to_cpu_time(ticks.at(frame_start));
+					const auto draw_start = to_cpu_time(ticks.at(clear_end));
+					trace_gpu_span("gpu clear", clear_start, draw_start);
+					trace_gpu_span("gpu draw", draw_start, to_cpu_time(ticks.at(draw_end)));
+				}
+			}
 
 		private:
-			const winrt::com_ptr<ID3D12Device4> m_device {};
-			const winrt::com_ptr<ID3D12CommandQueue> m_queue {};
-			const descriptor_heaps m_heaps {};
-			gpu_fence m_fence;
+			const winrt::com_ptr<ID3D12QueryHeap> m_heap {};
+			const winrt::com_ptr<ID3D12Resource> m_readback {};
+			const std::uint64_t m_frequency {};
+			std::uint64_t m_calibration_gpu_time {};
+			trace_clock::time_point m_calibration_cpu_time {};
 
-			const winrt::com_ptr<ID3D12RootSignature> m_root_signature {};
-			const winrt::com_ptr<ID3D12PipelineState> m_pipeline {};
-			const winrt::com_ptr<IDXGISwapChain3> m_swap_chain {};
+			static auto create_query_heap(ID3D12Device& device, unsigned int size)
+			{
+				D3D12_QUERY_HEAP_DESC info {};
+				info.Type = D3D12_QUERY_HEAP_TYPE_TIMESTAMP;
+				info.Count = size;
+				return winrt::capture<ID3D12QueryHeap>(&device, &ID3D12Device::CreateQueryHeap, &info);
+			}
 
-			const std::array<per_frame_resource_table, 2> m_frame_resources {};
-			render_state m_state {};
+			static std::uint64_t get_frequency(ID3D12CommandQueue& queue)
+			{
+				std::uint64_t frequency {};
+				winrt::check_hresult(queue.GetTimestampFrequency(&frequency));
+				return frequency;
+			}
 
-			// FIXME: a horrid hack, we should only have one upload ringbuffer
-			d3d12_renderer(IDXGIFactory6& factory, HWND window, bool enable_debugging) :
-				m_device {create_device(factory, enable_debugging)},
-				m_queue {create_command_queue(*m_device)},
-				m_heaps {*m_device},
-				m_fence {*m_device},
-				m_root_signature {create_root_signature(*m_device)},
-				m_pipeline {create_default_pipeline_state(*m_device, *m_root_signature)},
-				m_swap_chain {attach_swap_chain(factory, *m_device, window, *m_queue, m_heaps.rtv_base)},
-				m_frame_resources {create_frame_resources(*m_device, *m_swap_chain, m_heaps.rtv_base)},
-				m_state {create_render_state(*m_device, *m_swap_chain, m_heaps.dsv_base)}
+			static unsigned int get_first(std::size_t frame) noexcept
 			{
+				return gsl::narrow_cast<unsigned int>(frame) * marker::count;
 			}
-		};
 
-		void execute_game_thread(const std::atomic_bool& is_exit_required, HWND window, bool enable_debugging)
-		{
-			d3d12_renderer renderer {window, enable_debugging};
-			winrt::check_bool(PostMessage(window, ready_message, 0, 0));
-			std::uint64_t frame {};
-			while (!is_exit_required) {
-				renderer.render();
+			// Signed, as timestamps may predate the calibration
+			std::chrono::nanoseconds get_elapsed(std::uint64_t from, std::uint64_t to) const noexcept
+			{
+				const auto ticks = gsl::narrow_cast<double>(gsl::narrow_cast<std::int64_t>(to - from));
+				const auto seconds = ticks / gsl::narrow_cast<double>(m_frequency);
+				return std::chrono::nanoseconds {gsl::narrow_cast<std::chrono::nanoseconds::rep>(seconds * 1e9)};
+			}
+
+			trace_clock::time_point to_cpu_time(std::uint64_t ticks) const noexcept
+			{
+				return m_calibration_cpu_time
+					+ std::chrono::duration_cast<trace_clock::duration>(get_elapsed(m_calibration_gpu_time, ticks));
+			}
+		};
 
-				const auto angle = (frame / 60.0f) * 0.25f;
-				// Does the renderer always need to have the view matrix built in? It will be animated often
-				renderer.view() = DirectX::XMMatrixMultiply(
-					DirectX::XMMatrixRotationRollPitchYaw(angle, 0.0f, angle),
-					DirectX::XMMatrixTranslation(0.0f, 0.0f, 3.0f));
+		// What each draw binds, indexed by the fields of its sort key
+		struct draw_bindings {
+			gsl::span<ID3D12PipelineState* const> pipelines;
+			gsl::span<const geometry_buffers> geometries;
+		};
 
-				++frame;
+		// Lists are reset with the first pipeline bound; after that, only state that differs from the previous
+		// draw's is set again
+		void record_draws(
+			ID3D12GraphicsCommandList& list,
+			const draw_bindings& bindings,
+			const D3D12_VERTEX_BUFFER_VIEW& instances,
+			gsl::span<const draw_item> draws)
+		{
+			list.IASetPrimitiveTopology(D3D_PRIMITIVE_TOPOLOGY_TRIANGLELIST);
+			list.IASetVertexBuffers(1, 1, &instances);
+			std::uint32_t pipeline {};
+			std::optional<std::uint32_t> geometry {};
+			for (const auto& draw : draws) {
+				const auto state = get_draw_state(draw.key);
+				if (state.pipeline != pipeline) {
+					list.SetPipelineState(bindings.pipelines[state.pipeline]);
+					pipeline = state.pipeline;
+				}
+
+				if (state.geometry != geometry) {
+					const auto& buffers = bindings.geometries[state.geometry];
+					list.IASetVertexBuffers(0, 1, &buffers.vertices.view);
+					list.IASetIndexBuffer(&buffers.indices.view);
+					geometry = state.geometry;
+				}
+
+				list.DrawIndexedInstanced(
+					draw.index_count, draw.instance_count, draw.first_index, draw.base_vertex, draw.first_instance);
 			}
 		}
-	}
-}
 
-/*
-	I can identify four main complaints I have:
-	- d3d12_renderer is a *thicc* class
-	- record_commands is an oversized / over-specialized function
-	- there's a lot of duplicated code surrounding buffer creation
-	- upload buffer management is ad-hoc or non-existent
-	- Note that a lot of these resources can be easily grouped by usage
-	- Don't forget to never over-generalize
-*/
+		struct draw_bundle {
+			const winrt::com_ptr<ID3D12CommandAllocator> allocator {};
+			const winrt::com_ptr<ID3D12GraphicsCommandList> list {};
+			bool is_recorded {};
+		};
 
-int WinMain(HINSTANCE self, HINSTANCE, char*, int)
-{
-	using namespace cube;
+		/*
+			Draw ranges are static from frame to frame, so each range is recorded once into a bundle and replayed
+			afterwards. Bundles inherit the root signature and root constants from the direct list, so only the
+			bindings that depend on geometry and pipeline state are baked in; both are fixed once the renderer is built.
+		*/
+		class bundle_cache {
+		public:
+			bundle_cache(ID3D12Device4& device, std::size_t range_count)
+			{
+				m_bundles.reserve(range_count);
+				for (std::size_t i {}; i < range_count; ++i) {
+					m_bundles.push_back(
+						{create_command_allocator(device, D3D12_COMMAND_LIST_TYPE_BUNDLE),
+						 create_command_list(device, D3D12_COMMAND_LIST_TYPE_BUNDLE)});
+				}
+			}
 
-	WNDCLASS window_class {};
-	window_class.hInstance = self;
-	window_class.lpszClassName = L"cube::window";
+			// Each range is only ever touched by the thread recording it, so ranges may be requested concurrently
+			ID3D12GraphicsCommandList& get(
+				std::size_t range,
+				const render_state& state,
+				ID3D12PipelineState& pipeline_state,
+				const draw_bindings& bindings,
+				gsl::span<const draw_item> draws)
+			{
+				auto& bundle = m_bundles.at(range);
+				if (!bundle.is_recorded) {
+					const trace_scope scope {"record bundle"};
+					auto& list = *bundle.list;
+					winrt::check_hresult(bundle.allocator->Reset());
+					winrt::check_hresult(list.Reset(bundle.allocator.get(), &pipeline_state));
+					record_draws(list, bindings, state.all_instances, draws);
+					winrt::check_hresult(list.Close());
+					bundle.is_recorded = true;
+				}
+
+				return *bundle.list;
+			}
+
+		private:
+			std::vector<draw_bundle> m_bundles {};
+		};
+
+		// Copies a staged slice of the transient buffer into the persistent instance buffer
+		struct instance_upload {
+			std::size_t source_offset;
+			std::size_t first_instance;
+			std::size_t count;
+		};
+
+		// Keeps each staging copy short enough to spread over the pool
+		constexpr std::size_t instances_per_upload {16384};
+
+		/*
+			Reads back what the cull shader wrote each frame and checks it against cull_indirect_reference(), once the
+			frame's fence has completed. Every output is checked, including the draws of groups with nothing visible.
+		*/
+		class gpu_cull_validator {
+		public:
+			gpu_cull_validator(ID3D12Device& device, const sphere_set& bounds, unsigned int frames_in_flight) :
+				m_bounds {bounds},
+				m_group_count {get_gpu_cull_group_count(bounds.size())},
+				m_draws_size {m_group_count * sizeof(indirect_draw)},
+				m_visible_size {m_group_count * gpu_cull_group_size * sizeof(std::uint32_t)},
+				m_slot_size {m_draws_size + m_visible_size + sizeof(std::uint32_t)},
+				m_readback {create_readback_buffer(device, m_slot_size * frames_in_flight)},
+				m_constants(frames_in_flight),
+				m_draws(m_group_count),
+				m_visible(m_group_count * gpu_cull_group_size),
+				m_reference_draws(m_group_count),
+				m_reference_visible(m_group_count * gpu_cull_group_size)
+			{
+			}
+
+			// Expects the outputs in the states the draw left them in
+			void record(
+				ID3D12GraphicsCommandList& list,
+				std::size_t frame,
+				const gpu_culling_resources& culling,
+				const gpu_cull_constants& constants)
+			{
+				std::array barriers {
+					transition(
+						*culling.draws, D3D12_RESOURCE_STATE_INDIRECT_ARGUMENT, D3D12_RESOURCE_STATE_COPY_SOURCE),
+					transition(
+						*culling.visible,
+						D3D12_RESOURCE_STATE_NON_PIXEL_SHADER_RESOURCE,
+						D3D12_RESOURCE_STATE_COPY_SOURCE),
+					transition(
+						*culling.draw_count,
+						D3D12_RESOURCE_STATE_INDIRECT_ARGUMENT,
+						D3D12_RESOURCE_STATE_COPY_SOURCE)};
+
+				barrier(list, barriers);
+				const auto base = frame * m_slot_size;
+				list.CopyBufferRegion(m_readback.get(), base, culling.draws.get(), 0, m_draws_size);
+				list.CopyBufferRegion(m_readback.get(), base + m_draws_size, culling.visible.get(), 0, m_visible_size);
+				list.CopyBufferRegion(
+					m_readback.get(),
+					base + m_draws_size + m_visible_size,
+					culling.draw_count.get(),
+					0,
+					sizeof(std::uint32_t));
+
+				m_constants.at(frame) = constants;
+			}
+
+			void check(std::size_t frame)
+			{
+				auto& constants = m_constants.at(frame);
+				if (!constants)
+					return;
+
+				const auto base = frame * m_slot_size;
+				const D3D12_RANGE range {base, base + m_slot_size};
+				void* data {};
+				winrt::check_hresult(m_readback->Map(0, &range, &data));
+				const auto slot = std::next(static_cast<const char*>(data), base);
+				std::uint32_t count {};
+				std::memcpy(m_draws.data(), slot, m_draws_size);
+				std::memcpy(m_visible.data(), std::next(slot, m_draws_size), m_visible_size);
+				std::memcpy(&count, std::next(slot, m_draws_size + m_visible_size), sizeof(count));
+
+				const D3D12_RANGE written {};
+				m_readback->Unmap(0, &written);
+
+				const auto reference_count
+					= cull_indirect_reference(*constants, m_bounds, m_reference_visible, m_reference_draws);
+
+				constants.reset();
+				if (count != reference_count) {
+					log("gpu culling: {} draws, but the reference found {}", count, reference_count);
+					throw std::logic_error {"gpu culling disagrees with the reference"};
+				}
+
+				for (std::size_t group {}; group < m_group_count; ++group) {
+					const auto& draw = m_draws[group];
+					const auto& expected = m_reference_draws[group];
+					const auto first = group * gpu_cull_group_size;
+					const auto is_draw_equal = std::memcmp(&draw, &expected, sizeof(draw)) == 0;
+					if (!is_draw_equal
+						|| !std::equal(
+							std::next(m_visible.begin(), first),
+							std::next(m_visible.begin(), first + draw.instance_count),
+							std::next(m_reference_visible.begin(), first))) {
+						log("gpu culling: group {} has {} visible, but the reference found {}",
+							group,
+							draw.instance_count,
+							expected.instance_count);
+						throw std::logic_error {"gpu culling disagrees with the reference"};
+					}
+				}
+			}
+
+		private:
+			const sphere_set m_bounds;
+			const std::size_t m_group_count;
+			const std::size_t m_draws_size;
+			const std::size_t m_visible_size;
+			const std::size_t m_slot_size; // Draws, then visible, then the draw count
+			const winrt::com_ptr<ID3D12Resource> m_readback {};
+			std::vector<std::optional<gpu_cull_constants>> m_constants {}; // Of the frame each slot holds, if any
+			std::vector<indirect_draw> m_draws {};
+			std::vector<std::uint32_t> m_visible {};
+			std::vector<indirect_draw> m_reference_draws {};
+			std::vector<std::uint32_t> m_reference_visible {};
+		};
+
+		struct frame_context {
+			const backbuffer_table& target;
+			const render_state& state;
+			ID3D12RootSignature& root_signature;
+			ID3D12PipelineState& pipeline_state;
+			const draw_bindings& bindings;
+			const timestamp_queries& timestamps;
+			std::size_t frame_index;
+			bundle_cache& bundles;
+			ID3D12Resource& instance_buffer;
+			ID3D12Resource& transient_buffer;
+			gsl::span<const instance_upload> instance_uploads;
+			const D3D12_VERTEX_BUFFER_VIEW* visible_instances; // Null when nothing was culled
+		};
+
+		/*
+			Buffers decay to the common state after every submission, so the instance buffer is implicitly promoted
+			to a copy destination here; promotion stops at the first write state, so reads need a real transition.
+		*/
+		void record_instance_uploads(ID3D12GraphicsCommandList& list, const frame_context& context)
+		{
+			if (context.instance_uploads.empty())
+				return;
+
+			constexpr auto stride = sizeof(DirectX::XMFLOAT3X4);
+			for (const auto& upload : context.instance_uploads) {
+				list.CopyBufferRegion(
+					&context.instance_buffer,
+					upload.first_instance * stride,
+					&context.transient_buffer,
+					upload.source_offset,
+					upload.count * stride);
+			}
+
+			const std::array barriers {transition(
+				context.instance_buffer,
+				D3D12_RESOURCE_STATE_COPY_DEST,
+				D3D12_RESOURCE_STATE_NON_PIXEL_SHADER_RESOURCE)};
+
+			barrier(list, barriers);
+		}
+
+		// Transitions the target for drawing and clears it, once per frame
+		void begin_target(ID3D12GraphicsCommandList& list, const frame_context& context)
+		{
+			const std::array barriers {transition(
+				*context.target.backbuffer, D3D12_RESOURCE_STATE_COMMON, D3D12_RESOURCE_STATE_RENDER_TARGET)};
+
+			barrier(list, barriers);
+
+			std::array clear_color {0.0f, 0.0f, 0.0f, 1.0f};
+			list.ClearDepthStencilView(context.state.dsv, D3D12_CLEAR_FLAG_DEPTH, 1.0f, 0, 0, nullptr);
+			list.ClearRenderTargetView(context.target.rtv, clear_color.data(), 0, nullptr);
+			context.timestamps.mark(list, context.frame_index, timestamp_queries::clear_end);
+		}
+
+		void end_target(ID3D12GraphicsCommandList& list, const frame_context& context)
+		{
+			context.timestamps.mark(list, context.frame_index, timestamp_queries::draw_end);
+			const std::array barriers {transition(
+				*context.target.backbuffer, D3D12_RESOURCE_STATE_RENDER_TARGET, D3D12_RESOURCE_STATE_COMMON)};
+
+			barrier(list, barriers);
+			context.timestamps.resolve(list, context.frame_index);
+		}
+
+		// Every range sets up the same shared state; the first one also clears the target and the last one
+		// transitions it back, as the lists are submitted in range order
+		void record_range(
+			const command_recorder& recorder,
+			const frame_context& context,
+			std::size_t range,
+			gsl::span<const draw_item> draws,
+			bool is_first,
+			bool is_last)
+		{
+			auto& list = *recorder.list;
+			const auto& target = context.target;
+			const auto& state = context.state;
+			winrt::check_hresult(recorder.allocator->Reset());
+			winrt::check_hresult(list.Reset(recorder.allocator.get(), &context.pipeline_state));
+			if (is_first)
+				context.timestamps.mark(list, context.frame_index, timestamp_queries::frame_start);
+
+			list.SetGraphicsRootSignature(&context.root_signature);
+			list.SetGraphicsRoot32BitConstants(0, 4 * 4 * 2, &state.matrices, 0);
+			list.SetGraphicsRootShaderResourceView(1, context.instance_buffer.GetGPUVirtualAddress());
+			list.OMSetRenderTargets(1, &target.rtv, false, &state.dsv);
+			maximize_rasterizer(list, *target.backbuffer);
+			if (is_first) {
+				record_instance_uploads(list, context);
+				begin_target(list, context);
+			}
+
+			// Culling results change every frame, so they can't be baked into a bundle
+			if (context.visible_instances) {
+				record_draws(list, context.bindings, *context.visible_instances, draws);
+			} else {
+				auto& bundle = context.bundles.get(range, state, context.pipeline_state, context.bindings, draws);
+				list.ExecuteBundle(&bundle);
+			}
+
+			if (is_last)
+				end_target(list, context);
+
+			winrt::check_hresult(list.Close());
+		}
+
+		/*
+			Culls and draws the whole frame from one list. The cull shader writes a draw for each group of instances
+			and the number of draws worth issuing, which a single ExecuteIndirect() consumes; the CPU never learns
+			what is visible. The buffers start each frame in the common state they decay to after every submission,
+			and culling runs after the clear, so it counts towards the GPU draw time.
+		*/
+		void record_gpu_culled_frame(
+			const command_recorder& recorder,
+			const frame_context& context,
+			const gpu_culling_resources& culling,
+			const gpu_cull_constants& constants,
+			const transient_allocation<std::uint32_t>& zero,
+			gpu_cull_validator* validator)
+		{
+			auto& list = *recorder.list;
+			const auto& state = context.state;
+			winrt::check_hresult(recorder.allocator->Reset());
+			winrt::check_hresult(list.Reset(recorder.allocator.get(), culling.cull_pipeline.get()));
+			context.timestamps.mark(list, context.frame_index, timestamp_queries::frame_start);
+			record_instance_uploads(list, context);
+			begin_target(list, context);
+
+			// Groups only ever raise the count, so it has to start from zero
+			list.CopyBufferRegion(
+				culling.draw_count.get(), 0, &context.transient_buffer, zero.offset, sizeof(std::uint32_t));
+
+			std::array barriers {
+				transition(*culling.draw_count, D3D12_RESOURCE_STATE_COPY_DEST, D3D12_RESOURCE_STATE_UNORDERED_ACCESS),
+				transition(*culling.visible, D3D12_RESOURCE_STATE_COMMON, D3D12_RESOURCE_STATE_UNORDERED_ACCESS),
+				transition(*culling.draws, D3D12_RESOURCE_STATE_COMMON, D3D12_RESOURCE_STATE_UNORDERED_ACCESS)};
+
+			barrier(list, barriers);
+			list.SetComputeRootSignature(culling.cull_root_signature.get());
+			list.SetComputeRoot32BitConstants(0, sizeof(constants) / sizeof(std::uint32_t), &constants, 0);
+			list.SetComputeRootShaderResourceView(1, culling.bounds->GetGPUVirtualAddress());
+			list.SetComputeRootUnorderedAccessView(2, culling.visible->GetGPUVirtualAddress());
+			list.SetComputeRootUnorderedAccessView(3, culling.draws->GetGPUVirtualAddress());
+			list.SetComputeRootUnorderedAccessView(4, culling.draw_count->GetGPUVirtualAddress());
+			list.Dispatch(culling.group_count, 1, 1);
+
+			barriers = {
+				transition(
+					*culling.draw_count,
+					D3D12_RESOURCE_STATE_UNORDERED_ACCESS,
+					D3D12_RESOURCE_STATE_INDIRECT_ARGUMENT),
+				transition(
+					*culling.visible,
+					D3D12_RESOURCE_STATE_UNORDERED_ACCESS,
+					D3D12_RESOURCE_STATE_NON_PIXEL_SHADER_RESOURCE),
+				transition(
+					*culling.draws, D3D12_RESOURCE_STATE_UNORDERED_ACCESS, D3D12_RESOURCE_STATE_INDIRECT_ARGUMENT)};
+
+			barrier(list, barriers);
+			list.SetPipelineState(culling.draw_pipeline.get());
+			list.SetGraphicsRootSignature(culling.draw_root_signature.get());
+			list.SetGraphicsRoot32BitConstants(0, 4 * 4 * 2, &state.matrices, 0);
+			list.SetGraphicsRootShaderResourceView(1, context.instance_buffer.GetGPUVirtualAddress());
+			list.SetGraphicsRootShaderResourceView(2, culling.visible->GetGPUVirtualAddress());
+			list.OMSetRenderTargets(1, &context.target.rtv, false, &state.dsv);
+			maximize_rasterizer(list, *context.target.backbuffer);
+			list.IASetPrimitiveTopology(D3D_PRIMITIVE_TOPOLOGY_TRIANGLELIST);
+			const auto& geometry = state.geometries.front();
+			list.IASetVertexBuffers(0, 1, &geometry.vertices.view);
+			list.IASetIndexBuffer(&geometry.indices.view);
+			list.ExecuteIndirect(
+				culling.command_signature.get(),
+				culling.group_count,
+				culling.draws.get(),
+				0,
+				culling.draw_count.get(),
+				0);
+
+			end_target(list, context);
+			if (validator)
+				validator->record(list, context.frame_index, culling, constants);
+
+			winrt::check_hresult(list.Close());
+		}
+
+		// Draw keys carry the level of detail in their geometry field
+		std::array<std::uint64_t, max_lod_levels> count_triangles(gsl::span<const draw_item> draws)
+		{
+			std::array<std::uint64_t, max_lod_levels> counts {};
+			for (const auto& draw : draws) {
+				const auto triangles = std::uint64_t {draw.index_count} / 3 * draw.instance_count;
+				counts.at(get_draw_state(draw.key).geometry) += triangles;
+			}
+
+			return counts;
+		}
+
+		// Visible instances are drawn in batches this size, so that there is an order to sort
+		constexpr std::size_t instances_per_batch {1024};
+
+		std::size_t get_batch_count(std::size_t instance_count) noexcept
+		{
+			return (instance_count + instances_per_batch - 1) / instances_per_batch;
+		}
+
+		// Small draw lists aren't worth the cost of another command list
+		constexpr std::size_t min_draws_per_range {256};
+		constexpr std::size_t min_instances_per_range {16384};
+
+		std::size_t get_range_count(std::size_t count, std::size_t min_per_range, std::size_t recorder_count) noexcept
+		{
+			const auto wanted = (count + min_per_range - 1) / min_per_range;
+			return std::clamp(wanted, std::size_t {1}, recorder_count);
+		}
+
+		auto create_frame_resources(ID3D12Device4& device, unsigned int frames_in_flight, std::size_t recorder_count)
+		{
+			std::vector<per_frame_resource_table> frames {};
+			frames.reserve(frames_in_flight);
+			for (unsigned int i {}; i < frames_in_flight; ++i) {
+				std::vector<command_recorder> recorders {};
+				std::vector<ID3D12CommandList*> lists {};
+				for (std::size_t j {}; j < recorder_count; ++j) {
+					const auto& recorder
+						= recorders.emplace_back(create_command_allocator(device), create_command_list(device));
+
+					lists.push_back(recorder.list.get());
+				}
+
+				frames.push_back({std::move(recorders), std::move(lists)});
+			}
+
+			return frames;
+		}
+
+		auto create_backbuffer_tables(
+			ID3D12Device& device,
+			IDXGISwapChain1& swap_chain,
+			D3D12_CPU_DESCRIPTOR_HANDLE rtv_base)
+		{
+			DXGI_SWAP_CHAIN_DESC1 info {};
+			winrt::check_hresult(swap_chain.GetDesc1(&info));
+
+			const auto rtv_size = device.GetDescriptorHandleIncrementSize(D3D12_DESCRIPTOR_HEAP_TYPE_RTV);
+			std::vector<backbuffer_table> backbuffers {};
+			backbuffers.reserve(info.BufferCount);
+			for (unsigned int i {}; i < info.BufferCount; ++i) {
+				D3D12_RENDER_TARGET_VIEW_DESC rtv_info {};
+				rtv_info.ViewDimension = D3D12_RTV_DIMENSION_TEXTURE2D;
+				rtv_info.Format = DXGI_FORMAT_R8G8B8A8_UNORM_SRGB;
+
+				const auto rtv = offset(rtv_base, rtv_size, i);
+				auto buffer = get_buffer(swap_chain, i);
+				device.CreateRenderTargetView(buffer.get(), &rtv_info, rtv);
+				backbuffers.push_back({std::move(buffer), rtv});
+			}
+
+			return backbuffers;
+		}
+
+		// Input-to-completion time, taken by the completion thread as soon as the frame's fence token is reached
+		struct latency_statistics {
+			frame_clock::duration last {};
+			frame_clock::duration total {};
+			std::uint64_t count {};
+			frame_clock::time_point report_time {frame_clock::now()};
+		};
+
+		auto create_offscreen_target(ID3D12Device& device, D3D12_CPU_DESCRIPTOR_HANDLE rtv, const extent2d& size)
+		{
+			D3D12_HEAP_PROPERTIES properties {};
+			properties.Type = D3D12_HEAP_TYPE_DEFAULT;
+
+			D3D12_RESOURCE_DESC info {};
+			info.Dimension = D3D12_RESOURCE_DIMENSION_TEXTURE2D;
+			info.DepthOrArraySize = 1;
+			info.Width = size.width;
+			info.Height = size.height;
+			info.MipLevels = 1;
+			info.SampleDesc.Count = 1;
+			info.Format = DXGI_FORMAT_R8G8B8A8_UNORM_SRGB;
+			info.Flags = D3D12_RESOURCE_FLAG_ALLOW_RENDER_TARGET;
+
+			D3D12_CLEAR_VALUE clear_value {};
+			clear_value.Format = info.Format;
+			clear_value.Color[3] = 1.0f;
+
+			const auto buffer = winrt::capture<ID3D12Resource>(
+				&device,
+				&ID3D12Device::CreateCommittedResource,
+				&properties,
+				D3D12_HEAP_FLAG_NONE,
+				&info,
+				D3D12_RESOURCE_STATE_COMMON,
+				&clear_value);
+
+			D3D12_RENDER_TARGET_VIEW_DESC rtv_info {};
+			rtv_info.ViewDimension = D3D12_RTV_DIMENSION_TEXTURE2D;
+			rtv_info.Format = info.Format;
+			device.CreateRenderTargetView(buffer.get(), &rtv_info, rtv);
+
+			return buffer;
+		}
+
+		// Offscreen targets reuse the swap chain's RTV slots, since its buffers are never rendered to
+		auto create_render_targets(
+			ID3D12Device& device,
+			IDXGISwapChain1& swap_chain,
+			D3D12_CPU_DESCRIPTOR_HANDLE rtv_base,
+			present_mode mode,
+			const extent2d& size)
+		{
+			if (mode != present_mode::offscreen)
+				return create_backbuffer_tables(device, swap_chain, rtv_base);
+
+			DXGI_SWAP_CHAIN_DESC1 info {};
+			winrt::check_hresult(swap_chain.GetDesc1(&info));
+
+			const auto rtv_size = device.GetDescriptorHandleIncrementSize(D3D12_DESCRIPTOR_HEAP_TYPE_RTV);
+			std::vector<backbuffer_table> targets {};
+			targets.reserve(info.BufferCount);
+			for (unsigned int i {}; i < info.BufferCount; ++i) {
+				const auto rtv = offset(rtv_base, rtv_size, i);
+				targets.push_back({create_offscreen_target(device, rtv, size), rtv});
+			}
+
+			return targets;
+		}
+
+		/*
+			Frame rates are split by what limits them: submitted frames are bounded by the CPU and by presentation,
+			completed frames by the GPU. CPU time excludes the waits in begin_frame() and the Present() call, so it
+			gives the CPU-bound rate even when vsync is the real limit.
+		*/
+		struct frame_rate_statistics {
+			std::uint64_t submitted {};
+			std::uint64_t completed {};
+			frame_clock::duration cpu_time {};
+			frame_clock::duration wait_time {};
+			frame_clock::duration present_time {};
+			frame_clock::time_point report_time {frame_clock::now()};
+			std::uint64_t trace_spans {}; // Recorded by the last report
+		};
+
+		void report_allocations()
+		{
+			std::string line {"allocations:"};
+			for (std::size_t i {}; i < allocation_tag_count; ++i) {
+				const auto tag = static_cast<allocation_tag>(i);
+				const auto totals = get_allocation_totals(tag);
+				std::format_to(
+					std::back_inserter(line), " {} {} ({} bytes)", get_name(tag), totals.count, totals.bytes);
+			}
+
+			log("{}", line);
+		}
+
+		class d3d12_renderer {
+		public:
+			d3d12_renderer(
+				HWND window,
+				bool enable_debugging,
+				const renderer_settings& settings,
+				worker_pool& workers) :
+				d3d12_renderer {
+					*winrt::capture<IDXGIFactory6>(
+						CreateDXGIFactory2, enable_debugging ? DXGI_CREATE_FACTORY_DEBUG : 0),
+					window,
+					enable_debugging,
+					settings,
+					workers}
+			{
+				// Need to execute copy commands here
+				auto& recorder = m_frame_resources.front().recorders.front();
+				const auto lods = build_rounded_lods(load_wavefront("cube.wv"), max_lod_levels, cube_rounding);
+				for (const auto& level : lods.levels) {
+					m_state.geometries.push_back(
+						load_geometry(*m_device, *recorder.list, *recorder.allocator, *m_queue, m_timeline, level));
+				}
+
+				m_lod_errors = lods.errors;
+
+				// Without culling there is nothing to pick levels for, so everything is drawn at full detail
+				const auto& finest = m_state.geometries.front();
+				m_state.draws = {{make_draw_key({}, 0.0f), finest.indices.size, m_instance_count, 0, 0, 0}};
+
+				// Never changes, so it is read straight from upload memory
+				const gsl::span<std::uint32_t> all_instances {
+					static_cast<std::uint32_t*>(map(*m_all_instances)), m_instance_count};
+
+				std::iota(all_instances.begin(), all_instances.end(), 0u);
+				unmap(*m_all_instances);
+				m_state.all_instances = {
+					m_all_instances->GetGPUVirtualAddress(),
+					gsl::narrow<UINT>(all_instances.size_bytes()),
+					gsl::narrow_cast<UINT>(sizeof(std::uint32_t))};
+			}
+
+			d3d12_renderer(d3d12_renderer&) = delete;
+			d3d12_renderer(d3d12_renderer&&) = delete;
+			d3d12_renderer& operator=(d3d12_renderer&) = delete;
+			d3d12_renderer& operator=(d3d12_renderer&&) = delete;
+
+			~d3d12_renderer() noexcept
+			{
+				GSL_SUPPRESS(f .6)
+				m_timeline.wait_idle();
+			}
+
+			// Blocks until the next frame may be recorded; input should be sampled only after this returns
+			void begin_frame()
+			{
+				const trace_scope scope {"wait for frame"};
+				const auto wait_start = frame_clock::now();
+				if (m_frame_latency_waitable) {
+					constexpr DWORD timeout {1000};
+					const auto result = WaitForSingleObjectEx(m_frame_latency_waitable.get(), timeout, true);
+					winrt::check_bool(result != WAIT_FAILED);
+					if (result == WAIT_TIMEOUT)
+						log("frame latency: the swap chain wasn't ready after {} ms", timeout);
+				}
+
+				m_timeline.wait(m_frame_tokens.at(m_frame_index));
+				if (m_gpu_cull_validator)
+					m_gpu_cull_validator->check(m_frame_index);
+
+				update_completed_frames();
+				m_transients.begin_frame(m_frame_index);
+				m_instance_uploads.clear();
+				m_visible_instances.reset();
+				m_frame_start = frame_clock::now();
+				m_frame_rate.wait_time += m_frame_start - wait_start;
+			}
+
+			/*
+				A frame is drawn in parts, so that recording can be scheduled alongside other work: prepare_frame()
+				divides the draws among the recorders, record() fills one of their command lists, and end_frame()
+				presents what submit() executed. Different ranges may be recorded concurrently.
+			*/
+
+			// Must follow set_visible_instances(), if that is called at all
+			void prepare_frame()
+			{
+				const auto index = m_frame_index;
+				Expects(m_timeline.is_complete(m_frame_tokens.at(index)));
+				m_bindings = {m_pipelines, m_state.geometries};
+				m_frame_context.emplace(frame_context {
+					m_backbuffers.at(get_target_index()),
+					m_state,
+					*m_root_signature,
+					*m_pipeline,
+					m_bindings,
+					m_timestamps,
+					index,
+					m_bundles,
+					*m_instance_buffer,
+					m_transients.buffer(),
+					m_instance_uploads,
+					m_visible_instances ? &*m_visible_instances : nullptr});
+
+				if (m_gpu_culling) {
+					m_range_count = 1;
+					return;
+				}
+
+				const auto& frame = m_frame_resources.at(index);
+				m_frame_draws = m_state.draws;
+				m_range_count = get_range_count(m_frame_draws.size(), min_draws_per_range, frame.recorders.size());
+				if (m_visible_instances) {
+					const auto visible_count = m_visible_instances->SizeInBytes / sizeof(std::uint32_t);
+					m_range_count = get_range_count(visible_count, min_instances_per_range, frame.recorders.size());
+					m_frame_draws = m_visible_draws;
+				}
+
+				m_triangle_counts = count_triangles(m_frame_draws);
+			}
+
+			// The most ranges a frame may be recorded in
+			std::size_t recorder_count() const noexcept { return m_frame_resources.front().recorders.size(); }
+
+			// Ranges past the ones this frame was divided into record nothing
+			void record(std::size_t range)
+			{
+				Expects(m_frame_context.has_value());
+				if (range >= m_range_count)
+					return;
+
+				const auto& frame = m_frame_resources.at(m_frame_index);
+				if (m_gpu_culling) {
+					record_gpu_culled(frame.recorders.front());
+					return;
+				}
+
+				const auto first = m_frame_draws.size() * range / m_range_count;
+				const auto last = m_frame_draws.size() * (range + 1) / m_range_count;
+				record_range(
+					frame.recorders.at(range),
+					*m_frame_context,
+					range,
+					m_frame_draws.subspan(first, last - first),
+					range == 0,
+					range == m_range_count - 1);
+			}
+
+			void submit()
+			{
+				const scoped_timer timer {m_statistics, frame_timer::execute};
+				const auto& frame = m_frame_resources.at(m_frame_index);
+				m_queue->ExecuteCommandLists(gsl::narrow_cast<UINT>(m_range_count), frame.lists.data());
+			}
+
+			void end_frame(frame_clock::time_point input_time)
+			{
+				const auto index = m_frame_index;
+				const auto present_start = frame_clock::now();
+				present();
+				const auto present_end = frame_clock::now();
+				m_statistics.record(frame_timer::present, present_end - present_start);
+				m_frame_tokens.at(index) = m_timeline.signal(*m_queue);
+				m_input_times.at(index) = input_time;
+				if (m_completions) {
+					m_completions->on_completion(m_timeline, m_frame_tokens.at(index), [this, input_time] {
+						const auto latency = frame_clock::now() - input_time;
+						const std::lock_guard lock {m_latency_lock};
+						m_latency.last = latency;
+						m_latency.total += latency;
+						++m_latency.count;
+					});
+				}
+				m_frame_index = (index + 1) % m_frame_resources.size();
+				m_frame_context.reset();
+
+				++m_frame_rate.submitted;
+				m_frame_rate.present_time += present_end - present_start;
+				m_frame_rate.cpu_time += (present_start - m_frame_start) + (frame_clock::now() - present_end);
+			}
+
+			auto& view() noexcept { return m_state.matrices.view; }
+
+			const view_matrices& matrices() const noexcept { return m_state.matrices; }
+
+			// From then on, instances are culled against the given bounds on the GPU and drawn indirectly; the bounds
+			// must not change. Validation reads back every frame's results and checks them against the CPU reference
+			void enable_gpu_culling(const sphere_set& bounds, bool validate)
+			{
+				Expects(bounds.size() == m_instance_count);
+				auto& recorder = m_frame_resources.front().recorders.front();
+				m_timeline.wait_idle();
+				m_gpu_culling = create_gpu_culling_resources(
+					*m_device, *recorder.list, *recorder.allocator, *m_queue, m_timeline, bounds);
+
+				if (validate)
+					m_gpu_cull_validator.emplace(
+						*m_device, bounds, gsl::narrow<unsigned int>(m_frame_resources.size()));
+			}
+
+			// Limits this frame's draws to the given instances at their levels of detail, drawn in batches of a
+			// single level sorted by state and then front to back by their first instance's position; must be called
+			// between begin_frame() and prepare_frame()
+			void set_visible_instances(
+				gsl::span<const std::uint32_t> visible,
+				gsl::span<const std::uint8_t> levels,
+				gsl::span<const DirectX::XMFLOAT3X4> world)
+			{
+				Expects(visible.size() <= m_instance_count);
+				Expects(levels.size() == m_instance_count && world.size() == m_instance_count);
+
+				// Grouped by level, keeping their order within each, as the staging memory must be written in order
+				std::array<std::size_t, max_lod_levels> level_counts {};
+				for (const auto instance : visible)
+					++level_counts.at(levels[instance]);
+
+				std::array<std::size_t, max_lod_levels> offsets {};
+				std::exclusive_scan(level_counts.begin(), level_counts.end(), offsets.begin(), std::size_t {});
+				for (const auto instance : visible)
+					m_grouped_visible[offsets[levels[instance]]++] = instance;
+
+				const auto grouped = gsl::span<const std::uint32_t> {m_grouped_visible}.first(visible.size());
+				const auto staging = m_transients.allocate<std::uint32_t>(grouped.size());
+				if (!grouped.empty())
+					std::memcpy(staging.data.data(), grouped.data(), grouped.size_bytes());
+
+				m_visible_instances = D3D12_VERTEX_BUFFER_VIEW {
+					staging.address,
+					gsl::narrow<UINT>(grouped.size_bytes()),
+					gsl::narrow_cast<UINT>(sizeof(std::uint32_t))};
+
+				sort_visible_draws(grouped, level_counts, world);
+			}
+
+			// Against the current projection and target height
+			lod_parameters get_lod_parameters(float threshold, float hysteresis) const noexcept
+			{
+				return make_lod_parameters(
+					m_state.matrices.view,
+					m_state.matrices.projection,
+					m_extent.height,
+					m_lod_errors,
+					threshold,
+					hysteresis);
+			}
+
+			// Stages the dirty ranges of the transposed object-to-world transforms for copying into the instance
+			// buffer; must be called between begin_frame() and prepare_frame()
+			void upload_instances(gsl::span<const DirectX::XMFLOAT3X4> world, gsl::span<const transform_range> dirty)
+			{
+				const trace_scope scope {"upload instances"};
+				Expects(world.size() == m_instance_count);
+				std::size_t total {};
+				for (const auto& range : dirty)
+					total += range.count;
+
+				if (total == 0)
+					return;
+
+				const auto staging = m_transients.allocate<DirectX::XMFLOAT3X4>(total);
+				std::size_t staged {};
+				for (const auto& range : dirty) {
+					for (std::size_t first {}; first < range.count; first += instances_per_upload) {
+						const auto count = std::min(instances_per_upload, range.count - first);
+						m_instance_uploads.push_back(
+							{staging.offset + staged * sizeof(DirectX::XMFLOAT3X4), range.first + first, count});
+
+						staged += count;
+					}
+				}
+
+				m_workers.run(m_instance_uploads.size(), [this, world, staging](std::size_t task) {
+					const auto& upload = m_instance_uploads[task];
+					const auto staging_index = (upload.source_offset - staging.offset) / sizeof(DirectX::XMFLOAT3X4);
+					std::memcpy(
+						&staging.data[staging_index],
+						&world[upload.first_instance],
+						upload.count * sizeof(DirectX::XMFLOAT3X4));
+				});
+			}
+
+			frame_clock::duration latency() const
+			{
+				const std::lock_guard lock {m_latency_lock};
+				return m_latency.last;
+			}
+
+			// Rolling percentiles of the CPU and GPU frame timers; safe to read from any thread
+			frame_statistics& statistics() noexcept { return m_statistics; }
+
+			// Must be called between frames; waits for the GPU to go idle, since every frame's targets are replaced
+			void resize(const extent2d& size)
+			{
+				if (size == m_extent)
+					return;
+
+				const trace_scope scope {"resize"};
+				m_timeline.wait_idle();
+				m_backbuffers.clear();
+				if (m_present_mode != present_mode::offscreen) {
+					DXGI_SWAP_CHAIN_DESC1 info {};
+					winrt::check_hresult(m_swap_chain->GetDesc1(&info));
+					winrt::check_hresult(
+						m_swap_chain->ResizeBuffers(0, size.width, size.height, DXGI_FORMAT_UNKNOWN, info.Flags));
+				}
+
+				m_backbuffers = create_render_targets(*m_device, *m_swap_chain, m_heaps.rtv_base, m_present_mode, size);
+				m_state.depth_buffer = m_depth_buffers.acquire(size);
+				m_state.matrices.projection = create_projection(size);
+				m_offscreen_index = 0;
+				m_extent = size;
+			}
+
+		private:
+			worker_pool& m_workers;
+			const winrt::com_ptr<ID3D12Device4> m_device {};
+			const winrt::com_ptr<ID3D12CommandQueue> m_queue {};
+			const descriptor_heaps m_heaps {};
+			gpu_timeline m_timeline;
+
+			const winrt::com_ptr<ID3D12RootSignature> m_root_signature {};
+			const winrt::com_ptr<ID3D12PipelineState> m_pipeline {};
+			const present_mode m_present_mode {};
+			const winrt::com_ptr<IDXGISwapChain3> m_swap_chain {};
+			const winrt::handle m_frame_latency_waitable {};
+
+			const std::vector<per_frame_resource_table> m_frame_resources {};
+			extent2d m_extent {};
+			std::vector<backbuffer_table> m_backbuffers {};
+			std::vector<fence_token> m_frame_tokens {};
+			std::vector<std::optional<frame_clock::time_point>> m_input_times {};
+			depth_buffer_pool m_depth_buffers;
+			std::size_t m_frame_index {};
+			std::size_t m_offscreen_index {};
+			mutable std::mutex m_latency_lock {};
+			latency_statistics m_latency {}; // Guarded by m_latency_lock
+			// Only when latency is reported; declared after everything its callbacks touch, so it stops first
+			std::optional<completion_thread<d3d12_fence>> m_completions {};
+			frame_rate_statistics m_frame_rate {};
+			frame_clock::time_point m_frame_start {};
+			timestamp_queries m_timestamps;
+			frame_statistics m_statistics {};
+			frame_clock::time_point m_statistics_report_time {frame_clock::now()};
+			render_state m_state {};
+			bundle_cache m_bundles;
+			transient_allocator m_transients;
+			const unsigned int m_instance_count;
+			const winrt::com_ptr<ID3D12Resource> m_instance_buffer;
+			std::vector<instance_upload> m_instance_uploads {};
+			const winrt::com_ptr<ID3D12Resource> m_all_instances;
+			std::optional<D3D12_VERTEX_BUFFER_VIEW> m_visible_instances {};
+			std::vector<draw_item> m_batches {};
+			std::vector<std::uint64_t> m_batch_keys {};
+			radix_sorter m_batch_sorter;
+			std::vector<draw_item> m_visible_draws {};
+			std::vector<std::uint32_t> m_grouped_visible;
+			std::vector<float> m_lod_errors {};
+			std::array<std::uint64_t, max_lod_levels> m_triangle_counts {}; // Of the last frame drawn on the CPU path
+			state_change_counts m_unsorted_changes {}; // Between consecutive batches of the last culled frame
+			state_change_counts m_sorted_changes {};
+			std::optional<gpu_culling_resources> m_gpu_culling {};
+			std::optional<gpu_cull_validator> m_gpu_cull_validator {};
+			const std::array<ID3D12PipelineState*, 1> m_pipelines;
+			draw_bindings m_bindings {}; // Set per frame, since geometry is only loaded after construction
+			std::optional<frame_context> m_frame_context {}; // Between prepare_frame() and end_frame()
+			gsl::span<const draw_item> m_frame_draws {};
+			std::size_t m_range_count {};
+
+			std::size_t get_target_index() const
+			{
+				if (m_present_mode == present_mode::offscreen)
+					return m_offscreen_index;
+
+				return m_swap_chain->GetCurrentBackBufferIndex();
+			}
+
+			void present()
+			{
+				switch (m_present_mode) {
+				case present_mode::vsync:
+					winrt::check_hresult(m_swap_chain->Present(1, 0));
+					break;
+
+				case present_mode::tearing:
+					winrt::check_hresult(m_swap_chain->Present(0, DXGI_PRESENT_ALLOW_TEARING));
+					break;
+
+				case present_mode::offscreen:
+					m_offscreen_index = (m_offscreen_index + 1) % m_backbuffers.size();
+					break;
+				}
+			}
+
+			void update_completed_frames()
+			{
+				const auto now = frame_clock::now();
+				for (gsl::index i {}; i < gsl::narrow_cast<gsl::index>(m_input_times.size()); ++i) {
+					auto& input_time = m_input_times.at(i);
+					if (input_time && m_timeline.is_complete(m_frame_tokens.at(i))) {
+						++m_frame_rate.completed;
+						m_timestamps.read(i, m_statistics);
+						input_time.reset();
+					}
+				}
+
+				// The reports format their lines before logging them, so all of their allocations count as logging
+				const allocation_tag_scope tag {allocation_tag::logging};
+				report_latency(now);
+				report_frame_rate(now);
+				report_statistics(now);
+			}
+
+			void report_statistics(frame_clock::time_point now)
+			{
+				if (now - m_statistics_report_time < std::chrono::seconds {1})
+					return;
+
+				using milliseconds = std::chrono::duration<double, std::milli>;
+				std::string line {"frame times p50/p95/p99 (ms):"};
+				for (std::size_t i {}; i < frame_timer_count; ++i) {
+					const auto timer = static_cast<frame_timer>(i);
+					const auto summary = m_statistics.summary(timer);
+					std::format_to(
+						std::back_inserter(line),
+						" {} {:.3f}/{:.3f}/{:.3f}",
+						get_name(timer),
+						milliseconds {summary.p50}.count(),
+						milliseconds {summary.p95}.count(),
+						milliseconds {summary.p99}.count());
+				}
+
+				log("{}", line);
+				report_state_changes();
+				report_triangles();
+				report_allocations();
+				m_statistics.rotate();
+				m_statistics_report_time = now;
+				m_timestamps.calibrate(*m_queue);
+			}
+
+			void report_triangles()
+			{
+				const auto& counts = m_triangle_counts;
+				const auto total = std::accumulate(counts.begin(), counts.end(), std::uint64_t {});
+				if (total == 0)
+					return;
+
+				std::string line {std::format("triangles submitted: {} in the last frame, by level of detail", total)};
+				for (std::size_t level {}; level < counts.size(); ++level)
+					std::format_to(std::back_inserter(line), "{}{}", level == 0 ? " " : "/", counts[level]);
+
+				log("{}", line);
+			}
+
+			void report_state_changes()
+			{
+				if (m_visible_draws.empty())
+					return;
+
+				log("draw state changes over {} draws, unsorted/sorted: pipeline {}/{}, material {}/{}, geometry {}/{}",
+					m_visible_draws.size(),
+					m_unsorted_changes.pipeline,
+					m_sorted_changes.pipeline,
+					m_unsorted_changes.material,
+					m_sorted_changes.material,
+					m_unsorted_changes.geometry,
+					m_sorted_changes.geometry);
+			}
+
+			void report_latency(frame_clock::time_point now)
+			{
+				const std::lock_guard lock {m_latency_lock};
+				const auto is_report_due = now - m_latency.report_time >= std::chrono::seconds {1};
+				if (m_latency.count != 0 && is_report_due) {
+					using milliseconds = std::chrono::duration<double, std::milli>;
+					log("latency: last {:.2f} ms, mean {:.2f} ms over {} frames",
+						milliseconds {m_latency.last}.count(),
+						milliseconds {m_latency.total / m_latency.count}.count(),
+						m_latency.count);
+
+					m_latency = {.last {m_latency.last}, .report_time {now}};
+				}
+			}
+
+			void report_frame_rate(frame_clock::time_point now)
+			{
+				const auto elapsed = now - m_frame_rate.report_time;
+				if (elapsed < std::chrono::seconds {1} || m_frame_rate.submitted == 0)
+					return;
+
+				using seconds = std::chrono::duration<double>;
+				using milliseconds = std::chrono::duration<double, std::milli>;
+				const auto frames = gsl::narrow_cast<double>(m_frame_rate.submitted);
+				const auto cpu_time = seconds {m_frame_rate.cpu_time}.count() / frames;
+				log("{}: {:.1f} fps submitted, {:.1f} fps completed, cpu {:.3f} ms ({:.1f} fps limit), "
+					"wait {:.3f} ms, present {:.3f} ms",
+					get_name(m_present_mode),
+					frames / seconds {elapsed}.count(),
+					gsl::narrow_cast<double>(m_frame_rate.completed) / seconds {elapsed}.count(),
+					cpu_time * 1000.0,
+					1.0 / cpu_time,
+					milliseconds {m_frame_rate.wait_time}.count() / frames,
+					milliseconds {m_frame_rate.present_time}.count() / frames);
+
+				// Multiplied by the cost of a span, this gives the tracing overhead per frame
+				const auto trace_spans = is_tracing() ? get_trace_span_count() : 0;
+				if (trace_spans != 0) {
+					const auto spans = gsl::narrow_cast<double>(trace_spans - m_frame_rate.trace_spans);
+					log("trace: {:.1f} spans per frame", spans / frames);
+				}
+
+				m_frame_rate = {.report_time {now}, .trace_spans {trace_spans}};
+			}
+
+			// FIXME: a horrid hack, we should only have one upload ringbuffer
+			d3d12_renderer(
+				IDXGIFactory6& factory,
+				HWND window,
+				bool enable_debugging,
+				const renderer_settings& settings,
+				worker_pool& workers) :
+				m_workers {workers},
+				m_device {create_device(factory, enable_debugging)},
+				m_queue {create_command_queue(*m_device)},
+				m_heaps {*m_device, settings.swap_chain_buffers},
+				m_timeline {*m_device},
+				m_root_signature {create_default_root_signature(*m_device)},
+				m_pipeline {create_default_pipeline_state(*m_device, *m_root_signature)},
+				m_present_mode {resolve_present_mode(factory, settings.present)},
+				m_swap_chain {attach_swap_chain(
+					factory,
+					window,
+					*m_queue,
+					settings.swap_chain_buffers,
+					get_swap_chain_flags(settings.low_latency, m_present_mode))},
+				m_frame_latency_waitable {get_frame_latency_waitable(*m_swap_chain, settings)},
+				m_frame_resources {create_frame_resources(*m_device, settings.frames_in_flight, workers.size())},
+				m_extent {get_extent(*m_swap_chain)},
+				m_backbuffers {
+					create_render_targets(*m_device, *m_swap_chain, m_heaps.rtv_base, m_present_mode, m_extent)},
+				m_frame_tokens(settings.frames_in_flight),
+				m_input_times(settings.frames_in_flight),
+				m_depth_buffers {*m_device, m_heaps.dsv_base},
+				m_timestamps {*m_device, *m_queue, settings.frames_in_flight},
+				m_state {create_render_state(m_depth_buffers, m_extent, m_heaps.dsv_base)},
+				m_bundles {*m_device, workers.size()},
+				m_transients {
+					*m_device,
+					settings.frames_in_flight,
+					get_transient_frame_capacity(settings.instance_count)},
+				m_instance_count {settings.instance_count},
+				m_instance_buffer {create_buffer(
+					*m_device,
+					m_instance_count * sizeof(DirectX::XMFLOAT3X4),
+					D3D12_RESOURCE_STATE_COMMON,
+					D3D12_RESOURCE_FLAG_NONE)},
+				m_all_instances {create_upload_buffer(*m_device, m_instance_count * sizeof(std::uint32_t))},
+				m_batch_sorter {get_batch_count(m_instance_count) + max_lod_levels},
+				m_grouped_visible(m_instance_count),
+				m_pipelines {m_pipeline.get()}
+			{
+				// Worst case, every other transform block is dirty and each range is split into several uploads
+				m_instance_uploads.reserve(m_instance_count / 1024 + m_instance_count / instances_per_upload + 2);
+				// Each level of detail may end with a partial batch
+				const auto max_batches = get_batch_count(m_instance_count) + max_lod_levels;
+				m_batches.reserve(max_batches);
+				m_batch_keys.reserve(max_batches);
+				m_visible_draws.reserve(max_batches);
+				if (settings.low_latency)
+					m_completions.emplace();
+			}
+
+			void record_gpu_culled(const command_recorder& recorder)
+			{
+				const gpu_cull_constants constants {
+					extract_frustum(DirectX::XMMatrixMultiply(m_state.matrices.view, m_state.matrices.projection)),
+					m_gpu_culling->instance_count,
+					m_state.geometries.front().indices.size};
+
+				const auto zero = m_transients.allocate<std::uint32_t>(1);
+				zero.data.front() = 0;
+				record_gpu_culled_frame(
+					recorder,
+					*m_frame_context,
+					*m_gpu_culling,
+					constants,
+					zero,
+					m_gpu_cull_validator ? &*m_gpu_cull_validator : nullptr);
+			}
+
+			// Expects the visible instances grouped by level of detail, finest first
+			void sort_visible_draws(
+				gsl::span<const std::uint32_t> visible,
+				const std::array<std::size_t, max_lod_levels>& level_counts,
+				gsl::span<const DirectX::XMFLOAT3X4> world)
+			{
+				const trace_scope scope {"sort draws"};
+				const auto& view = m_state.matrices.view;
+				m_batches.clear();
+				m_batch_keys.clear();
+				std::size_t level_first {};
+				for (std::size_t level {}; level < level_counts.size(); ++level) {
+					const auto level_last = level_first + level_counts[level];
+					for (auto first = level_first; first < level_last; first += instances_per_batch) {
+						const auto count = std::min(instances_per_batch, level_last - first);
+						const auto& transform = world[visible[first]];
+						const auto position
+							= DirectX::XMVectorSet(transform.m[0][3], transform.m[1][3], transform.m[2][3], 1.0f);
+
+						const auto depth = DirectX::XMVectorGetZ(DirectX::XMVector4Transform(position, view));
+						const auto key = make_draw_key({.geometry {gsl::narrow_cast<std::uint32_t>(level)}}, depth);
+						m_batches.push_back(
+							{key,
+							 m_state.geometries.at(level).indices.size,
+							 gsl::narrow_cast<unsigned int>(count),
+							 0,
+							 0,
+							 gsl::narrow_cast<unsigned int>(first)});
+
+						m_batch_keys.push_back(key);
+					}
+
+					level_first = level_last;
+				}
+
+				const auto sorted = m_batch_sorter.sort(m_workers, m_batch_keys);
+				m_visible_draws.clear();
+				for (const auto index : sorted.order)
+					m_visible_draws.push_back(m_batches[index]);
+
+				m_unsorted_changes = count_state_changes(m_batch_keys);
+				m_sorted_changes = count_state_changes(sorted.keys);
+			}
+		};
+
+		// Frames before this may allocate freely, while buffers and thread registrations settle
+		constexpr std::uint64_t allocation_warm_up_frames {120};
+
+		// Diagnostic output, which may allocate on any frame
+		constexpr std::array exempt_allocation_tags {allocation_tag::tracing, allocation_tag::logging};
+
+		void check_no_allocations(std::string_view step, const allocation_sink& allocations, std::uint64_t frame)
+		{
+			if (frame < allocation_warm_up_frames)
+				return;
+
+			for (std::size_t i {}; i < allocation_tag_count; ++i) {
+				const auto tag = static_cast<allocation_tag>(i);
+				const auto allocated = allocations.get(tag);
+				const auto is_exempt = std::ranges::find(exempt_allocation_tags, tag) != exempt_allocation_tags.end();
+				if (allocated.count == 0 || is_exempt)
+					continue;
+
+				log("allocations: {} allocated {} times ({} bytes) under {} on frame {}",
+					step,
+					allocated.count,
+					allocated.bytes,
+					get_name(tag),
+					frame);
+				throw std::logic_error {"the render loop allocated after warm-up"};
+			}
+		}
+
+		constexpr float grid_spacing {2.5f};
+		constexpr std::size_t instances_per_task {16384};
+
+		std::size_t get_grid_side(std::size_t instance_count) noexcept
+		{
+			std::size_t side {1};
+			while (side * side * side < instance_count)
+				++side;
+
+			return side;
+		}
+
+		// Far enough back to see every instance within extent of the origin; a single cube ends up where it always has
+		float get_camera_distance(float extent) noexcept { return 3.0f + extent * 3.0f; }
+
+		// Encloses the cube mesh, which spans [-1, 1] on every axis, however it is rotated
+		constexpr float cube_radius {1.7321f};
+
+		// Of the largest sphere the cube mesh encloses
+		constexpr float cube_inner_radius {1.0f};
+
+		// The largest box the cube mesh always encloses, whatever its rotation; a box in its inscribed sphere
+		constexpr float cube_occluder_extent {0.5773f};
+
+		// Lays the cubes out on a grid centred on the origin and returns how far it reaches along each axis; they only
+		// ever spin, so their bounds never change
+		float layout_grid(
+			transform_system& transforms,
+			sphere_set& bounds,
+			gsl::span<aabb> boxes,
+			gsl::span<aabb> occluder_boxes)
+		{
+			const auto side = get_grid_side(transforms.size());
+			const auto offset = gsl::narrow_cast<float>(side - 1) * grid_spacing * 0.5f;
+			for (std::size_t i {}; i < transforms.size(); ++i) {
+				const DirectX::XMFLOAT3 position {
+					gsl::narrow_cast<float>(i % side) * grid_spacing - offset,
+					gsl::narrow_cast<float>(i / side % side) * grid_spacing - offset,
+					gsl::narrow_cast<float>(i / (side * side)) * grid_spacing - offset};
+
+				transforms.set_position(i, position);
+				bounds.set(i, position, cube_radius);
+				boxes[i] = get_sphere_bounds({position.x, position.y, position.z}, cube_radius);
+				occluder_boxes[i] = get_sphere_bounds({position.x, position.y, position.z}, cube_occluder_extent);
+			}
+
+			return offset;
+		}
+
+		/*
+			Copies a mapped scene's transforms in and computes its bounds in a single pass across the pool, so the
+			only other cost of loading is faulting its pages in. Returns how far its instances reach from the origin
+			along any axis.
+		*/
+		float load_scene_instances(
+			worker_pool& workers,
+			const scene_view& scene,
+			transform_system& transforms,
+			sphere_set& bounds,
+			gsl::span<aabb> boxes,
+			gsl::span<aabb> occluder_boxes)
+		{
+			const trace_scope scope {"load scene"};
+			Expects(scene.size() != 0 && transforms.size() == scene.size());
+			const auto task_count = (scene.size() + instances_per_task - 1) / instances_per_task;
+			std::vector<float> extents(task_count);
+			workers.run(task_count, [&](std::size_t task) {
+				const auto first = task * instances_per_task;
+				const auto last = std::min(first + instances_per_task, scene.size());
+				// Every instance is drawn as the cube, whichever mesh the scene names for it
+				get_instance_bounds(scene, first, last, cube_radius, cube_inner_radius, bounds, boxes, occluder_boxes);
+
+				const auto x = scene.get_floats(scene_array::position_x);
+				const auto y = scene.get_floats(scene_array::position_y);
+				const auto z = scene.get_floats(scene_array::position_z);
+				const auto rotation_x = scene.get_floats(scene_array::rotation_x);
+				const auto rotation_y = scene.get_floats(scene_array::rotation_y);
+				const auto rotation_z = scene.get_floats(scene_array::rotation_z);
+				const auto rotation_w = scene.get_floats(scene_array::rotation_w);
+				const auto scale_x = scene.get_floats(scene_array::scale_x);
+				const auto scale_y = scene.get_floats(scene_array::scale_y);
+				const auto scale_z = scene.get_floats(scene_array::scale_z);
+				float extent {};
+				for (auto i = first; i < last; ++i) {
+					transforms.set_position(i, {x[i], y[i], z[i]});
+					transforms.set_rotation(i, {rotation_x[i], rotation_y[i], rotation_z[i], rotation_w[i]});
+					transforms.set_scale(i, {scale_x[i], scale_y[i], scale_z[i]});
+					extent = std::max({extent, std::abs(x[i]), std::abs(y[i]), std::abs(z[i])});
+				}
+
+				extents[task] = extent;
+			});
+
+			return *std::ranges::max_element(extents);
+		}
+
+		// Where an entity's transform and bounds live in the per-instance arrays
+		struct instance_slot {
+			std::uint32_t index;
+		};
+
+		struct spin {
+			float phase;
+		};
+
+		// Every instance gets an entity; only the cubes of the grid spin
+		void create_instance_entities(entity_world& world, std::size_t count, bool is_spinning)
+		{
+			for (std::uint32_t i {}; i < count; ++i) {
+				if (is_spinning)
+					world.create(instance_slot {i}, spin {gsl::narrow_cast<float>(i % 64) * 0.1f});
+				else
+					world.create(instance_slot {i});
+			}
+		}
+
+		void animate_transforms(worker_pool& workers, entity_world& world, transform_system& transforms, float angle)
+		{
+			world.for_each_chunk<instance_slot, spin>(workers, [&transforms, angle](const entity_chunk& chunk) {
+				const auto slots = chunk.get<instance_slot>();
+				const auto spins = chunk.get<spin>();
+				for (std::size_t i {}; i < chunk.size(); ++i) {
+					const auto turn = angle + spins[i].phase;
+					DirectX::XMFLOAT4 rotation {};
+					DirectX::XMStoreFloat4(&rotation, DirectX::XMQuaternionRotationRollPitchYaw(turn, 0.0f, turn));
+					transforms.set_rotation(slots[i].index, rotation);
+				}
+			});
+		}
+
+		// A simulation further behind than this drops the rest of its backlog instead of catching up on it, since
+		// ticks that take longer than they simulate would otherwise put it ever further behind
+		constexpr std::size_t max_ticks_per_update {8};
+
+		// How finely snapshots track which world matrices changed
+		constexpr std::size_t snapshot_block_size {1024};
+
+		// Everything the render thread takes from one simulation tick
+		struct simulation_snapshot {
+			std::uint64_t tick;
+			frame_clock::time_point time; // The moment the simulation has been brought up to
+			frame_clock::time_point input_time; // When the tick sampled its input
+			std::vector<DirectX::XMFLOAT3X4> world;
+			std::vector<std::uint64_t> block_ticks; // The tick on which each block of world last changed
+		};
+
+		/*
+			The entities and their transforms, owned by the simulation thread once it starts. Every tick advances
+			them by the same period and publishes a snapshot without waiting for the renderer; the back buffer it
+			fills last held a snapshot from at least two ticks before, so only the blocks that changed since are
+			copied into it.
+		*/
+		class simulation {
+		public:
+			simulation(std::size_t instance_count, frame_clock::duration tick_period) :
+				m_tick_period {tick_period},
+				m_transforms {instance_count},
+				m_block_ticks((instance_count + snapshot_block_size - 1) / snapshot_block_size),
+				m_snapshots {{0, {}, {}, std::vector<DirectX::XMFLOAT3X4>(instance_count), m_block_ticks}}
+			{
+			}
+
+			simulation(simulation&) = delete;
+			simulation& operator=(simulation&) = delete;
+
+			frame_clock::duration tick_period() const noexcept { return m_tick_period; }
+
+			// Only for setting up before the simulation thread starts
+			entity_world& world() noexcept { return m_world; }
+			transform_system& transforms() noexcept { return m_transforms; }
+
+			// Read by the render thread only
+			triple_buffer<simulation_snapshot>& snapshots() noexcept { return m_snapshots; }
+
+			void tick(
+				worker_pool& workers,
+				frame_statistics& statistics,
+				frame_clock::time_point time,
+				frame_clock::time_point input_time)
+			{
+				const scoped_timer timer {statistics, frame_timer::simulate};
+				{
+					// A quarter of a radian a second, whatever the tick rate
+					const scoped_timer animate_timer {statistics, frame_timer::animate};
+					const std::chrono::duration<double> elapsed {m_tick * m_tick_period};
+					animate_transforms(workers, m_world, m_transforms, gsl::narrow_cast<float>(elapsed.count() * 0.25));
+				}
+
+				gsl::span<const transform_range> dirty {};
+				{
+					const scoped_timer transform_timer {statistics, frame_timer::transform};
+					dirty = m_transforms.update(workers);
+				}
+
+				++m_tick;
+				for (const auto& range : dirty) {
+					const auto last = (range.first + range.count - 1) / snapshot_block_size;
+					for (auto block = range.first / snapshot_block_size; block <= last; ++block)
+						m_block_ticks[block] = m_tick;
+				}
+
+				publish(workers, time, input_time);
+			}
+
+		private:
+			const frame_clock::duration m_tick_period;
+			entity_world m_world {};
+			transform_system m_transforms;
+			std::vector<std::uint64_t> m_block_ticks;
+			std::uint64_t m_tick {};
+			triple_buffer<simulation_snapshot> m_snapshots;
+
+			void publish(worker_pool& workers, frame_clock::time_point time, frame_clock::time_point input_time)
+			{
+				const trace_scope scope {"publish snapshot"};
+				auto& snapshot = m_snapshots.back();
+				const auto world = m_transforms.world();
+				workers.run(m_block_ticks.size(), [this, &snapshot, world](std::size_t block) {
+					if (m_block_ticks[block] <= snapshot.tick)
+						return;
+
+					const auto first = block * snapshot_block_size;
+					const auto count = std::min(snapshot_block_size, world.size() - first);
+					std::memcpy(&snapshot.world[first], &world[first], count * sizeof(DirectX::XMFLOAT3X4));
+				});
+
+				std::ranges::copy(m_block_ticks, snapshot.block_ticks.begin());
+				snapshot.tick = m_tick;
+				snapshot.time = time;
+				snapshot.input_time = input_time;
+				m_snapshots.publish();
+			}
+		};
+
+		/*
+			Elapsed time on the high-resolution clock accumulates and is spent a whole tick at a time, so the
+			simulation advances at the same rate however long its ticks take. In between, the thread sleeps until the
+			next tick is due.
+		*/
+		void execute_simulation_thread(
+			std::stop_token stop,
+			simulation& simulated,
+			worker_pool& workers,
+			frame_statistics& statistics,
+			bool assert_no_allocations)
+		{
+			set_thread_trace_name("simulation");
+			const auto period = simulated.tick_period();
+			auto last_time = frame_clock::now();
+			frame_clock::duration accumulated {};
+			std::uint64_t tick {};
+			allocation_sink allocations {};
+			while (!stop.stop_requested()) {
+				const auto now = frame_clock::now();
+				const auto backlog = accumulated + (now - last_time);
+				accumulated = std::min<frame_clock::duration>(backlog, period * max_ticks_per_update);
+				last_time = now;
+				while (accumulated >= period) {
+					accumulated -= period;
+					allocations.reset();
+					{
+						const allocation_sink_scope sink {allocations};
+						const allocation_tag_scope tag {allocation_tag::simulation};
+						simulated.tick(workers, statistics, now - accumulated, now);
+					}
+
+					if (assert_no_allocations)
+						check_no_allocations("simulation", allocations, tick);
+
+					++tick;
+				}
+
+				std::this_thread::sleep_until(now + (period - accumulated));
+			}
+		}
+
+		// The ranges of a snapshot's world matrices that changed after the given tick, in ascending order
+		void get_changed_ranges(
+			const simulation_snapshot& snapshot,
+			std::uint64_t since,
+			std::vector<transform_range>& ranges)
+		{
+			ranges.clear();
+			for (std::size_t block {}; block < snapshot.block_ticks.size(); ++block) {
+				if (snapshot.block_ticks[block] <= since)
+					continue;
+
+				const auto first = block * snapshot_block_size;
+				const auto count = std::min(snapshot_block_size, snapshot.world.size() - first);
+				if (!ranges.empty() && ranges.back().first + ranges.back().count == first)
+					ranges.back().count += count;
+				else
+					ranges.push_back({first, count});
+			}
+		}
+
+		/*
+			Blends the latest snapshot with the one the render thread took before it, so that motion stays smooth
+			whatever the render rate. Frames show the simulation as it was a tick before they start, which usually
+			falls between the two. Matrices are blended element by element: over a single tick's rotation, that is
+			within rounding of blending the rotations themselves.
+		*/
+		class snapshot_interpolator {
+		public:
+			explicit snapshot_interpolator(const simulation_snapshot& first) :
+				m_from(first.world),
+				m_blended(first.world),
+				m_from_tick {first.tick},
+				m_from_time {first.time}
+			{
+				m_ranges.reserve(first.block_ticks.size());
+			}
+
+			// The world matrices to draw, which stay valid until the next call
+			gsl::span<const DirectX::XMFLOAT3X4> world() const noexcept { return m_blended; }
+
+			/*
+				Takes the latest snapshot if there's a new one, then blends for the given moment and returns the
+				ranges of world() that changed since the last call. Blocks that moved between the two snapshots are
+				blended again every frame; the first call returns everything.
+			*/
+			gsl::span<const transform_range> update(
+				worker_pool& workers,
+				triple_buffer<simulation_snapshot>& snapshots,
+				frame_clock::time_point time)
+			{
+				const trace_scope scope {"interpolate"};
+				const auto since = m_blended_tick;
+				if (snapshots.is_updated()) {
+					const auto& previous = snapshots.front();
+					copy_blocks(workers, previous, m_from_tick, m_from);
+					m_from_tick = previous.tick;
+					m_from_time = previous.time;
+					snapshots.acquire();
+				}
+
+				const auto& latest = snapshots.front();
+				auto weight = 1.0f;
+				if (latest.time > m_from_time) {
+					const std::chrono::duration<float> offset {time - m_from_time};
+					const std::chrono::duration<float> span {latest.time - m_from_time};
+					weight = std::clamp(offset / span, 0.0f, 1.0f);
+				}
+
+				workers.run(latest.block_ticks.size(), [this, &latest, since, weight](std::size_t block) {
+					if (latest.block_ticks[block] > since)
+						blend_block(latest, block, weight);
+				});
+
+				get_changed_ranges(latest, since, m_ranges);
+				m_blended_tick = m_from_tick;
+				return m_ranges;
+			}
+
+		private:
+			std::vector<DirectX::XMFLOAT3X4> m_from; // As of the snapshot before the latest
+			std::vector<DirectX::XMFLOAT3X4> m_blended;
+			std::uint64_t m_from_tick;
+			frame_clock::time_point m_from_time;
+			std::uint64_t m_blended_tick {}; // Blocks that changed after this may differ from m_from
+			std::vector<transform_range> m_ranges {};
+
+			static void copy_blocks(
+				worker_pool& workers,
+				const simulation_snapshot& source,
+				std::uint64_t since,
+				std::vector<DirectX::XMFLOAT3X4>& destination)
+			{
+				workers.run(source.block_ticks.size(), [&source, since, &destination](std::size_t block) {
+					if (source.block_ticks[block] <= since)
+						return;
+
+					const auto first = block * snapshot_block_size;
+					const auto count = std::min(snapshot_block_size, source.world.size() - first);
+					std::memcpy(&destination[first], &source.world[first], count * sizeof(DirectX::XMFLOAT3X4));
+				});
+			}
+
+			void blend_block(const simulation_snapshot& latest, std::size_t block, float weight) noexcept
+			{
+				const auto first = block * snapshot_block_size;
+				const auto last = std::min(first + snapshot_block_size, latest.world.size());
+				for (auto i = first; i < last; ++i) {
+					for (std::size_t row {}; row < 3; ++row) {
+						const auto from
+							= DirectX::XMLoadFloat4(reinterpret_cast<const DirectX::XMFLOAT4*>(m_from[i].m[row]));
+
+						const auto to
+							= DirectX::XMLoadFloat4(reinterpret_cast<const DirectX::XMFLOAT4*>(latest.world[i].m[row]));
+
+						DirectX::XMStoreFloat4(
+							reinterpret_cast<DirectX::XMFLOAT4*>(m_blended[i].m[row]),
+							DirectX::XMVectorLerp(from, to, weight));
+					}
+				}
+			}
+		};
+
+		void validate_culling(
+			const frustum& view_frustum,
+			const sphere_set& bounds,
+			gsl::span<const std::uint32_t> visible,
+			gsl::span<std::uint32_t> reference)
+		{
+			const auto count = cull_spheres_reference(view_frustum, bounds, 0, bounds.size(), reference);
+			const auto expected = reference.first(count);
+			if (!std::equal(visible.begin(), visible.end(), expected.begin(), expected.end())) {
+				log("culling: {} visible, but the scalar reference found {}", visible.size(), count);
+				throw std::logic_error {"vectorized culling disagrees with the scalar reference"};
+			}
+		}
+
+		// The hierarchy reports objects in tree order, so they are sorted before comparing
+		void validate_hierarchy_culling(
+			const frustum& view_frustum,
+			const bvh& hierarchy,
+			gsl::span<const std::uint32_t> visible,
+			std::vector<std::uint32_t>& sorted,
+			gsl::span<std::uint32_t> reference)
+		{
+			const auto count = hierarchy.cull_reference(view_frustum, reference);
+			sorted.assign(visible.begin(), visible.end());
+			std::ranges::sort(sorted);
+			if (!std::ranges::equal(sorted, reference.first(count))) {
+				log("culling: {} visible, but testing every box found {}", visible.size(), count);
+				throw std::logic_error {"hierarchy culling disagrees with testing every box"};
+			}
+		}
+
+		// Levels depend on the ones they replace, so the reference starts from a copy taken before selecting
+		void validate_lods(
+			const lod_parameters& lods,
+			const sphere_set& bounds,
+			gsl::span<const std::uint32_t> visible,
+			gsl::span<const std::uint8_t> levels,
+			gsl::span<std::uint8_t> reference)
+		{
+			select_lods_reference(lods, bounds, visible, reference);
+			if (!std::ranges::equal(levels, reference)) {
+				const auto mismatch = std::ranges::mismatch(levels, reference).in1 - levels.begin();
+				log("lods: instance {} got level {}, but the scalar reference picked {}",
+					mismatch,
+					levels[mismatch],
+					reference[mismatch]);
+
+				throw std::logic_error {"vectorized level selection disagrees with the scalar reference"};
+			}
+		}
+
+		void execute_game_thread(window_state& state, HWND window, bool enable_debugging, renderer_settings settings)
+		{
+			set_thread_trace_name("game");
+			std::optional<scene_file> scene {};
+			if (!settings.scene.empty()) {
+				scene.emplace(std::filesystem::path {settings.scene});
+				if (scene->view().size() == 0)
+					throw std::runtime_error {"the scene has no instances"};
+
+				settings.instance_count = gsl::narrow<unsigned int>(scene->view().size());
+				log("scene: {} instances of {} meshes", scene->view().size(), scene->view().mesh_count());
+			}
+
+			worker_pool workers {settings.worker_threads == 0 ? get_default_worker_count() : settings.worker_threads};
+			d3d12_renderer renderer {window, enable_debugging, settings, workers};
+			const auto tick_period = std::chrono::duration_cast<frame_clock::duration>(
+				std::chrono::duration<double> {1.0 / settings.tick_rate});
+
+			simulation simulated {settings.instance_count, tick_period};
+			sphere_set bounds {settings.instance_count};
+			std::vector<aabb> boxes(settings.instance_count);
+			std::vector<aabb> occluder_boxes(settings.instance_count);
+			const auto extent = scene
+				? load_scene_instances(workers, scene->view(), simulated.transforms(), bounds, boxes, occluder_boxes)
+				: layout_grid(simulated.transforms(), bounds, boxes, occluder_boxes);
+
+			renderer.view() = DirectX::XMMatrixTranslation(0.0f, 0.0f, get_camera_distance(extent));
+			create_instance_entities(simulated.world(), settings.instance_count, !scene);
+			frustum_culler culler {settings.instance_count};
+			std::vector<std::uint32_t> reference_visible(settings.validate_culling ? settings.instance_count : 0);
+			bvh hierarchy {};
+			std::vector<std::uint32_t> hierarchy_visible {};
+			std::vector<std::uint32_t> sorted_visible {};
+			const std::array every_instance {transform_range {0, settings.instance_count}};
+			if (settings.culling == culling_mode::hierarchy) {
+				hierarchy.build(workers, boxes);
+				hierarchy_visible.resize(settings.instance_count);
+				if (settings.validate_culling)
+					sorted_visible.reserve(settings.instance_count);
+			}
+
+			occlusion_culler occlusion {settings.occlusion_culling ? settings.instance_count : 0};
+			std::vector<std::uint8_t> levels(settings.instance_count);
+			std::vector<std::uint8_t> reference_levels(settings.validate_culling ? settings.instance_count : 0);
+			const auto lod_threshold = gsl::narrow_cast<float>(settings.lod_threshold);
+			const auto lod_hysteresis = gsl::narrow_cast<float>(settings.lod_hysteresis) / 100.0f;
+			if (settings.culling == culling_mode::gpu)
+				renderer.enable_gpu_culling(bounds, settings.validate_culling);
+
+			// The first snapshot is published before the render loop starts, so there is always one to draw
+			const auto start_time = frame_clock::now();
+			simulated.tick(workers, renderer.statistics(), start_time, start_time);
+			auto& snapshots = simulated.snapshots();
+			snapshots.acquire();
+			snapshot_interpolator interpolator {snapshots.front()};
+			const std::jthread simulation_thread {
+				execute_simulation_thread,
+				std::ref(simulated),
+				std::ref(workers),
+				std::ref(renderer.statistics()),
+				settings.assert_no_allocations};
+
+			// Values the frame graph's tasks hand on to one another, or take from the loop
+			frame_clock::time_point blend_time {};
+			gsl::span<const std::uint32_t> visible {};
+			const auto is_culled_on_cpu
+				= settings.culling == culling_mode::flat || settings.culling == culling_mode::hierarchy;
+
+			/*
+				Culling only reads the bounds, which never change, so it runs alongside blending and uploading the
+				latest snapshots; both feed the draws, which are recorded in ranges that run side by side. The
+				simulation ticks on its own thread throughout.
+			*/
+			task_graph graph {workers};
+			const auto interpolate = graph.add("interpolate", {}, [&] {
+				const auto changed = interpolator.update(workers, snapshots, blend_time);
+				renderer.upload_instances(interpolator.world(), changed);
+			});
+
+			const auto cull = graph.add("cull", {}, [&] {
+				if (!is_culled_on_cpu)
+					return;
+
+				const scoped_timer cull_timer {renderer.statistics(), frame_timer::cull};
+				const auto& matrices = renderer.matrices();
+				const auto view_projection = DirectX::XMMatrixMultiply(matrices.view, matrices.projection);
+				const auto view_frustum = extract_frustum(view_projection);
+				const auto lods = renderer.get_lod_parameters(lod_threshold, lod_hysteresis);
+				if (settings.validate_culling)
+					std::ranges::copy(levels, reference_levels.begin());
+
+				if (settings.culling == culling_mode::flat) {
+					visible = culler.cull(workers, view_frustum, bounds, lods, levels);
+					if (settings.validate_culling)
+						validate_culling(view_frustum, bounds, visible, reference_visible);
+				} else {
+					// Nothing moves the bounds yet, so validating refits them all to exercise refits and rebuilds
+					if (settings.validate_culling)
+						hierarchy.update(workers, boxes, every_instance);
+
+					const auto count = hierarchy.cull(view_frustum, hierarchy_visible);
+					visible = gsl::span<const std::uint32_t> {hierarchy_visible}.first(count);
+					if (settings.validate_culling)
+						validate_hierarchy_culling(view_frustum, hierarchy, visible, sorted_visible, reference_visible);
+
+					select_lods(workers, lods, bounds, visible, levels);
+				}
+
+				if (settings.validate_culling)
+					validate_lods(lods, bounds, visible, levels, reference_levels);
+
+				if (settings.occlusion_culling) {
+					const auto occluders = occlusion.select_occluders(workers, matrices.view, bounds, visible);
+					occlusion.render_occluders(workers, view_projection, occluder_boxes, occluders);
+					visible = occlusion.cull(workers, boxes, visible);
+				}
+			});
+
+			const auto prepare = graph.add("prepare draws", {interpolate, cull}, [&] {
+				if (is_culled_on_cpu)
+					renderer.set_visible_instances(visible, levels, interpolator.world());
+
+				renderer.prepare_frame();
+			});
+
+			std::vector<task_id> records {};
+			for (std::size_t range {}; range < renderer.recorder_count(); ++range) {
+				records.push_back(graph.add(std::format("record {}", range), {prepare}, [&renderer, range] {
+					renderer.record(range);
+				}));
+			}
+
+			const auto submit = graph.add("submit", records, [&renderer] { renderer.submit(); });
+			graph.add("present", {submit}, [&renderer, &snapshots] {
+				renderer.end_frame(snapshots.front().input_time);
+			});
+
+			winrt::check_bool(PostMessage(window, ready_message, 0, 0));
+			std::uint64_t frame {};
+			unsigned int trace_count {};
+			std::size_t dropped_events {};
+			allocation_sink allocations {};
+			while (!state.is_exit_required) {
+				// The whole iteration is checked, begin_frame() and the jobs the graph fans out included
+				allocations.reset();
+				const allocation_sink_scope sink {allocations};
+				const allocation_tag_scope tag {allocation_tag::renderer};
+
+				const auto size = state.pending_size.exchange({});
+				const auto is_resized = size.width != 0 && size.height != 0;
+				if (is_resized)
+					renderer.resize(size);
+
+				renderer.begin_frame();
+
+				// Drained once the frame may start, so input delay counts the wait for it; input has no effect yet
+				auto is_trace_requested = false;
+				const auto drain_time = frame_clock::now();
+				window_event event {};
+				while (state.events.try_pop(event)) {
+					renderer.statistics().record(frame_timer::input_delay, drain_time - event.time);
+					if (event.type == window_event_type::key_down && event.key == VK_F8)
+						is_trace_requested = true;
+				}
+
+				if (const auto dropped = state.events.dropped(); dropped != dropped_events) {
+					log("window: dropped {} events", dropped - dropped_events);
+					dropped_events = dropped;
+				}
+
+				if (is_trace_requested && is_tracing()) {
+					const allocation_tag_scope tracing {allocation_tag::tracing};
+					const auto path = std::format("cube-{}.trace.json", trace_count++);
+					write_chrome_trace(path);
+					log("trace: wrote {}", path);
+				}
+
+				// Blends the latest snapshots once the frame may start, so they are as fresh as possible when drawn
+				blend_time = frame_clock::now() - tick_period;
+				const auto report = graph.run();
+				auto& statistics = renderer.statistics();
+				statistics.record(frame_timer::record, graph.get_span(records));
+				statistics.record(frame_timer::frame_graph, report.elapsed);
+				statistics.record(frame_timer::critical_path, report.critical_path);
+
+				// Resizing recreates the swap chain's buffers, so a frame that resizes isn't checked
+				if (settings.assert_no_allocations && !is_resized)
+					check_no_allocations("render", allocations, frame);
+
+				++frame;
+			}
+		}
+	}
+}
+
+/*
+	I can identify four main complaints I have:
+	- d3d12_renderer is a *thicc* class
+	- record_commands is an oversized / over-specialized function
+	- there's a lot of duplicated code surrounding buffer creation
+	- upload buffer management is ad-hoc or non-existent
+	- Note that a lot of these resources can be easily grouped by usage
+	- Don't forget to never over-generalize
+*/
+
+int WinMain(HINSTANCE self, HINSTANCE, char* command_line, int)
+{
+	using namespace cube;
+
+	const auto settings = parse_settings(command_line);
+	if (!settings.cook_scene.empty()) {
+		const std::filesystem::path description {settings.cook_scene};
+		auto output = description;
+		output.replace_extension(".scene");
+		convert_scene(description, output);
+		log("scene: wrote {}", output.string());
+		return 0;
+	}
+
+	enable_tracing(settings.trace);
+
+	WNDCLASS window_class {};
+	window_class.hInstance = self;
+	window_class.lpszClassName = L"cube::window";
 	window_class.hCursor = winrt::check_pointer(LoadCursor(nullptr, IDC_ARROW));
 	window_class.lpfnWndProc = handle_message;
 	winrt::check_bool(RegisterClass(&window_class));
@@ -545,9 +2905,12 @@ int WinMain(HINSTANCE self, HINSTANCE, char*, int)
 		self,
 		nullptr));
 
-	std::atomic_bool is_exit_required {};
-	std::thread game_thread {
-		[&is_exit_required, window] { execute_game_thread(is_exit_required, window, IsDebuggerPresent()); }};
+	window_state state {};
+	SetWindowLongPtr(window, GWLP_USERDATA, reinterpret_cast<LONG_PTR>(&state));
+
+	std::thread game_thread {[&state, window, &settings] {
+		execute_game_thread(state, window, IsDebuggerPresent(), settings);
+	}};
 
 	MSG message {};
 	while (GetMessage(&message, nullptr, 0, 0)) {
@@ -555,7 +2918,7 @@ int WinMain(HINSTANCE self, HINSTANCE, char*, int)
 		DispatchMessage(&message);
 	}
 
-	is_exit_required = true;
+	state.is_exit_required = true;
 	game_thread.join();
 
 	return 0;
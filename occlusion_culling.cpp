@@ -0,0 +1,417 @@
+#include "occlusion_culling.h"
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <utility>
+#include <vector>
+
+#include <gsl/gsl>
+
+#include <DirectXMath.h>
+
+#include <immintrin.h>
+
+#include "bvh.h"
+#include "frustum_culling.h"
+#include "trace.h"
+#include "worker_pool.h"
+
+namespace cube {
+	namespace {
+		constexpr std::size_t occluders_per_task {64};
+		constexpr std::size_t triangles_per_box {12};
+
+		// Corner i takes the max of the box on x, y and z when bits 0, 1 and 2 of i are set
+		constexpr std::array<std::array<std::size_t, 3>, triangles_per_box> box_triangles {{
+			{0, 2, 6},
+			{0, 6, 4},
+			{1, 3, 7},
+			{1, 7, 5},
+			{0, 1, 5},
+			{0, 5, 4},
+			{2, 3, 7},
+			{2, 7, 6},
+			{0, 1, 3},
+			{0, 3, 2},
+			{4, 5, 7},
+			{4, 7, 6},
+		}};
+
+		// Screen position in pixels, with y pointing down, and depth
+		struct screen_vertex {
+			float x;
+			float y;
+			float z;
+		};
+
+		// Projects the box's corners, unless part of it is behind the near plane
+		std::optional<std::array<screen_vertex, 8>>
+		project_box(const DirectX::XMFLOAT4X4& view_projection, const aabb& box) noexcept
+		{
+			const auto& m = view_projection.m;
+			std::array<screen_vertex, 8> corners {};
+			for (std::size_t i {}; i < corners.size(); ++i) {
+				const auto x = (i & 1) != 0 ? box.max[0] : box.min[0];
+				const auto y = (i & 2) != 0 ? box.max[1] : box.min[1];
+				const auto z = (i & 4) != 0 ? box.max[2] : box.min[2];
+				const auto clip_x = x * m[0][0] + y * m[1][0] + z * m[2][0] + m[3][0];
+				const auto clip_y = x * m[0][1] + y * m[1][1] + z * m[2][1] + m[3][1];
+				const auto clip_z = x * m[0][2] + y * m[1][2] + z * m[2][2] + m[3][2];
+				const auto clip_w = x * m[0][3] + y * m[1][3] + z * m[2][3] + m[3][3];
+				if (clip_w <= 0.0f || clip_z < 0.0f)
+					return {};
+
+				corners[i] = {
+					(clip_x / clip_w * 0.5f + 0.5f) * occlusion_culler::width,
+					(0.5f - clip_y / clip_w * 0.5f) * occlusion_culler::height,
+					clip_z / clip_w};
+			}
+
+			return corners;
+		}
+
+		// The first and last pixel whose centers may fall in [min, max], clamped to the screen
+		std::pair<int, int> get_pixel_span(float min, float max, std::size_t size) noexcept
+		{
+			const auto limit = gsl::narrow_cast<float>(size);
+			return {
+				gsl::narrow_cast<int>(std::ceil(std::clamp(min - 0.5f, 0.0f, limit))),
+				gsl::narrow_cast<int>(std::floor(std::clamp(max - 0.5f, -1.0f, limit - 1.0f)))};
+		}
+
+		std::size_t get_tiled_index(std::size_t x, std::size_t y, std::size_t tiles_x) noexcept
+		{
+			constexpr auto tile_width = occlusion_culler::tile_width;
+			constexpr auto tile_height = occlusion_culler::tile_height;
+			return ((y / tile_height) * tiles_x + x / tile_width) * tile_width * tile_height
+				+ (y % tile_height) * tile_width + x % tile_width;
+		}
+	}
+}
+
+cube::occlusion_culler::occlusion_culler(std::size_t capacity) :
+	m_depth(width * height, 1.0f),
+	m_pyramid {},
+	m_levels {},
+	m_triangles(max_occluders * triangles_per_box),
+	m_occluder_keys(capacity),
+	m_chunk_counts((capacity + chunk_size - 1) / chunk_size),
+	m_occluders(max_occluders),
+	m_visible(capacity)
+{
+	static_assert(width % tile_width == 0 && height % tile_height == 0 && tile_width % 4 == 0);
+	std::size_t level_width {tiles_x};
+	std::size_t level_height {tiles_y};
+	std::size_t offset {};
+	while (true) {
+		m_levels.push_back({offset, level_width, level_height});
+		offset += level_width * level_height;
+		if (level_width == 1 && level_height == 1)
+			break;
+
+		level_width = (level_width + 1) / 2;
+		level_height = (level_height + 1) / 2;
+	}
+
+	m_pyramid.resize(offset, 1.0f);
+}
+
+gsl::span<const std::uint32_t> cube::occlusion_culler::select_occluders(
+	worker_pool& workers,
+	DirectX::FXMMATRIX view,
+	const sphere_set& bounds,
+	gsl::span<const std::uint32_t> candidates)
+{
+	const trace_scope scope {"select occluders"};
+	Expects(candidates.size() <= m_occluder_keys.size());
+	DirectX::XMFLOAT4X4 matrix {};
+	DirectX::XMStoreFloat4x4(&matrix, view);
+
+	// Each chunk keeps its own best, then the best of those are picked; ties go to the lower index either way
+	const auto chunk_count = (candidates.size() + chunk_size - 1) / chunk_size;
+	workers.run(chunk_count, [this, &matrix, &bounds, candidates](std::size_t chunk) {
+		const auto& m = matrix.m;
+		const auto first = chunk * chunk_size;
+		const auto last = std::min(first + chunk_size, candidates.size());
+		for (auto i = first; i < last; ++i) {
+			const auto index = candidates[i];
+			const auto depth = bounds.x()[index] * m[0][2] + bounds.y()[index] * m[1][2]
+				+ bounds.z()[index] * m[2][2] + m[3][2];
+
+			const auto radius = bounds.radius()[index];
+			m_occluder_keys[i] = {depth > radius ? -radius / depth : 0.0f, index};
+		}
+
+		const auto keys = m_occluder_keys.begin() + gsl::narrow_cast<std::ptrdiff_t>(first);
+		const auto kept = std::min(max_occluders, last - first);
+		std::nth_element(keys, keys + gsl::narrow_cast<std::ptrdiff_t>(kept), keys + (last - first));
+		m_chunk_counts[chunk] = kept;
+	});
+
+	std::size_t count {};
+	for (std::size_t chunk {}; chunk < chunk_count; ++chunk) {
+		const auto source = m_occluder_keys.begin() + gsl::narrow_cast<std::ptrdiff_t>(chunk * chunk_size);
+		const auto kept = gsl::narrow_cast<std::ptrdiff_t>(m_chunk_counts[chunk]);
+		std::copy(source, source + kept, m_occluder_keys.begin() + gsl::narrow_cast<std::ptrdiff_t>(count));
+		count += m_chunk_counts[chunk];
+	}
+
+	const auto keys = m_occluder_keys.begin();
+	const auto selected = std::min(max_occluders, count);
+	const auto last_selected = keys + gsl::narrow_cast<std::ptrdiff_t>(selected);
+	std::nth_element(keys, last_selected, keys + gsl::narrow_cast<std::ptrdiff_t>(count));
+	std::sort(keys, last_selected);
+
+	// Candidates reaching behind the camera can't be rendered as occluders, so they are dropped here
+	count = 0;
+	for (std::size_t i {}; i < selected && m_occluder_keys[i].first < 0.0f; ++i)
+		m_occluders[count++] = m_occluder_keys[i].second;
+
+	return {m_occluders.data(), count};
+}
+
+void cube::occlusion_culler::render_occluders(
+	worker_pool& workers,
+	DirectX::FXMMATRIX view_projection,
+	gsl::span<const aabb> occluder_bounds,
+	gsl::span<const std::uint32_t> occluders)
+{
+	const trace_scope scope {"render occluders"};
+	Expects(occluders.size() <= max_occluders);
+	DirectX::XMStoreFloat4x4(&m_view_projection, view_projection);
+	m_triangle_count = occluders.size() * triangles_per_box;
+	const auto task_count = (occluders.size() + occluders_per_task - 1) / occluders_per_task;
+	workers.run(task_count, [this, occluder_bounds, occluders](std::size_t task) {
+		const auto first = task * occluders_per_task;
+		const auto last = std::min(first + occluders_per_task, occluders.size());
+		for (auto i = first; i < last; ++i)
+			set_up_triangles(i, occluder_bounds[occluders[i]]);
+	});
+
+	workers.run(tiles_y, [this](std::size_t row) { rasterize_tile_row(row); });
+	build_pyramid();
+}
+
+bool cube::occlusion_culler::is_occluded(const aabb& box) const noexcept
+{
+	const auto corners = project_box(m_view_projection, box);
+	if (!corners)
+		return false;
+
+	auto min_x = corners->front().x;
+	auto max_x = min_x;
+	auto min_y = corners->front().y;
+	auto max_y = min_y;
+	auto min_z = corners->front().z;
+	for (const auto& corner : *corners) {
+		min_x = std::min(min_x, corner.x);
+		max_x = std::max(max_x, corner.x);
+		min_y = std::min(min_y, corner.y);
+		max_y = std::max(max_y, corner.y);
+		min_z = std::min(min_z, corner.z);
+	}
+
+	// Every pixel the box touches, not just those whose centers it covers
+	if (max_x < 0.0f || max_y < 0.0f || min_x >= width || min_y >= height)
+		return false;
+
+	const auto get_pixel = [](float position, std::size_t size) {
+		return gsl::narrow_cast<std::size_t>(std::clamp(position, 0.0f, gsl::narrow_cast<float>(size - 1)));
+	};
+
+	auto first_column = get_pixel(min_x, width) / tile_width;
+	auto last_column = get_pixel(max_x, width) / tile_width;
+	auto first_row = get_pixel(min_y, height) / tile_height;
+	auto last_row = get_pixel(max_y, height) / tile_height;
+	std::size_t level {};
+	while (last_column - first_column > 1 || last_row - first_row > 1) {
+		first_column /= 2;
+		last_column /= 2;
+		first_row /= 2;
+		last_row /= 2;
+		++level;
+	}
+
+	const auto& [offset, level_width, level_height] = m_levels[level];
+	for (auto row = first_row; row <= last_row; ++row) {
+		for (auto column = first_column; column <= last_column; ++column) {
+			if (m_pyramid[offset + row * level_width + column] >= min_z)
+				return false;
+		}
+	}
+
+	return true;
+}
+
+gsl::span<const std::uint32_t> cube::occlusion_culler::cull(
+	worker_pool& workers,
+	gsl::span<const aabb> bounds,
+	gsl::span<const std::uint32_t> candidates)
+{
+	const trace_scope scope {"occlusion cull"};
+	Expects(candidates.size() <= m_visible.size());
+	const auto chunk_count = (candidates.size() + chunk_size - 1) / chunk_size;
+	workers.run(chunk_count, [this, bounds, candidates](std::size_t chunk) {
+		const auto first = chunk * chunk_size;
+		const auto last = std::min(first + chunk_size, candidates.size());
+		auto count = first;
+		for (auto i = first; i < last; ++i) {
+			if (!is_occluded(bounds[candidates[i]]))
+				m_visible[count++] = candidates[i];
+		}
+
+		m_chunk_counts[chunk] = count - first;
+	});
+
+	std::size_t count {};
+	for (std::size_t chunk {}; chunk < chunk_count; ++chunk) {
+		const auto source = m_visible.begin() + gsl::narrow_cast<std::ptrdiff_t>(chunk * chunk_size);
+		const auto chunk_visible = gsl::narrow_cast<std::ptrdiff_t>(m_chunk_counts[chunk]);
+		std::copy(source, source + chunk_visible, m_visible.begin() + gsl::narrow_cast<std::ptrdiff_t>(count));
+		count += m_chunk_counts[chunk];
+	}
+
+	return {m_visible.data(), count};
+}
+
+float cube::occlusion_culler::get_depth(std::size_t x, std::size_t y) const noexcept
+{
+	Expects(x < width && y < height);
+	return m_depth[get_tiled_index(x, y, tiles_x)];
+}
+
+void cube::occlusion_culler::set_up_triangles(std::size_t occluder, const aabb& box) noexcept
+{
+	const auto triangles = gsl::span {m_triangles}.subspan(occluder * triangles_per_box, triangles_per_box);
+	const auto corners = project_box(m_view_projection, box);
+	for (std::size_t i {}; i < triangles_per_box; ++i) {
+		auto& setup = triangles[i];
+		setup.min_x = 0;
+		setup.max_x = -1;
+		if (!corners)
+			continue;
+
+		auto v0 = (*corners)[box_triangles[i][0]];
+		auto v1 = (*corners)[box_triangles[i][1]];
+		auto v2 = (*corners)[box_triangles[i][2]];
+		auto area = (v1.x - v0.x) * (v2.y - v0.y) - (v2.x - v0.x) * (v1.y - v0.y);
+		if (area == 0.0f)
+			continue;
+
+		// Either winding will do, as both sides of a box are drawn
+		if (area < 0.0f) {
+			std::swap(v1, v2);
+			area = -area;
+		}
+
+		const std::array vertices {v0, v1, v2};
+		for (std::size_t edge {}; edge < 3; ++edge) {
+			const auto& from = vertices[edge];
+			const auto& to = vertices[(edge + 1) % 3];
+			const auto a = from.y - to.y;
+			const auto b = to.x - from.x;
+			setup.edges[edge] = {a, b, -(a * from.x + b * from.y)};
+		}
+
+		const auto depth_x = ((v1.z - v0.z) * (v2.y - v0.y) - (v2.z - v0.z) * (v1.y - v0.y)) / area;
+		const auto depth_y = ((v2.z - v0.z) * (v1.x - v0.x) - (v1.z - v0.z) * (v2.x - v0.x)) / area;
+		setup.depth = {depth_x, depth_y, v0.z - depth_x * v0.x - depth_y * v0.y};
+
+		const auto [min_x, max_x] = get_pixel_span(
+			std::min({v0.x, v1.x, v2.x}), std::max({v0.x, v1.x, v2.x}), width);
+
+		const auto [min_y, max_y] = get_pixel_span(
+			std::min({v0.y, v1.y, v2.y}), std::max({v0.y, v1.y, v2.y}), height);
+
+		setup.min_x = min_x;
+		setup.max_x = max_x;
+		setup.min_y = min_y;
+		setup.max_y = max_y;
+	}
+}
+
+// Clears, draws and reduces one row of tiles, four pixels at a time; no other task touches its pixels
+void cube::occlusion_culler::rasterize_tile_row(std::size_t row) noexcept
+{
+	constexpr auto tile_size = tile_width * tile_height;
+	const auto pixels = gsl::span {m_depth}.subspan(row * tiles_x * tile_size, tiles_x * tile_size);
+	std::fill(pixels.begin(), pixels.end(), 1.0f);
+
+	const auto first_y = gsl::narrow_cast<int>(row * tile_height);
+	const auto last_y = first_y + gsl::narrow_cast<int>(tile_height) - 1;
+	const auto lane_offsets = _mm_setr_ps(0.5f, 1.5f, 2.5f, 3.5f);
+	const auto zero = _mm_setzero_ps();
+	const auto one = _mm_set1_ps(1.0f);
+	for (const auto& setup : gsl::span {m_triangles}.first(m_triangle_count)) {
+		if (setup.min_x > setup.max_x || setup.max_y < first_y || setup.min_y > last_y)
+			continue;
+
+		const auto& edges = setup.edges;
+		const std::array edge_x {_mm_set1_ps(edges[0][0]), _mm_set1_ps(edges[1][0]), _mm_set1_ps(edges[2][0])};
+		const auto depth_x = _mm_set1_ps(setup.depth[0]);
+		for (auto y = std::max(setup.min_y, first_y); y <= std::min(setup.max_y, last_y); ++y) {
+			const auto center_y = gsl::narrow_cast<float>(y) + 0.5f;
+			const std::array edge_row {
+				_mm_set1_ps(edges[0][1] * center_y + edges[0][2]),
+				_mm_set1_ps(edges[1][1] * center_y + edges[1][2]),
+				_mm_set1_ps(edges[2][1] * center_y + edges[2][2])};
+
+			const auto depth_row = _mm_set1_ps(setup.depth[1] * center_y + setup.depth[2]);
+			const auto pixel_y = gsl::narrow_cast<std::size_t>(y - first_y);
+			for (auto x = setup.min_x & ~3; x <= setup.max_x; x += 4) {
+				const auto center_x = _mm_add_ps(_mm_set1_ps(gsl::narrow_cast<float>(x)), lane_offsets);
+				auto inside = _mm_castsi128_ps(_mm_set1_epi32(-1));
+				for (std::size_t edge {}; edge < 3; ++edge) {
+					const auto distance = _mm_add_ps(_mm_mul_ps(edge_x[edge], center_x), edge_row[edge]);
+					inside = _mm_and_ps(inside, _mm_cmpge_ps(distance, zero));
+				}
+
+				if (_mm_movemask_ps(inside) == 0)
+					continue;
+
+				const auto plane = _mm_add_ps(_mm_mul_ps(depth_x, center_x), depth_row);
+				const auto depth = _mm_min_ps(_mm_max_ps(plane, zero), one);
+				const auto pixel_x = gsl::narrow_cast<std::size_t>(x);
+				auto* const target = &pixels[get_tiled_index(pixel_x, pixel_y, tiles_x)];
+				const auto current = _mm_loadu_ps(target);
+				const auto nearest = _mm_min_ps(current, depth);
+				_mm_storeu_ps(target, _mm_or_ps(_mm_and_ps(inside, nearest), _mm_andnot_ps(inside, current)));
+			}
+		}
+	}
+
+	for (std::size_t column {}; column < tiles_x; ++column) {
+		const auto tile = pixels.subspan(column * tile_size, tile_size);
+		m_pyramid[row * tiles_x + column] = *std::max_element(tile.begin(), tile.end());
+	}
+}
+
+// Each texel holds the farthest depth of the up to four below it
+void cube::occlusion_culler::build_pyramid() noexcept
+{
+	for (std::size_t level {1}; level < m_levels.size(); ++level) {
+		const auto& below = m_levels[level - 1];
+		const auto& current = m_levels[level];
+		for (std::size_t row {}; row < current.height; ++row) {
+			for (std::size_t column {}; column < current.width; ++column) {
+				const auto first_column = column * 2;
+				const auto last_column = std::min(first_column + 1, below.width - 1);
+				const auto first_row = row * 2;
+				const auto last_row = std::min(first_row + 1, below.height - 1);
+				const auto texel = [this, &below](std::size_t y, std::size_t x) {
+					return m_pyramid[below.offset + y * below.width + x];
+				};
+
+				m_pyramid[current.offset + row * current.width + column] = std::max(
+					{texel(first_row, first_column),
+					 texel(first_row, last_column),
+					 texel(last_row, first_column),
+					 texel(last_row, last_column)});
+			}
+		}
+	}
+}
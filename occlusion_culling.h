@@ -0,0 +1,100 @@
+#ifndef HELIUM_OCCLUSION_CULLING_H
+#define HELIUM_OCCLUSION_CULLING_H
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+#include <gsl/gsl>
+
+#include <DirectXMath.h>
+
+#include "bvh.h"
+#include "frustum_culling.h"
+#include "worker_pool.h"
+
+namespace cube {
+	/*
+		Culls objects hidden behind a few large occluders, entirely on the CPU. Occluder boxes are rasterized into a
+		small depth buffer split into 8x4 tiles, one row of tiles per task, and each tile's farthest depth feeds a
+		max-depth pyramid. Occludee boxes are then tested against the pyramid level where they cover at most 2x2
+		texels. Every pixel is written by a single task and every test only reads, so the results do not depend on
+		how the work was scheduled.
+
+		Occluders must lie inside the geometry they stand for, or objects peeking past its edges get culled.
+	*/
+	class occlusion_culler {
+	public:
+		static constexpr std::size_t width {256};
+		static constexpr std::size_t height {128};
+		static constexpr std::size_t tile_width {8};
+		static constexpr std::size_t tile_height {4};
+		static constexpr std::size_t max_occluders {512};
+
+		explicit occlusion_culler(std::size_t capacity);
+
+		// The candidates with the largest bounds relative to their view depth, which tend to hide the most
+		gsl::span<const std::uint32_t> select_occluders(
+			worker_pool& workers,
+			DirectX::FXMMATRIX view,
+			const sphere_set& bounds,
+			gsl::span<const std::uint32_t> candidates);
+
+		// Expects the combined view and projection matrices, with a [0, 1] clip-space depth range
+		void render_occluders(
+			worker_pool& workers,
+			DirectX::FXMMATRIX view_projection,
+			gsl::span<const aabb> occluder_bounds,
+			gsl::span<const std::uint32_t> occluders);
+
+		// Only boxes wholly in front of the near plane and behind the rendered occluders are hidden
+		bool is_occluded(const aabb& box) const noexcept;
+
+		// Keeps the candidates that are not occluded, in order; the result is only valid until the next call
+		gsl::span<const std::uint32_t>
+		cull(worker_pool& workers, gsl::span<const aabb> bounds, gsl::span<const std::uint32_t> candidates);
+
+		// The rendered depth at a pixel, where 1 is the far plane or no occluder
+		float get_depth(std::size_t x, std::size_t y) const noexcept;
+
+	private:
+		static constexpr std::size_t tiles_x {width / tile_width};
+		static constexpr std::size_t tiles_y {height / tile_height};
+		static constexpr std::size_t chunk_size {16384};
+
+		// Edge functions and depth are planes over pixel coordinates, evaluated as a * x + b * y + c
+		struct triangle {
+			std::array<std::array<float, 3>, 3> edges;
+			std::array<float, 3> depth;
+			int min_x;
+			int min_y;
+			int max_x; // Inclusive, and less than min_x when there is nothing to draw
+			int max_y;
+		};
+
+		struct pyramid_level {
+			std::size_t offset;
+			std::size_t width;
+			std::size_t height;
+		};
+
+		DirectX::XMFLOAT4X4 m_view_projection {};
+		std::vector<float> m_depth;
+		std::vector<float> m_pyramid;
+		std::vector<pyramid_level> m_levels;
+		std::vector<triangle> m_triangles;
+		std::size_t m_triangle_count {};
+		std::vector<std::pair<float, std::uint32_t>> m_occluder_keys;
+		std::vector<std::size_t> m_chunk_counts;
+		std::vector<std::uint32_t> m_occluders;
+		std::vector<std::uint32_t> m_visible;
+
+		void set_up_triangles(std::size_t occluder, const aabb& box) noexcept;
+		void rasterize_tile_row(std::size_t row) noexcept;
+		void build_pyramid() noexcept;
+	};
+}
+
+#endif
@@ -0,0 +1,565 @@
+#include "scene.h"
+
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <charconv>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <limits>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <vector>
+
+#include <gsl/gsl>
+
+#include <DirectXMath.h>
+#include <Windows.h>
+
+#include <winrt/base.h>
+
+#include "bvh.h"
+#include "frustum_culling.h"
+#include "wavefront_loader.h"
+
+namespace cube {
+	namespace {
+		constexpr std::size_t scene_alignment {64}; // A cache line, and a multiple of every SIMD width in use
+		constexpr std::array<char, 4> scene_magic {'H', 'S', 'C', 'N'};
+		constexpr std::array<char, 4> mesh_magic {'H', 'M', 'S', 'H'};
+		constexpr std::uint32_t scene_version {1};
+		constexpr std::uint32_t mesh_version {1};
+
+		struct scene_header {
+			std::array<char, 4> magic;
+			std::uint32_t version;
+			std::uint64_t instance_count;
+			std::uint64_t mesh_count;
+			std::uint64_t meshes_offset;
+			std::uint64_t strings_offset;
+			std::uint64_t strings_size;
+			std::array<std::uint64_t, scene_array_count> array_offsets;
+		};
+
+		struct scene_mesh_record {
+			std::uint64_t path_offset; // Into the string table
+			std::uint64_t path_size;
+			float radius;
+			float inner_radius;
+		};
+
+		struct mesh_header {
+			std::array<char, 4> magic;
+			std::uint32_t version;
+			std::uint32_t vertex_count;
+			std::uint32_t index_count;
+			float radius;
+			float inner_radius;
+		};
+
+		std::uint64_t align(std::uint64_t offset) noexcept
+		{
+			return (offset + scene_alignment - 1) / scene_alignment * scene_alignment;
+		}
+
+		// Written so that nothing overflows, whatever the header claims
+		bool is_in_range(std::uint64_t offset, std::uint64_t count, std::uint64_t element_size, std::uint64_t total)
+		{
+			return offset <= total && count <= (total - offset) / element_size;
+		}
+
+		void throw_invalid_scene(std::string_view reason)
+		{
+			throw std::runtime_error {"invalid scene file: " + std::string {reason}};
+		}
+
+		vector3 operator-(const vector3& a, const vector3& b) noexcept { return {a.x - b.x, a.y - b.y, a.z - b.z}; }
+
+		float dot(const vector3& a, const vector3& b) noexcept { return a.x * b.x + a.y * b.y + a.z * b.z; }
+
+		vector3 cross(const vector3& a, const vector3& b) noexcept
+		{
+			return {a.y * b.z - a.z * b.y, a.z * b.x - a.x * b.z, a.x * b.y - a.y * b.x};
+		}
+
+		std::string_view get_next(std::string_view& line) noexcept
+		{
+			const auto first = line.find_first_not_of(" \t");
+			if (first == line.npos) {
+				line = {};
+				return {};
+			}
+
+			line.remove_prefix(first);
+			const auto token = line.substr(0, line.find_first_of(" \t"));
+			line.remove_prefix(token.size());
+			return token;
+		}
+
+		class description_parser {
+		public:
+			description_parser(std::string_view line, std::size_t line_number) noexcept :
+				m_line {line}, m_line_number {line_number}
+			{
+			}
+
+			bool is_done() noexcept
+			{
+				auto rest = m_line;
+				return get_next(rest).empty();
+			}
+
+			std::string_view get_token()
+			{
+				const auto token = get_next(m_line);
+				if (token.empty())
+					fail("expected another field");
+
+				return token;
+			}
+
+			template <typename type>
+			type get_number()
+			{
+				const auto token = get_token();
+				type value {};
+				const auto last = token.data() + token.size();
+				const auto [end, error] = std::from_chars(token.data(), last, value);
+				if (error != std::errc {} || end != last)
+					fail("\"" + std::string {token} + "\" is not a valid number");
+
+				return value;
+			}
+
+			[[noreturn]] void fail(std::string_view reason) const
+			{
+				throw std::runtime_error {"line " + std::to_string(m_line_number) + ": " + std::string {reason}};
+			}
+
+		private:
+			std::string_view m_line;
+			std::size_t m_line_number;
+		};
+
+		struct mesh_entry {
+			std::string name;
+			std::string cache_path;
+			float radius;
+			float inner_radius;
+		};
+
+		// A single instance or a grid of them, expanded only as the arrays are written
+		struct placement {
+			std::uint32_t mesh;
+			std::uint32_t material;
+			std::array<float, 3> first;
+			std::array<std::uint32_t, 3> counts;
+			float spacing;
+			DirectX::XMFLOAT4 rotation;
+			float scale;
+
+			std::uint64_t size() const noexcept { return std::uint64_t {counts[0]} * counts[1] * counts[2]; }
+		};
+
+		std::uint32_t get_attribute(const placement& source, std::uint64_t index, scene_array array) noexcept
+		{
+			const std::array<std::uint64_t, 3> cell {
+				index % source.counts[0],
+				index / source.counts[0] % source.counts[1],
+				index / (std::uint64_t {source.counts[0]} * source.counts[1])};
+
+			const auto position = [&source, &cell](std::size_t axis) {
+				return std::bit_cast<std::uint32_t>(
+					source.first[axis] + gsl::narrow_cast<float>(cell[axis]) * source.spacing);
+			};
+
+			switch (array) {
+			case scene_array::position_x:
+				return position(0);
+			case scene_array::position_y:
+				return position(1);
+			case scene_array::position_z:
+				return position(2);
+			case scene_array::rotation_x:
+				return std::bit_cast<std::uint32_t>(source.rotation.x);
+			case scene_array::rotation_y:
+				return std::bit_cast<std::uint32_t>(source.rotation.y);
+			case scene_array::rotation_z:
+				return std::bit_cast<std::uint32_t>(source.rotation.z);
+			case scene_array::rotation_w:
+				return std::bit_cast<std::uint32_t>(source.rotation.w);
+			case scene_array::scale_x:
+			case scene_array::scale_y:
+			case scene_array::scale_z:
+				return std::bit_cast<std::uint32_t>(source.scale);
+			case scene_array::mesh_id:
+				return source.mesh;
+			case scene_array::material_id:
+				return source.material;
+			default:
+				return 0;
+			}
+		}
+
+		template <typename type>
+		void write_value(std::ofstream& file, const type& value)
+		{
+			file.write(reinterpret_cast<const char*>(&value), sizeof(value));
+		}
+
+		void pad_to(std::ofstream& file, std::uint64_t offset)
+		{
+			static constexpr std::array<char, scene_alignment> zeros {};
+			const auto position = gsl::narrow<std::uint64_t>(static_cast<std::streamoff>(file.tellp()));
+			Expects(position <= offset && offset - position <= zeros.size());
+			file.write(zeros.data(), gsl::narrow_cast<std::streamsize>(offset - position));
+		}
+
+		// Instances are streamed through a small buffer, so even huge grids never exist in memory all at once
+		void write_array(std::ofstream& file, gsl::span<const placement> placements, scene_array array)
+		{
+			constexpr std::size_t buffer_size {4096};
+			std::vector<std::uint32_t> buffer {};
+			buffer.reserve(buffer_size);
+			for (const auto& source : placements) {
+				for (std::uint64_t i {}, count {source.size()}; i < count; ++i) {
+					buffer.push_back(get_attribute(source, i, array));
+					if (buffer.size() == buffer_size) {
+						file.write(reinterpret_cast<const char*>(buffer.data()), buffer.size() * sizeof(buffer[0]));
+						buffer.clear();
+					}
+				}
+			}
+
+			file.write(reinterpret_cast<const char*>(buffer.data()), buffer.size() * sizeof(buffer[0]));
+		}
+
+		// An instance's box must stay inside it whichever way it is turned, so it fits the inner sphere
+		constexpr float inscribed_box_scale {0.57735026f}; // 1 / sqrt(3)
+	}
+}
+
+cube::cooked_mesh cube::cook_mesh(const wavefront& object)
+{
+	cooked_mesh mesh {.positions {object.positions}};
+	for (const auto& face : object.faces) {
+		for (const auto index : face.indices) {
+			if (index == 0 || index > object.positions.size())
+				throw std::runtime_error {"face refers to missing vertex " + std::to_string(index)};
+
+			mesh.indices.push_back(index - 1);
+		}
+	}
+
+	float radius {};
+	for (const auto& position : mesh.positions)
+		radius = std::max(radius, std::sqrt(dot(position, position)));
+
+	// Every face plane must have the origin on its inner side for a sphere to fit inside
+	auto inner_radius = std::numeric_limits<float>::max();
+	for (std::size_t i {}; i < mesh.indices.size(); i += 3) {
+		const auto& a = mesh.positions[mesh.indices[i]];
+		const auto normal = cross(mesh.positions[mesh.indices[i + 1]] - a, mesh.positions[mesh.indices[i + 2]] - a);
+		const auto length = std::sqrt(dot(normal, normal));
+		if (length == 0.0f)
+			continue;
+
+		const auto distance = dot(normal, a) / length;
+		if (!(distance > 0.0f)) {
+			inner_radius = 0.0f;
+			break;
+		}
+
+		inner_radius = std::min(inner_radius, distance);
+	}
+
+	mesh.radius = radius;
+	mesh.inner_radius = mesh.indices.empty() ? 0.0f : inner_radius;
+	return mesh;
+}
+
+void cube::write_cooked_mesh(const std::filesystem::path& path, const cooked_mesh& mesh)
+{
+	std::ofstream file {path, file.binary};
+	file.exceptions(file.badbit | file.failbit);
+	write_value(
+		file,
+		mesh_header {
+			mesh_magic,
+			mesh_version,
+			gsl::narrow<std::uint32_t>(mesh.positions.size()),
+			gsl::narrow<std::uint32_t>(mesh.indices.size()),
+			mesh.radius,
+			mesh.inner_radius});
+
+	file.write(reinterpret_cast<const char*>(mesh.positions.data()), mesh.positions.size() * sizeof(vector3));
+	file.write(reinterpret_cast<const char*>(mesh.indices.data()), mesh.indices.size() * sizeof(unsigned int));
+}
+
+cube::scene_view::scene_view(gsl::span<const std::byte> data) : m_data {data}
+{
+	Expects(reinterpret_cast<std::uintptr_t>(data.data()) % scene_alignment == 0);
+	scene_header header {};
+	if (data.size() < sizeof(header))
+		throw_invalid_scene("too small for a header");
+
+	std::memcpy(&header, data.data(), sizeof(header));
+	if (header.magic != scene_magic)
+		throw_invalid_scene("wrong magic number");
+
+	if (header.version != scene_version)
+		throw_invalid_scene("unsupported version " + std::to_string(header.version));
+
+	// Instances are indexed with 32 bits everywhere downstream
+	if (header.instance_count > std::numeric_limits<std::uint32_t>::max())
+		throw_invalid_scene("too many instances");
+
+	const auto size = data.size();
+	if (header.meshes_offset % scene_alignment != 0
+		|| !is_in_range(header.meshes_offset, header.mesh_count, sizeof(scene_mesh_record), size))
+		throw_invalid_scene("mesh table out of range");
+
+	if (!is_in_range(header.strings_offset, header.strings_size, 1, size))
+		throw_invalid_scene("string table out of range");
+
+	for (std::size_t i {}; i < scene_array_count; ++i) {
+		const auto offset = header.array_offsets[i];
+		if (offset % scene_alignment != 0 || !is_in_range(offset, header.instance_count, sizeof(float), size))
+			throw_invalid_scene("instance array out of range");
+
+		m_array_offsets[i] = gsl::narrow_cast<std::size_t>(offset);
+	}
+
+	m_instance_count = gsl::narrow_cast<std::size_t>(header.instance_count);
+	m_mesh_count = gsl::narrow_cast<std::size_t>(header.mesh_count);
+	m_meshes_offset = gsl::narrow_cast<std::size_t>(header.meshes_offset);
+	m_strings_offset = gsl::narrow_cast<std::size_t>(header.strings_offset);
+	for (std::size_t i {}; i < m_mesh_count; ++i) {
+		const auto& record = reinterpret_cast<const scene_mesh_record*>(data.data() + m_meshes_offset)[i];
+		if (!is_in_range(record.path_offset, record.path_size, 1, header.strings_size))
+			throw_invalid_scene("mesh path out of range");
+	}
+}
+
+cube::scene_mesh cube::scene_view::get_mesh(std::size_t index) const noexcept
+{
+	Expects(index < m_mesh_count);
+	const auto& record = reinterpret_cast<const scene_mesh_record*>(m_data.data() + m_meshes_offset)[index];
+	const auto path = reinterpret_cast<const char*>(m_data.data() + m_strings_offset + record.path_offset);
+	return {
+		.cache_path {path, gsl::narrow_cast<std::size_t>(record.path_size)},
+		.radius {record.radius},
+		.inner_radius {record.inner_radius}};
+}
+
+gsl::span<const float> cube::scene_view::get_floats(scene_array array) const noexcept
+{
+	Expects(array < scene_array::mesh_id);
+	const auto offset = m_array_offsets[static_cast<std::size_t>(array)];
+	return {reinterpret_cast<const float*>(m_data.data() + offset), m_instance_count};
+}
+
+gsl::span<const std::uint32_t> cube::scene_view::get_ids(scene_array array) const noexcept
+{
+	Expects(array >= scene_array::mesh_id && array < scene_array::count);
+	const auto offset = m_array_offsets[static_cast<std::size_t>(array)];
+	return {reinterpret_cast<const std::uint32_t*>(m_data.data() + offset), m_instance_count};
+}
+
+void cube::scene_file::view_unmapper::operator()(const void* data) const noexcept { UnmapViewOfFile(data); }
+
+cube::scene_file::scene_file(const std::filesystem::path& path) :
+	m_file {CreateFileW(
+		path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr)}
+{
+	winrt::check_bool(static_cast<bool>(m_file));
+	LARGE_INTEGER size {};
+	winrt::check_bool(GetFileSizeEx(m_file.get(), &size));
+	if (size.QuadPart == 0)
+		throw_invalid_scene("empty file");
+
+	m_mapping = winrt::handle {
+		winrt::check_pointer(CreateFileMappingW(m_file.get(), nullptr, PAGE_READONLY, 0, 0, nullptr))};
+
+	m_data.reset(winrt::check_pointer(MapViewOfFile(m_mapping.get(), FILE_MAP_READ, 0, 0, 0)));
+	m_view = scene_view {
+		{static_cast<const std::byte*>(m_data.get()), gsl::narrow<std::size_t>(size.QuadPart)}};
+}
+
+void cube::get_instance_bounds(
+	const scene_view& scene,
+	std::size_t first,
+	std::size_t last,
+	float mesh_radius,
+	float mesh_inner_radius,
+	sphere_set& bounds,
+	gsl::span<aabb> boxes,
+	gsl::span<aabb> occluder_boxes)
+{
+	Expects(first <= last && last <= scene.size());
+	Expects(bounds.size() >= last && boxes.size() >= last && occluder_boxes.size() >= last);
+	const auto x = scene.get_floats(scene_array::position_x);
+	const auto y = scene.get_floats(scene_array::position_y);
+	const auto z = scene.get_floats(scene_array::position_z);
+	const auto scale_x = scene.get_floats(scene_array::scale_x);
+	const auto scale_y = scene.get_floats(scene_array::scale_y);
+	const auto scale_z = scene.get_floats(scene_array::scale_z);
+	const auto mesh_ids = scene.get_ids(scene_array::mesh_id);
+	for (auto i = first; i < last; ++i) {
+		const auto mesh_id = mesh_ids[i];
+		if (mesh_id >= scene.mesh_count()) {
+			throw std::runtime_error {
+				"instance " + std::to_string(i) + " refers to missing mesh " + std::to_string(mesh_id)};
+		}
+
+		const auto sx = std::abs(scale_x[i]);
+		const auto sy = std::abs(scale_y[i]);
+		const auto sz = std::abs(scale_z[i]);
+		const auto radius = mesh_radius * std::max({sx, sy, sz});
+		const std::array center {x[i], y[i], z[i]};
+		bounds.set(i, {x[i], y[i], z[i]}, radius);
+		boxes[i] = get_sphere_bounds(center, radius);
+		occluder_boxes[i] = get_sphere_bounds(center, mesh_inner_radius * std::min({sx, sy, sz}) * inscribed_box_scale);
+	}
+}
+
+void cube::convert_scene(const std::filesystem::path& description, const std::filesystem::path& output)
+{
+	std::ifstream reader {description};
+	reader.exceptions(reader.badbit);
+	if (!reader)
+		throw std::runtime_error {"could not open " + description.string()};
+
+	const auto source_directory = std::filesystem::absolute(description).parent_path();
+	const auto output_directory = std::filesystem::absolute(output).parent_path();
+	std::vector<mesh_entry> meshes {};
+	std::vector<placement> placements {};
+	std::uint64_t instance_count {};
+	std::string text {};
+	for (std::size_t line_number {1}; std::getline(reader, text); ++line_number) {
+		std::string_view line {text};
+		if (!line.empty() && line.back() == '\r')
+			line.remove_suffix(1);
+
+		description_parser parser {line, line_number};
+		if (parser.is_done())
+			continue;
+
+		const auto type = parser.get_token();
+		if (type.front() == '#')
+			continue;
+
+		if (type == "mesh") {
+			const std::string name {parser.get_token()};
+			const auto source = source_directory / parser.get_token();
+			if (std::ranges::any_of(meshes, [&name](const mesh_entry& mesh) { return mesh.name == name; }))
+				parser.fail("mesh " + name + " is already defined");
+
+			if (!std::filesystem::is_regular_file(source))
+				parser.fail("could not find " + source.string());
+
+			auto cache = source;
+			cache.replace_extension(".mesh");
+			const auto mesh = cook_mesh(load_wavefront(source.string().c_str()));
+			write_cooked_mesh(cache, mesh);
+			meshes.push_back(
+				{.name {name},
+				 .cache_path {std::filesystem::relative(cache, output_directory).generic_string()},
+				 .radius {mesh.radius},
+				 .inner_radius {mesh.inner_radius}});
+		}
+		else if (type == "instance" || type == "grid") {
+			const auto name = parser.get_token();
+			const auto mesh = std::ranges::find(meshes, name, &mesh_entry::name);
+			if (mesh == meshes.end())
+				parser.fail("mesh " + std::string {name} + " is not defined");
+
+			placement source {
+				.mesh = gsl::narrow_cast<std::uint32_t>(mesh - meshes.begin()),
+				.material = parser.get_number<std::uint32_t>(),
+				.counts {1, 1, 1},
+				.rotation {0.0f, 0.0f, 0.0f, 1.0f},
+				.scale = 1.0f};
+
+			if (type == "instance") {
+				source.first = {parser.get_number<float>(), parser.get_number<float>(), parser.get_number<float>()};
+				if (!parser.is_done()) {
+					const auto pitch = DirectX::XMConvertToRadians(parser.get_number<float>());
+					const auto yaw = DirectX::XMConvertToRadians(parser.get_number<float>());
+					const auto roll = DirectX::XMConvertToRadians(parser.get_number<float>());
+					DirectX::XMStoreFloat4(
+						&source.rotation, DirectX::XMQuaternionRotationRollPitchYaw(pitch, yaw, roll));
+				}
+			}
+			else {
+				source.counts = {
+					parser.get_number<std::uint32_t>(),
+					parser.get_number<std::uint32_t>(),
+					parser.get_number<std::uint32_t>()};
+
+				source.spacing = parser.get_number<float>();
+				for (std::size_t axis {}; axis < 3; ++axis)
+					source.first[axis] = -0.5f * gsl::narrow_cast<float>(source.counts[axis] - 1) * source.spacing;
+
+				if (source.size() == 0)
+					parser.fail("grids must have at least one instance");
+			}
+
+			if (!parser.is_done())
+				source.scale = parser.get_number<float>();
+
+			instance_count += source.size();
+			if (instance_count > std::numeric_limits<std::uint32_t>::max())
+				parser.fail("too many instances");
+
+			placements.push_back(source);
+		}
+		else {
+			parser.fail("unknown line type " + std::string {type});
+		}
+
+		if (!parser.is_done())
+			parser.fail("unexpected extra fields");
+	}
+
+	scene_header header {
+		.magic = scene_magic,
+		.version = scene_version,
+		.instance_count = instance_count,
+		.mesh_count = meshes.size(),
+		.meshes_offset = align(sizeof(scene_header))};
+
+	header.strings_offset = header.meshes_offset + meshes.size() * sizeof(scene_mesh_record);
+	for (const auto& mesh : meshes)
+		header.strings_size += mesh.cache_path.size();
+
+	auto offset = header.strings_offset + header.strings_size;
+	for (auto& array_offset : header.array_offsets) {
+		array_offset = align(offset);
+		offset = array_offset + instance_count * sizeof(float);
+	}
+
+	std::ofstream file {output, file.binary};
+	file.exceptions(file.badbit | file.failbit);
+	write_value(file, header);
+	pad_to(file, header.meshes_offset);
+	std::uint64_t path_offset {};
+	for (const auto& mesh : meshes) {
+		write_value(file, scene_mesh_record {path_offset, mesh.cache_path.size(), mesh.radius, mesh.inner_radius});
+		path_offset += mesh.cache_path.size();
+	}
+
+	for (const auto& mesh : meshes)
+		file.write(mesh.cache_path.data(), gsl::narrow<std::streamsize>(mesh.cache_path.size()));
+
+	for (std::size_t i {}; i < scene_array_count; ++i) {
+		pad_to(file, header.array_offsets[i]);
+		write_array(file, placements, static_cast<scene_array>(i));
+	}
+}
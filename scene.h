@@ -0,0 +1,131 @@
+#ifndef HELIUM_SCENE_H
+#define HELIUM_SCENE_H
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <memory>
+#include <string_view>
+#include <vector>
+
+#include <gsl/gsl>
+
+#include <winrt/base.h>
+
+#include "bvh.h"
+#include "frustum_culling.h"
+#include "wavefront_loader.h"
+
+namespace cube {
+	// A mesh ready to upload, cooked once from its source so that loading is a straight copy
+	struct cooked_mesh {
+		std::vector<vector3> positions;
+		std::vector<unsigned int> indices; // Triangle lists, counting from zero
+		float radius; // Of the smallest sphere around the origin enclosing the mesh
+		float inner_radius; // Of the largest sphere around the origin the mesh encloses; zero if it isn't convex
+	};
+
+	cooked_mesh cook_mesh(const wavefront& object);
+	void write_cooked_mesh(const std::filesystem::path& path, const cooked_mesh& mesh);
+
+	// The per-instance arrays of a scene, in file order
+	enum class scene_array : std::size_t {
+		position_x,
+		position_y,
+		position_z,
+		rotation_x,
+		rotation_y,
+		rotation_z,
+		rotation_w,
+		scale_x,
+		scale_y,
+		scale_z,
+		mesh_id, // The first array of integers
+		material_id,
+		count
+	};
+
+	constexpr auto scene_array_count = static_cast<std::size_t>(scene_array::count);
+
+	struct scene_mesh {
+		std::string_view cache_path; // Relative to the scene file
+		float radius;
+		float inner_radius;
+	};
+
+	/*
+		A scene file is a header, a mesh table naming cooked mesh caches, and one array per instance attribute.
+		Every array starts on a 64-byte boundary, so a mapped scene is used in place: nothing is parsed or copied,
+		and opening one only checks that the header and tables are consistent with the file size.
+	*/
+	class scene_view {
+	public:
+		scene_view() = default;
+		explicit scene_view(gsl::span<const std::byte> data);
+
+		std::size_t size() const noexcept { return m_instance_count; }
+		std::size_t mesh_count() const noexcept { return m_mesh_count; }
+
+		scene_mesh get_mesh(std::size_t index) const noexcept;
+
+		gsl::span<const float> get_floats(scene_array array) const noexcept;
+		gsl::span<const std::uint32_t> get_ids(scene_array array) const noexcept;
+
+	private:
+		gsl::span<const std::byte> m_data {};
+		std::size_t m_instance_count {};
+		std::size_t m_mesh_count {};
+		std::size_t m_meshes_offset {};
+		std::size_t m_strings_offset {};
+		std::array<std::size_t, scene_array_count> m_array_offsets {};
+	};
+
+	// Maps a scene file read-only; its pages are only read from disk as they are first touched
+	class scene_file {
+	public:
+		explicit scene_file(const std::filesystem::path& path);
+
+		const scene_view& view() const noexcept { return m_view; }
+
+	private:
+		struct view_unmapper {
+			void operator()(const void* data) const noexcept;
+		};
+
+		winrt::file_handle m_file;
+		winrt::handle m_mapping;
+		std::unique_ptr<const void, view_unmapper> m_data;
+		scene_view m_view;
+	};
+
+	/*
+		Fills in the bounds of the instances in [first, last), given the radii of the mesh they are all drawn with:
+		spheres and boxes enclosing them, and boxes inside them for occluders. Throws if an instance names a mesh
+		the scene doesn't have.
+	*/
+	void get_instance_bounds(
+		const scene_view& scene,
+		std::size_t first,
+		std::size_t last,
+		float mesh_radius,
+		float mesh_inner_radius,
+		sphere_set& bounds,
+		gsl::span<aabb> boxes,
+		gsl::span<aabb> occluder_boxes);
+
+	/*
+		Converts a text description into a scene file, cooking the meshes it names next to their sources. Each line
+		is one of the following, where paths are relative to the description, angles are in degrees and scales
+		are uniform:
+
+			mesh <name> <wavefront path>
+			instance <mesh> <material> <x> <y> <z> [<pitch> <yaw> <roll> [<scale>]]
+			grid <mesh> <material> <x count> <y count> <z count> <spacing> [<scale>]
+
+		Grids are centred on the origin. Blank lines and lines starting with # are skipped.
+	*/
+	void convert_scene(const std::filesystem::path& description, const std::filesystem::path& output);
+}
+
+#endif
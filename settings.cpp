@@ -0,0 +1,145 @@
+#include "settings.h"
+
+#include <charconv>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <system_error>
+
+namespace cube {
+	namespace {
+		constexpr unsigned int max_frames_in_flight {8};
+		constexpr unsigned int max_swap_chain_buffers {16}; // DXGI_MAX_SWAP_CHAIN_BUFFERS
+		constexpr unsigned int max_frame_latency {16}; // See IDXGIDevice1::SetMaximumFrameLatency
+		constexpr unsigned int max_worker_threads {64};
+		constexpr unsigned int max_instance_count {1 << 22}; // 48 bytes of transforms each, per frame in flight
+		constexpr unsigned int max_lod_threshold {64}; // In pixels
+		constexpr unsigned int max_lod_hysteresis {90}; // In percent
+		constexpr unsigned int max_tick_rate {1000};
+
+		std::string_view get_next(std::string_view& line) noexcept
+		{
+			const auto first = line.find_first_not_of(' ');
+			if (first == line.npos) {
+				line = {};
+				return {};
+			}
+
+			line.remove_prefix(first);
+			const auto token = line.substr(0, line.find(' '));
+			line.remove_prefix(token.size());
+			return token;
+		}
+
+		unsigned int parse_count(std::string_view name, std::string_view value, unsigned int min, unsigned int max)
+		{
+			unsigned int count {};
+			const auto last = value.data() + value.size();
+			const auto [end, error] = std::from_chars(value.data(), last, count);
+			if (error != std::errc {} || end != last || count < min || count > max) {
+				throw std::invalid_argument {
+					std::string {name} + " must be between " + std::to_string(min) + " and " + std::to_string(max)};
+			}
+
+			return count;
+		}
+
+		present_mode parse_present_mode(std::string_view value)
+		{
+			if (value == "vsync")
+				return present_mode::vsync;
+			else if (value == "tearing")
+				return present_mode::tearing;
+			else if (value == "offscreen")
+				return present_mode::offscreen;
+			else
+				throw std::invalid_argument {"--present-mode must be one of vsync, tearing or offscreen"};
+		}
+
+		culling_mode parse_culling_mode(std::string_view value)
+		{
+			if (value == "none")
+				return culling_mode::none;
+			else if (value == "flat")
+				return culling_mode::flat;
+			else if (value == "hierarchy")
+				return culling_mode::hierarchy;
+			else if (value == "gpu")
+				return culling_mode::gpu;
+			else
+				throw std::invalid_argument {"--culling must be one of none, flat, hierarchy or gpu"};
+		}
+
+		std::string parse_path(std::string_view name, std::string_view value)
+		{
+			if (value.empty())
+				throw std::invalid_argument {std::string {name} + " needs a path"};
+
+			return std::string {value};
+		}
+
+		bool parse_flag(std::string_view name, std::string_view value)
+		{
+			if (!value.empty())
+				throw std::invalid_argument {std::string {name} + " does not take a value"};
+
+			return true;
+		}
+	}
+}
+
+cube::renderer_settings cube::parse_settings(std::string_view command_line)
+{
+	renderer_settings settings {};
+	while (true) {
+		const auto option = get_next(command_line);
+		if (option.empty())
+			break;
+
+		const auto separator = option.find('=');
+		const auto name = option.substr(0, separator);
+		const auto value = separator == option.npos ? std::string_view {} : option.substr(separator + 1);
+		if (name == "--frames-in-flight")
+			settings.frames_in_flight = parse_count(name, value, 1, max_frames_in_flight);
+		else if (name == "--swap-chain-buffers")
+			settings.swap_chain_buffers = parse_count(name, value, 2, max_swap_chain_buffers);
+		else if (name == "--low-latency")
+			settings.low_latency = parse_flag(name, value);
+		else if (name == "--max-frame-latency")
+			settings.max_frame_latency = parse_count(name, value, 1, max_frame_latency);
+		else if (name == "--present-mode")
+			settings.present = parse_present_mode(value);
+		else if (name == "--trace")
+			settings.trace = parse_flag(name, value);
+		else if (name == "--instances")
+			settings.instance_count = parse_count(name, value, 1, max_instance_count);
+		else if (name == "--scene")
+			settings.scene = parse_path(name, value);
+		else if (name == "--cook-scene")
+			settings.cook_scene = parse_path(name, value);
+		else if (name == "--culling")
+			settings.culling = parse_culling_mode(value);
+		else if (name == "--no-occlusion-culling")
+			settings.occlusion_culling = !parse_flag(name, value);
+		else if (name == "--validate-culling")
+			settings.validate_culling = parse_flag(name, value);
+		else if (name == "--lod-threshold")
+			settings.lod_threshold = parse_count(name, value, 0, max_lod_threshold);
+		else if (name == "--lod-hysteresis")
+			settings.lod_hysteresis = parse_count(name, value, 0, max_lod_hysteresis);
+		else if (name == "--tick-rate")
+			settings.tick_rate = parse_count(name, value, 1, max_tick_rate);
+		else if (name == "--worker-threads")
+			settings.worker_threads = parse_count(name, value, 0, max_worker_threads);
+		else if (name == "--assert-no-allocations")
+			settings.assert_no_allocations = parse_flag(name, value);
+		else
+			throw std::invalid_argument {"unknown option " + std::string {option}};
+	}
+
+	// The waitable is only signalled by presenting, so offscreen frames would each wait out its timeout
+	if (settings.low_latency && settings.present == present_mode::offscreen)
+		throw std::invalid_argument {"--low-latency can't be combined with --present-mode=offscreen"};
+
+	return settings;
+}
@@ -0,0 +1,73 @@
+#ifndef HELIUM_SETTINGS_H
+#define HELIUM_SETTINGS_H
+
+#include <string>
+#include <string_view>
+
+namespace cube {
+	enum class present_mode {
+		vsync,
+		tearing, // Uncapped, falls back to vsync if the system can't tear
+		offscreen // Renders into private targets and never presents
+	};
+
+	enum class culling_mode {
+		none,
+		flat, // Tests every instance's bounding sphere, vectorized
+		hierarchy, // Walks a bounding volume hierarchy, accepting or rejecting whole subtrees at once
+		gpu // Tests every instance's bounding sphere in a compute shader, which also writes the draws
+	};
+
+	struct renderer_settings {
+		// How many frames the CPU may record ahead of the GPU; more hides stalls, fewer cuts latency
+		unsigned int frames_in_flight {2};
+		unsigned int swap_chain_buffers {2};
+
+		// Waits on the swap chain's frame latency object before rendering each frame, and logs the latency from the
+		// tick that sampled a frame's input to the GPU finishing it; waiting needs a present mode that presents
+		bool low_latency {};
+		unsigned int max_frame_latency {1};
+
+		present_mode present {present_mode::vsync};
+
+		// Records CPU and GPU spans from startup; F8 dumps them as a Chrome trace
+		bool trace {};
+
+		// Cubes drawn with a single instanced call, laid out on a grid
+		unsigned int instance_count {1};
+
+		// Maps the instances from a scene file instead of laying out a grid, which overrides the instance count.
+		// Cooking converts a text description into a scene file next to it, then exits without rendering.
+		std::string scene {};
+		std::string cook_scene {};
+
+		// Skips instances whose bounds are outside the view; validation checks every mode against testing each
+		// instance on its own and levels of detail against the scalar reference, and refits the hierarchy every
+		// frame so that refits and rebuilds are checked too
+		culling_mode culling {culling_mode::hierarchy};
+		bool validate_culling {};
+
+		// Also skips instances hidden behind the nearest visible ones; needs CPU frustum culling to pick candidates
+		bool occlusion_culling {true};
+
+		// Culled instances are drawn at the coarsest level of detail whose error projects to at most this many
+		// pixels, and only move to a coarser level once it is this many percent under; zero keeps full detail
+		unsigned int lod_threshold {1};
+		unsigned int lod_hysteresis {25};
+
+		// Simulation ticks per second, whatever the render rate; frames are drawn a tick behind, blended between the
+		// two ticks either side
+		unsigned int tick_rate {60};
+
+		// Threads recording command lists alongside the game thread; zero picks one per spare hardware thread
+		unsigned int worker_threads {};
+
+		// Fails if simulating or rendering a frame allocates once warmed up, other than for logging and tracing
+		bool assert_no_allocations {};
+	};
+
+	// Options are of the form "--name=value" or "--name", separated by spaces; unknown options are rejected
+	renderer_settings parse_settings(std::string_view command_line);
+}
+
+#endif
@@ -0,0 +1,69 @@
+#ifndef HELIUM_SPSC_QUEUE_H
+#define HELIUM_SPSC_QUEUE_H
+
+#include <array>
+#include <atomic>
+#include <bit>
+#include <cstddef>
+#include <type_traits>
+
+namespace cube {
+	/*
+		A bounded ring between exactly one producer thread and one consumer thread, without locks or allocations.
+		Each side owns one index and only reads the other's, caching it so that most calls touch no shared cache
+		line but the item's. A full queue drops new items and counts them, so the producer never waits; items that
+		can be lost are pushed with slots held back for the ones that can't.
+	*/
+	template <typename type, std::size_t capacity>
+	class spsc_queue {
+		static_assert(std::has_single_bit(capacity), "the capacity must be a power of two");
+		static_assert(std::is_trivially_copyable_v<type>);
+
+	public:
+		// Producer only; refuses the item unless reserved slots would still be free after it
+		bool try_push(const type& item, std::size_t reserved = 0) noexcept
+		{
+			const auto limit = capacity - reserved;
+			const auto tail = m_tail.load(std::memory_order_relaxed);
+			if (tail - m_cached_head >= limit) {
+				m_cached_head = m_head.load(std::memory_order_acquire);
+				if (tail - m_cached_head >= limit) {
+					m_dropped.fetch_add(1, std::memory_order_relaxed);
+					return false;
+				}
+			}
+
+			m_items[tail % capacity] = item;
+			m_tail.store(tail + 1, std::memory_order_release);
+			return true;
+		}
+
+		// Consumer only
+		bool try_pop(type& item) noexcept
+		{
+			const auto head = m_head.load(std::memory_order_relaxed);
+			if (head == m_cached_tail) {
+				m_cached_tail = m_tail.load(std::memory_order_acquire);
+				if (head == m_cached_tail)
+					return false;
+			}
+
+			item = m_items[head % capacity];
+			m_head.store(head + 1, std::memory_order_release);
+			return true;
+		}
+
+		// Items refused since the queue was created; either side may ask
+		std::size_t dropped() const noexcept { return m_dropped.load(std::memory_order_relaxed); }
+
+	private:
+		alignas(64) std::atomic_size_t m_head {}; // Next to read, written by the consumer
+		std::size_t m_cached_tail {};
+		alignas(64) std::atomic_size_t m_tail {}; // Next to write, written by the producer
+		std::size_t m_cached_head {};
+		std::atomic_size_t m_dropped {};
+		alignas(64) std::array<type, capacity> m_items {};
+	};
+}
+
+#endif
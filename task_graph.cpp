@@ -0,0 +1,103 @@
+#include "task_graph.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <functional>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <gsl/gsl>
+
+#include "allocation_tracking.h"
+#include "trace.h"
+#include "worker_pool.h"
+
+cube::task_id cube::task_graph::add(
+	std::string name,
+	std::vector<task_id> dependencies,
+	std::function<void()> function)
+{
+	const auto id = m_tasks.size();
+	for (const auto dependency : dependencies) {
+		Expects(dependency < id);
+		m_tasks[dependency]->dependents.push_back(id);
+	}
+
+	auto& added = *m_tasks.emplace_back(std::make_unique<task>());
+	added.name = std::move(name);
+	added.dependencies = std::move(dependencies);
+	added.function = std::move(function);
+	added.runner = {this, id};
+	return id;
+}
+
+cube::task_graph_report cube::task_graph::run()
+{
+	const auto start = clock::now();
+	for (const auto& item : m_tasks) {
+		item->pending.store(item->dependencies.size(), std::memory_order_relaxed);
+		item->start = item->end = start;
+	}
+
+	m_allocations.reset();
+	const allocation_sink_scope allocations {m_allocations};
+	job_counter counter {};
+	m_counter = &counter;
+	for (const auto& item : m_tasks) {
+		if (item->dependencies.empty())
+			m_workers.submit(counter, 1, item->runner);
+	}
+
+	m_workers.wait(counter);
+	const auto end = clock::now();
+
+	// Tasks were added after their dependencies, so each one's path is known by the time it is reached
+	std::chrono::nanoseconds critical_path {};
+	for (const auto& item : m_tasks) {
+		std::chrono::nanoseconds longest {};
+		for (const auto dependency : item->dependencies)
+			longest = std::max(longest, m_tasks[dependency]->path);
+
+		item->path = longest + (item->end - item->start);
+		critical_path = std::max(critical_path, item->path);
+	}
+
+	return {end - start, critical_path, m_allocations.get_total()};
+}
+
+std::chrono::nanoseconds cube::task_graph::get_span(gsl::span<const task_id> tasks) const noexcept
+{
+	if (tasks.empty())
+		return {};
+
+	auto first = m_tasks[tasks.front()]->start;
+	auto last = m_tasks[tasks.front()]->end;
+	for (const auto id : tasks) {
+		first = std::min(first, m_tasks[id]->start);
+		last = std::max(last, m_tasks[id]->end);
+	}
+
+	return last - first;
+}
+
+void cube::task_graph::execute(task_id id)
+{
+	// A task waiting on nested work may run other tasks meanwhile, whose time then counts twice
+	auto& item = *m_tasks[id];
+	item.start = clock::now();
+	{
+		const trace_scope scope {item.name.c_str()};
+		item.function();
+	}
+
+	item.end = clock::now();
+	for (const auto dependent : item.dependents) {
+		auto& next = *m_tasks[dependent];
+		if (next.pending.fetch_sub(1, std::memory_order_acq_rel) == 1)
+			m_workers.submit(*m_counter, 1, next.runner);
+	}
+}
@@ -0,0 +1,80 @@
+#ifndef HELIUM_TASK_GRAPH_H
+#define HELIUM_TASK_GRAPH_H
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <gsl/gsl>
+
+#include "allocation_tracking.h"
+#include "worker_pool.h"
+
+namespace cube {
+	using task_id = std::size_t;
+
+	struct task_graph_report {
+		std::chrono::nanoseconds elapsed;
+		std::chrono::nanoseconds critical_path; // The longest chain of dependent tasks, which no schedule can beat
+		allocation_counters allocations; // By the tasks and any jobs they submitted, on whichever threads ran them
+	};
+
+	/*
+		Tasks and the data dependencies between them, declared once and then run as often as needed. Each task is
+		queued on the pool as soon as the last task it depends on finishes, so independent chains run side by side;
+		running never allocates. Every task is timed and traced under its name.
+	*/
+	class task_graph {
+	public:
+		explicit task_graph(worker_pool& workers) noexcept : m_workers {workers} {}
+
+		task_graph(task_graph&) = delete;
+		task_graph& operator=(task_graph&) = delete;
+
+		// Dependencies must already have been added, which keeps the graph acyclic
+		task_id add(std::string name, std::vector<task_id> dependencies, std::function<void()> function);
+
+		// Runs every task once; rethrows the first exception any of them threw, after skipping tasks that depend on it
+		task_graph_report run();
+
+		// From the first of the tasks starting to the last of them finishing, during the last run
+		std::chrono::nanoseconds get_span(gsl::span<const task_id> tasks) const noexcept;
+
+	private:
+		using clock = std::chrono::steady_clock;
+
+		// What the pool calls to run a task
+		struct task_runner {
+			task_graph* graph;
+			task_id id;
+
+			void operator()(std::size_t) const { graph->execute(id); }
+		};
+
+		struct task {
+			std::string name;
+			std::vector<task_id> dependencies;
+			std::vector<task_id> dependents;
+			std::function<void()> function;
+			task_runner runner;
+			std::atomic_size_t pending; // Dependencies yet to finish in this run
+			clock::time_point start;
+			clock::time_point end;
+			std::chrono::nanoseconds path; // The longest chain of dependencies ending with this task
+		};
+
+		worker_pool& m_workers;
+		std::vector<std::unique_ptr<task>> m_tasks {};
+		job_counter* m_counter {}; // Of the run in progress
+		allocation_sink m_allocations {}; // Of the last run
+
+		void execute(task_id id);
+	};
+}
+
+#endif
@@ -0,0 +1,200 @@
+#include "trace.h"
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include <gsl/gsl>
+
+#include "allocation_tracking.h"
+
+namespace cube {
+	namespace {
+		struct trace_event {
+			gsl::czstring<> name;
+			trace_clock::rep begin;
+			trace_clock::rep end;
+		};
+
+		/*
+			Single-producer ring; old events are overwritten. The reader skips the oldest slice of the ring, since the
+			producer may be overwriting it while the dump is being written.
+		*/
+		class trace_buffer {
+		public:
+			static constexpr std::uint64_t capacity {1 << 16};
+			static constexpr std::uint64_t read_margin {capacity / 8};
+
+			trace_buffer(std::string name, std::size_t id) : m_name {std::move(name)}, m_id {id} {}
+
+			void push(const trace_event& event) noexcept
+			{
+				const auto head = m_head.load(std::memory_order_relaxed);
+				m_events.at(head % capacity) = event;
+				m_head.store(head + 1, std::memory_order_release);
+			}
+
+			template <typename function_type>
+			void for_each(function_type function) const
+			{
+				const auto head = m_head.load(std::memory_order_acquire);
+				const auto first = head > capacity - read_margin ? head - (capacity - read_margin) : 0;
+				for (auto i = first; i < head; ++i)
+					function(m_events.at(i % capacity));
+			}
+
+			std::uint64_t size() const noexcept { return m_head.load(std::memory_order_relaxed); }
+			std::string& name() noexcept { return m_name; }
+			std::size_t id() const noexcept { return m_id; }
+
+		private:
+			std::string m_name;
+			const std::size_t m_id;
+			std::array<trace_event, capacity> m_events {};
+			std::atomic_uint64_t m_head {};
+		};
+
+		struct trace_registry {
+			std::mutex lock {};
+			std::vector<std::unique_ptr<trace_buffer>> buffers {};
+			std::atomic_bool is_enabled {};
+		};
+
+		trace_registry& get_registry()
+		{
+			static trace_registry registry {};
+			return registry;
+		}
+
+		trace_buffer& add_buffer(std::string name)
+		{
+			const allocation_tag_scope tag {allocation_tag::tracing};
+			auto& registry = get_registry();
+			const std::lock_guard lock {registry.lock};
+			const auto id = registry.buffers.size();
+			return *registry.buffers.emplace_back(std::make_unique<trace_buffer>(std::move(name), id));
+		}
+
+		// Registration is the only locking, and happens once per thread
+		trace_buffer& get_thread_buffer()
+		{
+			thread_local trace_buffer* buffer {};
+			if (!buffer)
+				buffer = &add_buffer("thread");
+
+			return *buffer;
+		}
+
+		trace_buffer& get_gpu_buffer()
+		{
+			static auto& buffer = add_buffer("GPU");
+			return buffer;
+		}
+
+		void write_escaped(std::ostream& stream, std::string_view string)
+		{
+			for (const auto character : string) {
+				if (character == '"' || character == '\\')
+					stream << '\\';
+
+				stream << character;
+			}
+		}
+	}
+}
+
+void cube::enable_tracing(bool is_enabled) noexcept
+{
+	get_registry().is_enabled.store(is_enabled, std::memory_order_relaxed);
+}
+
+bool cube::is_tracing() noexcept { return get_registry().is_enabled.load(std::memory_order_relaxed); }
+
+void cube::set_thread_trace_name(std::string_view name)
+{
+	auto& buffer = get_thread_buffer();
+	const allocation_tag_scope tag {allocation_tag::tracing};
+	const std::lock_guard lock {get_registry().lock};
+	buffer.name() = name;
+}
+
+void cube::trace_span(gsl::czstring<> name, trace_clock::time_point begin, trace_clock::time_point end) noexcept
+{
+	if (!is_tracing())
+		return;
+
+	try {
+		get_thread_buffer().push({name, begin.time_since_epoch().count(), end.time_since_epoch().count()});
+	}
+	catch (...) {
+	}
+}
+
+void cube::trace_gpu_span(gsl::czstring<> name, trace_clock::time_point begin, trace_clock::time_point end) noexcept
+{
+	if (!is_tracing())
+		return;
+
+	try {
+		get_gpu_buffer().push({name, begin.time_since_epoch().count(), end.time_since_epoch().count()});
+	}
+	catch (...) {
+	}
+}
+
+std::uint64_t cube::get_trace_span_count()
+{
+	auto& registry = get_registry();
+	const std::lock_guard lock {registry.lock};
+	std::uint64_t count {};
+	for (const auto& buffer : registry.buffers)
+		count += buffer->size();
+
+	return count;
+}
+
+void cube::write_chrome_trace(const std::filesystem::path& path)
+{
+	const allocation_tag_scope tag {allocation_tag::tracing};
+	using microseconds = std::chrono::duration<double, std::micro>;
+	const auto to_microseconds = [](trace_clock::rep time) {
+		return microseconds {trace_clock::duration {time}}.count();
+	};
+
+	std::ofstream stream {path};
+	stream.exceptions(stream.badbit | stream.failbit);
+	stream << std::fixed;
+	stream.precision(3);
+	stream << "{\"traceEvents\":[\n";
+
+	auto& registry = get_registry();
+	const std::lock_guard lock {registry.lock};
+	auto is_first = true;
+	for (const auto& buffer : registry.buffers) {
+		stream << (is_first ? "" : ",\n") << R"({"ph":"M","pid":1,"tid":)" << buffer->id()
+			   << R"(,"name":"thread_name","args":{"name":")";
+
+		write_escaped(stream, buffer->name());
+		stream << "\"}}";
+		is_first = false;
+
+		buffer->for_each([&stream, &buffer, &to_microseconds](const trace_event& event) {
+			stream << ",\n" << R"({"ph":"X","pid":1,"tid":)" << buffer->id() << R"(,"name":")";
+			write_escaped(stream, event.name);
+			stream << R"(","ts":)" << to_microseconds(event.begin) << R"(,"dur":)"
+				   << to_microseconds(std::max(event.end - event.begin, trace_clock::rep {})) << '}';
+		});
+	}
+
+	stream << "\n]}\n";
+}
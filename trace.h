@@ -0,0 +1,58 @@
+#ifndef HELIUM_TRACE_H
+#define HELIUM_TRACE_H
+
+#include <chrono>
+#include <cstdint>
+#include <filesystem>
+#include <string_view>
+
+#include <gsl/gsl>
+
+namespace cube {
+	using trace_clock = std::chrono::steady_clock;
+
+	void enable_tracing(bool is_enabled) noexcept;
+	bool is_tracing() noexcept;
+
+	void set_thread_trace_name(std::string_view name);
+
+	/*
+		Names are stored by pointer, so they must outlive the trace (in practice, they should be literals). A thread's
+		first span registers its buffer, which allocates; if that fails, the span is dropped rather than thrown.
+	*/
+	void trace_span(gsl::czstring<> name, trace_clock::time_point begin, trace_clock::time_point end) noexcept;
+
+	// Only one thread may emit GPU spans, which must already be converted to the CPU clock
+	void trace_gpu_span(gsl::czstring<> name, trace_clock::time_point begin, trace_clock::time_point end) noexcept;
+
+	// Spans recorded so far on every thread, the GPU's included; the frame rate report divides it by frames
+	std::uint64_t get_trace_span_count();
+
+	// Writes whatever the ring buffers still hold as Chrome trace event JSON (also loadable by Perfetto)
+	void write_chrome_trace(const std::filesystem::path& path);
+
+	// Reads the clock only while tracing, since the two reads cost far more than recording the span
+	class trace_scope {
+	public:
+		explicit trace_scope(gsl::czstring<> name) noexcept :
+			m_name {is_tracing() ? name : nullptr},
+			m_begin {m_name ? trace_clock::now() : trace_clock::time_point {}}
+		{
+		}
+
+		trace_scope(trace_scope&) = delete;
+		trace_scope& operator=(trace_scope&) = delete;
+
+		~trace_scope() noexcept
+		{
+			if (m_name)
+				trace_span(m_name, m_begin, trace_clock::now());
+		}
+
+	private:
+		const gsl::czstring<> m_name;
+		const trace_clock::time_point m_begin;
+	};
+}
+
+#endif
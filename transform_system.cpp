@@ -0,0 +1,177 @@
+#include "transform_system.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <vector>
+
+#include <gsl/gsl>
+
+#include <DirectXMath.h>
+
+#include "trace.h"
+#include "worker_pool.h"
+
+namespace cube {
+	namespace {
+		// Padding lanes hold identity transforms, so that every batch is full
+		std::size_t get_padded_count(std::size_t count, std::size_t lane_count) noexcept
+		{
+			return (count + lane_count - 1) / lane_count * lane_count;
+		}
+
+		DirectX::XMVECTOR load_lanes(const std::vector<float>& values, std::size_t first) noexcept
+		{
+			return DirectX::XMLoadFloat4(reinterpret_cast<const DirectX::XMFLOAT4*>(&values[first]));
+		}
+
+		// Rows of the same component for four objects in, one row per object out
+		void store_row(
+			gsl::span<DirectX::XMFLOAT3X4> world,
+			std::size_t first,
+			std::size_t row,
+			const DirectX::XMMATRIX& components) noexcept
+		{
+			const auto rows = DirectX::XMMatrixTranspose(components);
+			for (std::size_t i {}; i < 4; ++i) {
+				DirectX::XMStoreFloat4(reinterpret_cast<DirectX::XMFLOAT4*>(world[first + i].m[row]), rows.r[i]);
+			}
+		}
+	}
+}
+
+cube::transform_system::transform_system(std::size_t count) :
+	m_count {count},
+	m_positions {
+		std::vector<float>(get_padded_count(count, lane_count)),
+		std::vector<float>(get_padded_count(count, lane_count)),
+		std::vector<float>(get_padded_count(count, lane_count))},
+	m_rotations {
+		std::vector<float>(get_padded_count(count, lane_count)),
+		std::vector<float>(get_padded_count(count, lane_count)),
+		std::vector<float>(get_padded_count(count, lane_count)),
+		std::vector<float>(get_padded_count(count, lane_count), 1.0f)},
+	m_scales {
+		std::vector<float>(get_padded_count(count, lane_count), 1.0f),
+		std::vector<float>(get_padded_count(count, lane_count), 1.0f),
+		std::vector<float>(get_padded_count(count, lane_count), 1.0f)},
+	m_world(get_padded_count(count, lane_count)),
+	m_dirty_blocks((count + block_size - 1) / block_size)
+{
+	for (auto& block : m_dirty_blocks)
+		block.store(true, std::memory_order_relaxed);
+
+	m_pending_blocks.reserve(m_dirty_blocks.size());
+	m_dirty_ranges.reserve(m_dirty_blocks.size());
+}
+
+void cube::transform_system::set_position(std::size_t index, const DirectX::XMFLOAT3& position) noexcept
+{
+	m_positions.x[index] = position.x;
+	m_positions.y[index] = position.y;
+	m_positions.z[index] = position.z;
+	mark_dirty(index);
+}
+
+void cube::transform_system::set_rotation(std::size_t index, const DirectX::XMFLOAT4& rotation) noexcept
+{
+	m_rotations.x[index] = rotation.x;
+	m_rotations.y[index] = rotation.y;
+	m_rotations.z[index] = rotation.z;
+	m_rotations.w[index] = rotation.w;
+	mark_dirty(index);
+}
+
+void cube::transform_system::set_scale(std::size_t index, const DirectX::XMFLOAT3& scale) noexcept
+{
+	m_scales.x[index] = scale.x;
+	m_scales.y[index] = scale.y;
+	m_scales.z[index] = scale.z;
+	mark_dirty(index);
+}
+
+gsl::span<const cube::transform_range> cube::transform_system::update(worker_pool& workers)
+{
+	const trace_scope scope {"update transforms"};
+	m_pending_blocks.clear();
+	m_dirty_ranges.clear();
+	for (std::size_t block {}; block < m_dirty_blocks.size(); ++block) {
+		if (!m_dirty_blocks[block].exchange(false, std::memory_order_relaxed))
+			continue;
+
+		m_pending_blocks.push_back(block);
+		const auto first = block * block_size;
+		const auto count = std::min(block_size, m_count - first);
+		if (!m_dirty_ranges.empty() && m_dirty_ranges.back().first + m_dirty_ranges.back().count == first)
+			m_dirty_ranges.back().count += count;
+		else
+			m_dirty_ranges.push_back({first, count});
+	}
+
+	workers.run(m_pending_blocks.size(), [this](std::size_t task) { update_block(m_pending_blocks[task]); });
+	return m_dirty_ranges;
+}
+
+void cube::transform_system::mark_dirty(std::size_t index) noexcept
+{
+	m_dirty_blocks[index / block_size].store(true, std::memory_order_relaxed);
+}
+
+// The same as XMMatrixScaling * XMMatrixRotationQuaternion * XMMatrixTranslation, stored with XMStoreFloat3x4
+void cube::transform_system::update_block(std::size_t block) noexcept
+{
+	using namespace DirectX;
+	const auto first = block * block_size;
+	const auto last = std::min(first + block_size, m_world.size());
+	const auto one = XMVectorReplicate(1.0f);
+	for (auto i = first; i < last; i += lane_count) {
+		const auto x = load_lanes(m_rotations.x, i);
+		const auto y = load_lanes(m_rotations.y, i);
+		const auto z = load_lanes(m_rotations.z, i);
+		const auto w = load_lanes(m_rotations.w, i);
+		const auto x2 = XMVectorAdd(x, x);
+		const auto y2 = XMVectorAdd(y, y);
+		const auto z2 = XMVectorAdd(z, z);
+		const auto xx = XMVectorMultiply(x, x2);
+		const auto yy = XMVectorMultiply(y, y2);
+		const auto zz = XMVectorMultiply(z, z2);
+		const auto xy = XMVectorMultiply(x, y2);
+		const auto xz = XMVectorMultiply(x, z2);
+		const auto yz = XMVectorMultiply(y, z2);
+		const auto wx = XMVectorMultiply(w, x2);
+		const auto wy = XMVectorMultiply(w, y2);
+		const auto wz = XMVectorMultiply(w, z2);
+
+		const auto scale_x = load_lanes(m_scales.x, i);
+		const auto scale_y = load_lanes(m_scales.y, i);
+		const auto scale_z = load_lanes(m_scales.z, i);
+
+		// Each row here is one column of the rotation, scaled per axis, with the translation at the end
+		store_row(
+			m_world,
+			i,
+			0,
+			{XMVectorMultiply(scale_x, XMVectorSubtract(XMVectorSubtract(one, yy), zz)),
+			 XMVectorMultiply(scale_y, XMVectorSubtract(xy, wz)),
+			 XMVectorMultiply(scale_z, XMVectorAdd(xz, wy)),
+			 load_lanes(m_positions.x, i)});
+
+		store_row(
+			m_world,
+			i,
+			1,
+			{XMVectorMultiply(scale_x, XMVectorAdd(xy, wz)),
+			 XMVectorMultiply(scale_y, XMVectorSubtract(XMVectorSubtract(one, xx), zz)),
+			 XMVectorMultiply(scale_z, XMVectorSubtract(yz, wx)),
+			 load_lanes(m_positions.y, i)});
+
+		store_row(
+			m_world,
+			i,
+			2,
+			{XMVectorMultiply(scale_x, XMVectorSubtract(xz, wy)),
+			 XMVectorMultiply(scale_y, XMVectorAdd(yz, wx)),
+			 XMVectorMultiply(scale_z, XMVectorSubtract(XMVectorSubtract(one, xx), yy)),
+			 load_lanes(m_positions.z, i)});
+	}
+}
@@ -0,0 +1,75 @@
+#ifndef HELIUM_TRANSFORM_SYSTEM_H
+#define HELIUM_TRANSFORM_SYSTEM_H
+
+#include <atomic>
+#include <cstddef>
+#include <vector>
+
+#include <gsl/gsl>
+
+#include <DirectXMath.h>
+
+#include "worker_pool.h"
+
+namespace cube {
+	struct transform_range {
+		std::size_t first;
+		std::size_t count;
+	};
+
+	/*
+		Positions, rotations and scales of every object, each component in its own array so that local-to-world
+		matrices can be built four objects at a time. Objects are tracked in blocks; only blocks touched since the
+		last update are rebuilt.
+	*/
+	class transform_system {
+	public:
+		explicit transform_system(std::size_t count);
+
+		std::size_t size() const noexcept { return m_count; }
+
+		// Safe to call concurrently for different objects, but not during update()
+		void set_position(std::size_t index, const DirectX::XMFLOAT3& position) noexcept;
+		void set_rotation(std::size_t index, const DirectX::XMFLOAT4& rotation) noexcept; // Must be normalized
+		void set_scale(std::size_t index, const DirectX::XMFLOAT3& scale) noexcept;
+
+		// Rebuilds the dirty blocks across the pool and returns the rebuilt ranges in ascending order; the span is
+		// only valid until the next update
+		gsl::span<const transform_range> update(worker_pool& workers);
+
+		// Transposed local-to-world matrices, as the instance buffer expects them
+		gsl::span<const DirectX::XMFLOAT3X4> world() const noexcept { return {m_world.data(), m_count}; }
+
+	private:
+		// Large enough to amortize a task, small enough that sparse edits don't rebuild much
+		static constexpr std::size_t block_size {1024};
+		static constexpr std::size_t lane_count {4};
+
+		struct vector3_array {
+			std::vector<float> x;
+			std::vector<float> y;
+			std::vector<float> z;
+		};
+
+		struct quaternion_array {
+			std::vector<float> x;
+			std::vector<float> y;
+			std::vector<float> z;
+			std::vector<float> w;
+		};
+
+		const std::size_t m_count;
+		vector3_array m_positions;
+		quaternion_array m_rotations;
+		vector3_array m_scales;
+		std::vector<DirectX::XMFLOAT3X4> m_world;
+		std::vector<std::atomic_bool> m_dirty_blocks;
+		std::vector<std::size_t> m_pending_blocks {};
+		std::vector<transform_range> m_dirty_ranges {};
+
+		void mark_dirty(std::size_t index) noexcept;
+		void update_block(std::size_t block) noexcept;
+	};
+}
+
+#endif
@@ -0,0 +1,59 @@
+#ifndef HELIUM_TRIPLE_BUFFER_H
+#define HELIUM_TRIPLE_BUFFER_H
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+
+namespace cube {
+	/*
+		Hands the latest of a stream of values from one writer thread to one reader thread, without locks, waiting or
+		allocations. The writer fills the back slot and swaps it with the middle one; the reader swaps its front slot
+		with the middle one whenever that holds a value it hasn't seen. Neither ever touches the slot the other owns,
+		so the writer may overwrite values the reader skips, and the reader may see the same value more than once.
+	*/
+	template <typename type>
+	class triple_buffer {
+	public:
+		explicit triple_buffer(const type& initial) : m_slots {initial, initial, initial} {}
+
+		triple_buffer(triple_buffer&) = delete;
+		triple_buffer& operator=(triple_buffer&) = delete;
+
+		// Writer only; still holds whatever was published from it two or more publishes ago
+		type& back() noexcept { return m_slots[m_back]; }
+
+		// Writer only
+		void publish() noexcept
+		{
+			m_back = m_middle.exchange(m_back | fresh_bit, std::memory_order_acq_rel) & index_mask;
+		}
+
+		// Reader only; whether acquire() would switch to a new value
+		bool is_updated() const noexcept { return (m_middle.load(std::memory_order_relaxed) & fresh_bit) != 0; }
+
+		// Reader only; switches to the latest published value and returns whether there was a new one
+		bool acquire() noexcept
+		{
+			if (!is_updated())
+				return false;
+
+			m_front = m_middle.exchange(m_front, std::memory_order_acq_rel) & index_mask;
+			return true;
+		}
+
+		// Reader only
+		const type& front() const noexcept { return m_slots[m_front]; }
+
+	private:
+		static constexpr std::uint8_t index_mask {0b011};
+		static constexpr std::uint8_t fresh_bit {0b100}; // Set while the middle slot holds an unread value
+
+		std::array<type, 3> m_slots;
+		std::uint8_t m_front {0};
+		alignas(64) std::atomic_uint8_t m_middle {1};
+		alignas(64) std::uint8_t m_back {2};
+	};
+}
+
+#endif
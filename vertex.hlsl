@@ -4,16 +4,24 @@ cbuffer buffer : register(b0)
 	row_major float4x4 projection;
 }
 
+// Object-to-world, transposed so that it only takes three rows
+struct instance {
+	row_major float3x4 model;
+};
+
+StructuredBuffer<instance> instances : register(t0);
+
 struct vertex {
 	float4 position : SV_POSITION;
 	float3 color : COLOR;
 };
 
-vertex main(uint id : SV_VertexID, float3 position : POSITION)
+vertex main(uint id : SV_VertexID, float3 position : POSITION, uint instance : INSTANCE)
 {
 	const float3 colors[] = {float3(0.0f, 0.0f, 1.0f), float3(0.0f, 1.0f, 0.0f), float3(1.0f, 0.0f, 0.0f)};
+	const float3 world = mul(instances[instance].model, float4(position, 1.0));
 	vertex data;
-	data.position = mul(float4(position, 1.0), mul(view, projection));
+	data.position = mul(float4(world, 1.0), mul(view, projection));
 	data.color = colors[id % 3];
 	return data;
 }
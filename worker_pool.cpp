@@ -0,0 +1,328 @@
+#include "worker_pool.h"
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+
+#include "allocation_tracking.h"
+#include "trace.h"
+
+namespace cube {
+	namespace {
+		// Which pool's worker the current thread is, if any
+		struct worker_identity {
+			const worker_pool* pool;
+			std::size_t index;
+		};
+
+		thread_local worker_identity current_worker {};
+
+		// Idle workers keep looking this many times before going to sleep, since new work usually follows soon
+		constexpr std::size_t spin_count {64};
+	}
+}
+
+/*
+	From "Correct and Efficient Work-Stealing for Weak Memory Models" (Lê et al., 2013), with a fixed capacity. A full
+	deque refuses new jobs rather than growing, and its owner runs them itself. Slots are read and written through
+	relaxed atomics, since a thief may read one the owner is overwriting before its steal fails.
+*/
+class cube::worker_pool::job_deque {
+public:
+	bool push(const job& item) noexcept
+	{
+		const auto bottom = m_bottom.load(std::memory_order_relaxed);
+		const auto top = m_top.load(std::memory_order_acquire);
+		if (bottom - top >= capacity)
+			return false;
+
+		m_slots[bottom % capacity].store(item);
+		std::atomic_thread_fence(std::memory_order_release);
+		m_bottom.store(bottom + 1, std::memory_order_relaxed);
+		return true;
+	}
+
+	bool pop(job& item) noexcept
+	{
+		const auto bottom = m_bottom.load(std::memory_order_relaxed) - 1;
+		m_bottom.store(bottom, std::memory_order_relaxed);
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+		auto top = m_top.load(std::memory_order_relaxed);
+		if (top > bottom) {
+			m_bottom.store(bottom + 1, std::memory_order_relaxed);
+			return false;
+		}
+
+		item = m_slots[bottom % capacity].load();
+		if (top < bottom)
+			return true;
+
+		// The last job, which a thief may be taking at the same time
+		const auto is_taken = m_top.compare_exchange_strong(
+			top, top + 1, std::memory_order_seq_cst, std::memory_order_relaxed);
+
+		m_bottom.store(bottom + 1, std::memory_order_relaxed);
+		return is_taken;
+	}
+
+	// Leaves the job in place if only is set and the job isn't under that counter
+	bool steal(job& item, const job_counter* only) noexcept
+	{
+		auto top = m_top.load(std::memory_order_acquire);
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+		const auto bottom = m_bottom.load(std::memory_order_acquire);
+		if (top >= bottom)
+			return false;
+
+		item = m_slots[top % capacity].load();
+		if (only && item.counter != only)
+			return false;
+
+		return m_top.compare_exchange_strong(top, top + 1, std::memory_order_seq_cst, std::memory_order_relaxed);
+	}
+
+	bool is_empty() const noexcept
+	{
+		return m_top.load(std::memory_order_relaxed) >= m_bottom.load(std::memory_order_relaxed);
+	}
+
+private:
+	// Splitting halves the remaining range each time, so a deque rarely holds more than a few dozen jobs
+	static constexpr std::int64_t capacity {1024};
+
+	struct slot {
+		std::atomic<task_reference::invoke_type> invoke;
+		std::atomic<void*> context;
+		std::atomic_size_t first;
+		std::atomic_size_t last;
+		std::atomic<job_counter*> counter;
+		std::atomic<allocation_tag> tag;
+		std::atomic<allocation_sink*> sink;
+
+		void store(const job& item) noexcept
+		{
+			invoke.store(item.task.invoke, std::memory_order_relaxed);
+			context.store(item.task.context, std::memory_order_relaxed);
+			first.store(item.first, std::memory_order_relaxed);
+			last.store(item.last, std::memory_order_relaxed);
+			counter.store(item.counter, std::memory_order_relaxed);
+			tag.store(item.allocations.tag, std::memory_order_relaxed);
+			sink.store(item.allocations.sink, std::memory_order_relaxed);
+		}
+
+		job load() const noexcept
+		{
+			return {
+				{context.load(std::memory_order_relaxed), invoke.load(std::memory_order_relaxed)},
+				first.load(std::memory_order_relaxed),
+				last.load(std::memory_order_relaxed),
+				counter.load(std::memory_order_relaxed),
+				{tag.load(std::memory_order_relaxed), sink.load(std::memory_order_relaxed)}};
+		}
+	};
+
+	alignas(64) std::atomic_int64_t m_top {};
+	alignas(64) std::atomic_int64_t m_bottom {};
+	std::array<slot, capacity> m_slots {};
+};
+
+cube::worker_pool::worker_pool(std::size_t thread_count)
+{
+	m_deques.reserve(thread_count);
+	for (std::size_t i {}; i < thread_count; ++i)
+		m_deques.push_back(std::make_unique<job_deque>());
+
+	m_threads.reserve(thread_count);
+	for (std::size_t i {}; i < thread_count; ++i)
+		m_threads.emplace_back([this, i] { execute_worker(i); });
+}
+
+cube::worker_pool::~worker_pool() noexcept
+{
+	m_is_exiting.store(true);
+	m_epoch.fetch_add(1);
+	m_epoch.notify_all();
+	for (auto& thread : m_threads)
+		thread.join();
+}
+
+void cube::worker_pool::wait(job_counter& counter)
+{
+	// Threads outside the pool only help with their own jobs, so that one client never runs another's work
+	const auto only = current_worker.pool == this ? nullptr : &counter;
+	while (!counter.is_done()) {
+		job item {};
+		if (try_take(item, only))
+			execute(item);
+		else
+			std::this_thread::yield();
+	}
+
+	if (counter.m_has_error.test(std::memory_order_acquire)) {
+		counter.m_has_error.clear();
+		std::rethrow_exception(std::exchange(counter.m_error, {}));
+	}
+}
+
+void cube::worker_pool::submit_tasks(job_counter& counter, std::size_t task_count, task_reference task)
+{
+	if (task_count == 0)
+		return;
+
+	counter.m_pending.fetch_add(1, std::memory_order_relaxed);
+	const job item {task, 0, task_count, &counter, get_allocation_context()};
+	if (!push(item))
+		execute(item);
+}
+
+bool cube::worker_pool::push(const job& item)
+{
+	if (current_worker.pool == this) {
+		if (!m_deques[current_worker.index]->push(item))
+			return false;
+	} else {
+		const std::lock_guard lock {m_injected_lock};
+		const auto count = m_injected_count.load(std::memory_order_relaxed);
+		if (count == max_injected_jobs)
+			return false;
+
+		m_injected[(m_injected_first + count) % max_injected_jobs] = item;
+		m_injected_count.store(count + 1, std::memory_order_relaxed);
+	}
+
+	// Pairs with the fence a worker makes by counting itself as sleeping before its last look for work
+	std::atomic_thread_fence(std::memory_order_seq_cst);
+	if (m_sleeping_workers.load(std::memory_order_relaxed) != 0) {
+		m_epoch.fetch_add(1, std::memory_order_release);
+		m_epoch.notify_one();
+	}
+
+	return true;
+}
+
+bool cube::worker_pool::try_take(job& item, const job_counter* only)
+{
+	const auto is_worker = current_worker.pool == this;
+	if (is_worker && m_deques[current_worker.index]->pop(item))
+		return true;
+
+	if (m_injected_count.load(std::memory_order_relaxed) != 0 && take_injected(item, only))
+		return true;
+
+	// Victims are visited starting from the next worker along, which spreads thieves across them
+	const auto start = is_worker ? current_worker.index + 1 : 0;
+	for (std::size_t i {}; i < m_deques.size(); ++i) {
+		const auto victim = (start + i) % m_deques.size();
+		if ((!is_worker || victim != current_worker.index) && m_deques[victim]->steal(item, only))
+			return true;
+	}
+
+	return false;
+}
+
+// The oldest injected job, or the oldest under only if that is set; later jobs move up to close the gap
+bool cube::worker_pool::take_injected(job& item, const job_counter* only)
+{
+	const std::lock_guard lock {m_injected_lock};
+	const auto count = m_injected_count.load(std::memory_order_relaxed);
+	for (std::size_t i {}; i < count; ++i) {
+		const auto slot = (m_injected_first + i) % max_injected_jobs;
+		if (only && m_injected[slot].counter != only)
+			continue;
+
+		item = m_injected[slot];
+		for (auto j = i; j > 0; --j) {
+			m_injected[(m_injected_first + j) % max_injected_jobs]
+				= m_injected[(m_injected_first + j - 1) % max_injected_jobs];
+		}
+
+		m_injected_first = (m_injected_first + 1) % max_injected_jobs;
+		m_injected_count.store(count - 1, std::memory_order_relaxed);
+		return true;
+	}
+
+	return false;
+}
+
+bool cube::worker_pool::is_local_queue_empty() const noexcept
+{
+	if (current_worker.pool == this)
+		return m_deques[current_worker.index]->is_empty();
+
+	return m_injected_count.load(std::memory_order_relaxed) == 0;
+}
+
+void cube::worker_pool::execute(job item) noexcept
+{
+	const allocation_context_scope allocations {item.allocations};
+	auto& counter = *item.counter;
+	while (item.first < item.last) {
+		if (item.last - item.first > 1 && is_local_queue_empty()) {
+			const auto middle = item.first + (item.last - item.first) / 2;
+			counter.m_pending.fetch_add(1, std::memory_order_relaxed);
+			if (push({item.task, middle, item.last, &counter, item.allocations}))
+				item.last = middle;
+			else
+				counter.m_pending.fetch_sub(1, std::memory_order_relaxed);
+		}
+
+		try {
+			item.task.invoke(item.task.context, item.first);
+		}
+		catch (...) {
+			if (!counter.m_has_error.test_and_set(std::memory_order_relaxed))
+				counter.m_error = std::current_exception();
+		}
+
+		++item.first;
+	}
+
+	counter.m_pending.fetch_sub(1, std::memory_order_release);
+}
+
+void cube::worker_pool::execute_worker(std::size_t index)
+{
+	set_thread_trace_name("worker " + std::to_string(index));
+	current_worker = {this, index};
+	while (!m_is_exiting.load(std::memory_order_relaxed)) {
+		job item {};
+		auto is_found = false;
+		for (std::size_t i {}; i < spin_count && !is_found; ++i) {
+			is_found = try_take(item);
+			if (!is_found)
+				std::this_thread::yield();
+		}
+
+		if (is_found) {
+			execute(item);
+			continue;
+		}
+
+		// Counting itself as sleeping before the last look means a push either sees it or is seen by that look
+		const auto epoch = m_epoch.load(std::memory_order_acquire);
+		m_sleeping_workers.fetch_add(1, std::memory_order_seq_cst);
+		if (try_take(item)) {
+			m_sleeping_workers.fetch_sub(1, std::memory_order_relaxed);
+			execute(item);
+			continue;
+		}
+
+		if (!m_is_exiting.load())
+			m_epoch.wait(epoch, std::memory_order_acquire);
+
+		m_sleeping_workers.fetch_sub(1, std::memory_order_relaxed);
+	}
+}
+
+std::size_t cube::get_default_worker_count() noexcept
+{
+	return std::max(std::thread::hardware_concurrency(), 2u) - 1;
+}
@@ -0,0 +1,122 @@
+#ifndef HELIUM_WORKER_POOL_H
+#define HELIUM_WORKER_POOL_H
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+#include "allocation_tracking.h"
+
+namespace cube {
+	// Counts unfinished jobs; jobs that depend on others wait on their counter
+	class job_counter {
+	public:
+		job_counter() = default;
+
+		job_counter(job_counter&) = delete;
+		job_counter& operator=(job_counter&) = delete;
+
+		bool is_done() const noexcept { return m_pending.load(std::memory_order_acquire) == 0; }
+
+	private:
+		friend class worker_pool;
+
+		std::atomic_size_t m_pending {};
+		std::atomic_flag m_has_error {};
+		std::exception_ptr m_error {}; // Written only by whoever sets the flag
+	};
+
+	/*
+		A work-stealing job system. Each worker owns a Chase-Lev deque, pushing and popping jobs at the bottom while
+		idle threads steal from the top; threads outside the pool share a small locked queue instead. A job is a range
+		of indices over a function passed by reference, so submitting never allocates. Ranges are split lazily: the
+		thread running one hands half of what remains to its queue only when that queue is empty, so work is divided
+		as finely as stealing demands and no finer. Jobs run under their submitter's allocation tag and sink, so what
+		they allocate is counted as if the submitter had. Threads waiting on a counter run other jobs instead of
+		blocking; a thread outside the pool only runs jobs under the counter it waits on.
+	*/
+	class worker_pool {
+	public:
+		explicit worker_pool(std::size_t thread_count);
+		~worker_pool() noexcept;
+
+		worker_pool(worker_pool&) = delete;
+		worker_pool& operator=(worker_pool&) = delete;
+
+		// Counts the calling thread, which always participates
+		std::size_t size() const noexcept { return m_threads.size() + 1; }
+
+		// Queues function(i) for every i in [0, task_count) under the counter; the function must outlive the wait
+		template <typename function_type>
+		void submit(job_counter& counter, std::size_t task_count, function_type& function)
+		{
+			using pointer_type = std::add_pointer_t<function_type>;
+			submit_tasks(counter, task_count, {&function, [](void* context, std::size_t index) {
+												   (*static_cast<pointer_type>(context))(index);
+											   }});
+		}
+
+		// Runs other jobs until the counter's have all finished, then rethrows the first exception any of them threw
+		void wait(job_counter& counter);
+
+		// Calls function(i) for every i in [0, task_count) and returns once all have finished; rethrows the first
+		// exception thrown by any task
+		template <typename function_type>
+		void run(std::size_t task_count, function_type&& function)
+		{
+			job_counter counter {};
+			submit(counter, task_count, function);
+			wait(counter);
+		}
+
+	private:
+		struct task_reference {
+			using invoke_type = void (*)(void*, std::size_t);
+
+			void* context;
+			invoke_type invoke;
+		};
+
+		struct job {
+			task_reference task;
+			std::size_t first;
+			std::size_t last;
+			job_counter* counter;
+			allocation_context allocations;
+		};
+
+		class job_deque;
+
+		static constexpr std::size_t max_injected_jobs {256};
+
+		std::vector<std::unique_ptr<job_deque>> m_deques {};
+		std::mutex m_injected_lock {};
+		std::array<job, max_injected_jobs> m_injected {};
+		std::size_t m_injected_first {};
+		std::atomic_size_t m_injected_count {};
+		std::atomic_uint32_t m_epoch {}; // Bumped whenever sleeping workers should look for work again
+		std::atomic_size_t m_sleeping_workers {};
+		std::atomic_bool m_is_exiting {};
+		std::vector<std::thread> m_threads {};
+
+		void submit_tasks(job_counter& counter, std::size_t task_count, task_reference task);
+		bool push(const job& item);
+		bool try_take(job& item, const job_counter* only = nullptr);
+		bool take_injected(job& item, const job_counter* only);
+		bool is_local_queue_empty() const noexcept;
+		void execute(job item) noexcept;
+		void execute_worker(std::size_t index);
+	};
+
+	// One fewer than the hardware threads, leaving room for the thread that dispatches work
+	std::size_t get_default_worker_count() noexcept;
+}
+
+#endif